@@ -0,0 +1,169 @@
+// best_first.h
+// Best-first (anytime) builder. Instead of splitting every block over a fixed
+// threshold, it keeps the leaves in a max-heap keyed by squared error and
+// always splits the worst one, until a leaf count, a byte budget or a
+// deadline is reached. After every split the tree is complete and valid, so
+// the build can stop at any point with the best tree found for its size.
+//
+// Unlike buildQT, the number of leaves is chosen by the caller; with no limit
+// the build runs until every splittable leaf is flat.
+#pragma once
+
+#include "qtc_format.h"
+
+#include <chrono>
+#include <queue>
+
+struct BestFirstLimits
+{
+    size_t maxLeaves = 0; // 0 = no limit
+    size_t maxBytes = 0;  // native tree bytes (qtcBytes); 0 = no limit
+    double maxMs = 0;     // wall clock; 0 = no limit
+};
+
+enum BestFirstStop
+{
+    BEST_FIRST_COMPLETE, // no leaf left to split
+    BEST_FIRST_LEAVES,
+    BEST_FIRST_BYTES,
+    BEST_FIRST_DEADLINE,
+};
+
+inline const char *bestFirstStopName(int s)
+{
+    static const char *names[] = {"complete", "leaves", "bytes", "deadline"};
+    return s >= 0 && s <= BEST_FIRST_DEADLINE ? names[s] : "?";
+}
+
+struct BestFirstBuilder
+{
+    struct Item
+    {
+        double sse;    // key: summed over channels
+        double ch[3];  // per channel, taken off the totals on a split
+        Node *n;
+        bool operator<(const Item &o) const { return sse < o.sse; }
+    };
+
+    ImageView px;
+    int minLeaf = 1;
+    Node *root = nullptr; // owned by the caller once built
+    size_t nodes = 0, leaves = 0, splits = 0;
+    double sse[3] = {0, 0, 0}; // squared error of the current tree per channel
+
+    // Starts over with the whole image as one leaf.
+    void start(const ImageView &image, int leafSize)
+    {
+        px = image;
+        minLeaf = std::max(1, leafSize);
+        heap = std::priority_queue<Item>();
+        sse[0] = sse[1] = sse[2] = 0;
+        root = makeLeaf(0, 0, px.W, px.H);
+        nodes = leaves = 1;
+        splits = 0;
+    }
+
+    bool done() const { return heap.empty(); }
+    double totalSSE() const { return sse[0] + sse[1] + sse[2]; }
+
+    // Children a split of the worst leaf would add (0 when nothing is left).
+    int nextChildren() const
+    {
+        if (heap.empty())
+            return 0;
+        const Node *n = heap.top().n;
+        int r[4][4], k = 0;
+        childRects(n->x, n->y, n->w, n->h, r);
+        for (int i = 0; i < 4; ++i)
+            k += rectInImage(px.W, px.H, r[i][0], r[i][1], r[i][2], r[i][3]);
+        return k;
+    }
+
+    // Splits the leaf with the largest error. False when none is left.
+    bool step()
+    {
+        if (heap.empty())
+            return false;
+        const Item top = heap.top();
+        heap.pop();
+        Node *n = top.n;
+        int r[4][4];
+        childRects(n->x, n->y, n->w, n->h, r);
+        for (int c = 0; c < 3; ++c)
+            sse[c] -= top.ch[c];
+        leaves--;
+        for (int i = 0; i < 4; ++i)
+            if (rectInImage(px.W, px.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            {
+                n->ch[i] = makeLeaf(r[i][0], r[i][1], r[i][2], r[i][3]);
+                nodes++;
+                leaves++;
+            }
+        n->leaf = false; // only now: the tree stays valid between steps
+        splits++;
+        return true;
+    }
+
+    // Splits until a limit would be exceeded; returns the BestFirstStop reason.
+    int run(const BestFirstLimits &lim)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        const auto deadline = t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                       std::chrono::duration<double, std::milli>(lim.maxMs));
+        for (;;)
+        {
+            const int k = nextChildren();
+            if (k == 0)
+                return BEST_FIRST_COMPLETE;
+            if (lim.maxLeaves && leaves + k - 1 > lim.maxLeaves)
+                return BEST_FIRST_LEAVES;
+            if (lim.maxBytes && qtcBytes(nodes + k, leaves + k - 1) > lim.maxBytes)
+                return BEST_FIRST_BYTES;
+            // the clock is cheap next to a split, which reads the whole block
+            if (lim.maxMs > 0 && std::chrono::steady_clock::now() >= deadline)
+                return BEST_FIRST_DEADLINE;
+            step();
+        }
+    }
+
+private:
+    std::priority_queue<Item> heap; // splittable leaves
+
+    Node *makeLeaf(int x, int y, int w, int h)
+    {
+        Node *n = new Node();
+        n->x = x;
+        n->y = y;
+        n->w = w;
+        n->h = h;
+        n->leaf = true;
+        const BlockStats bs = blockStats(px, x, y, w, h);
+        n->avg = bs.mean();
+        Item it{0, {bs.sse(0), bs.sse(1), bs.sse(2)}, n};
+        for (int c = 0; c < 3; ++c)
+        {
+            sse[c] += it.ch[c];
+            it.sse += it.ch[c];
+        }
+        if (it.sse > 0 && w > minLeaf && h > minLeaf && w / 2 > 0 && h / 2 > 0)
+            heap.push(it);
+        return n;
+    }
+};
+
+// Builds a tree of the image within the limits (see BestFirstBuilder).
+inline Node *buildQTBestFirst(const ImageView &px, int minLeaf, const BestFirstLimits &lim, BuildStats &stats,
+                              int *stop = nullptr)
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
+    BestFirstBuilder b;
+    b.start(px, minLeaf);
+    const int why = b.run(lim);
+    if (stop)
+        *stop = why;
+    stats.nodes = b.nodes;
+    stats.leaves = b.leaves;
+    std::copy(b.sse, b.sse + 3, stats.sse);
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+    return b.root;
+}
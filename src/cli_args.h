@@ -0,0 +1,70 @@
+// cli_args.h
+// Command line parsing shared by the viewer's headless mode and the
+// standalone tools: positional arguments plus "--name value" options.
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct HeadlessArgs
+{
+    std::string cmd;
+    std::vector<std::string> pos;
+    std::vector<std::pair<std::string, std::string>> opts;
+
+    const char *get(const char *key) const
+    {
+        for (const auto &kv : opts)
+            if (kv.first == key)
+                return kv.second.c_str();
+        return nullptr;
+    }
+    int getInt(const char *key, int def) const
+    {
+        const char *v = get(key);
+        return v ? std::atoi(v) : def;
+    }
+    double getDouble(const char *key, double def) const
+    {
+        const char *v = get(key);
+        return v ? std::atof(v) : def;
+    }
+    bool has(const char *key) const { return get(key) != nullptr; }
+    // "1,2,4" -> {1, 2, 4}; empty when the option is absent.
+    std::vector<double> getList(const char *key) const
+    {
+        std::vector<double> out;
+        const char *v = get(key);
+        while (v && *v)
+        {
+            char *end = nullptr;
+            const double d = std::strtod(v, &end);
+            if (end == v)
+                break;
+            out.push_back(d);
+            v = *end == ',' ? end + 1 : end;
+        }
+        return out;
+    }
+};
+
+// Parses argv[first..]: "--name value" pairs; an option followed by another
+// option (or nothing) is a flag.
+inline HeadlessArgs parseArgs(int argc, char **argv, int first)
+{
+    HeadlessArgs a;
+    for (int i = first; i < argc; ++i)
+    {
+        std::string s = argv[i];
+        if (s.rfind("--", 0) == 0)
+        {
+            const bool hasValue = i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0;
+            a.opts.emplace_back(s.substr(2), hasValue ? argv[++i] : "1");
+        }
+        else
+            a.pos.push_back(s);
+    }
+    return a;
+}
@@ -0,0 +1,376 @@
+// deflate.h
+// Small raw-deflate encoder (RFC 1951, fixed Huffman codes) built for
+// parallel use: a call compresses one byte range that may look back into a
+// preset dictionary (the 32 KB before it), and ends either with a sync flush
+// (empty stored block, byte aligned) or with the final block. Ranges
+// compressed independently therefore concatenate into one valid stream, and
+// their Adler-32 values combine with adler32Combine().
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ---------------- Checksums ----------------
+inline uint32_t adler32(uint32_t adler, const uint8_t *p, size_t n)
+{
+    uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+    while (n > 0)
+    {
+        const size_t k = std::min<size_t>(n, 5552); // largest run without 32-bit overflow
+        for (size_t i = 0; i < k; ++i)
+        {
+            s1 += p[i];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+        p += k;
+        n -= k;
+    }
+    return (s2 << 16) | s1;
+}
+
+// Adler-32 of A||B from adler(A), adler(B) and len(B) (as in zlib).
+inline uint32_t adler32Combine(uint32_t a1, uint32_t a2, uint64_t len2)
+{
+    const uint32_t BASE = 65521;
+    const uint32_t rem = (uint32_t)(len2 % BASE);
+    uint32_t sum1 = a1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % BASE);
+    sum1 += (a2 & 0xffff) + BASE - 1;
+    sum2 += (a1 >> 16) + (a2 >> 16) + BASE - rem;
+    if (sum1 >= BASE)
+        sum1 -= BASE;
+    if (sum1 >= BASE)
+        sum1 -= BASE;
+    if (sum2 >= 2 * BASE)
+        sum2 -= 2 * BASE;
+    if (sum2 >= BASE)
+        sum2 -= BASE;
+    return sum1 | (sum2 << 16);
+}
+
+inline uint32_t crc32Update(uint32_t crc, const uint8_t *p, size_t n)
+{
+    static const auto table = []
+    {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// ---------------- Encoder ----------------
+struct DeflateParams
+{
+    int maxChain = 32;  // hash-chain candidates examined per position
+    int niceLen = 64;   // stop searching once a match is this long
+    bool lazy = true;   // defer a match if the next position has a longer one
+    bool stored = false; // level 0: stored blocks only
+};
+
+// zlib-style levels 0..9.
+inline DeflateParams deflateParamsForLevel(int level)
+{
+    static const int chain[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+    static const int nice[10] = {0, 8, 16, 32, 64, 128, 128, 258, 258, 258};
+    level = std::clamp(level, 0, 9);
+    DeflateParams p;
+    p.stored = level == 0;
+    p.maxChain = chain[level];
+    p.niceLen = nice[level];
+    p.lazy = level >= 4;
+    return p;
+}
+
+namespace deflate_detail
+{
+    constexpr int WINDOW = 32768;
+    constexpr int HASH_BITS = 15;
+    constexpr int MIN_MATCH = 3, MAX_MATCH = 258;
+
+    static const uint16_t kLenBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t kLenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t kDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                           193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+                                           4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    inline uint32_t reverseBits(uint32_t v, int n)
+    {
+        uint32_t r = 0;
+        for (int i = 0; i < n; ++i, v >>= 1)
+            r = (r << 1) | (v & 1);
+        return r;
+    }
+
+    // Fixed Huffman codes (RFC 1951 3.2.6), pre-reversed for LSB-first output.
+    struct FixedCodes
+    {
+        uint16_t lit[288];
+        uint8_t litLen[288];
+        uint8_t dist[30];
+        uint8_t lenSym[MAX_MATCH + 1]; // match length -> index into kLenBase
+        uint8_t distSym[512];          // see distSymbol()
+
+        FixedCodes()
+        {
+            for (int n = 0; n < 288; ++n)
+            {
+                uint32_t code;
+                int len;
+                if (n <= 143)
+                    code = 0x30 + n, len = 8;
+                else if (n <= 255)
+                    code = 0x190 + (n - 144), len = 9;
+                else if (n <= 279)
+                    code = n - 256, len = 7;
+                else
+                    code = 0xC0 + (n - 280), len = 8;
+                lit[n] = (uint16_t)reverseBits(code, len);
+                litLen[n] = (uint8_t)len;
+            }
+            for (int d = 0; d < 30; ++d)
+                dist[d] = (uint8_t)reverseBits(d, 5);
+            for (int l = MIN_MATCH; l <= MAX_MATCH; ++l)
+            {
+                int s = 28;
+                while (kLenBase[s] > l)
+                    --s;
+                lenSym[l] = (uint8_t)s;
+            }
+            // distances 1..256 directly, larger ones by (d-1) >> 7
+            for (int i = 0; i < 512; ++i)
+            {
+                const int d = i < 256 ? i + 1 : ((i - 256) << 7) + 1;
+                int s = 29;
+                while (kDistBase[s] > d)
+                    --s;
+                distSym[i] = (uint8_t)s;
+            }
+        }
+
+        int distSymbol(int d) const { return d <= 256 ? distSym[d - 1] : distSym[256 + ((d - 1) >> 7)]; }
+    };
+
+    inline const FixedCodes &fixedCodes()
+    {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    struct BitWriter
+    {
+        std::vector<uint8_t> &out;
+        uint64_t buf = 0;
+        int count = 0;
+
+        explicit BitWriter(std::vector<uint8_t> &o) : out(o) {}
+
+        void put(uint32_t bits, int n)
+        {
+            buf |= (uint64_t)bits << count;
+            count += n;
+            while (count >= 8)
+            {
+                out.push_back((uint8_t)buf);
+                buf >>= 8;
+                count -= 8;
+            }
+        }
+        void alignByte()
+        {
+            if (count > 0)
+                put(0, 8 - count);
+        }
+    };
+
+    inline uint32_t hash3(const uint8_t *p)
+    {
+        const uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    inline void storedBlocks(BitWriter &bw, const uint8_t *p, size_t n, bool final)
+    {
+        do
+        {
+            const size_t len = std::min<size_t>(n, 65535);
+            const bool last = final && len == n;
+            bw.put(last ? 1 : 0, 1);
+            bw.put(0, 2); // BTYPE = 00
+            bw.alignByte();
+            bw.put((uint32_t)len, 16);
+            bw.put((uint32_t)~len & 0xffff, 16);
+            bw.out.insert(bw.out.end(), p, p + len);
+            p += len;
+            n -= len;
+        } while (n > 0);
+    }
+}
+
+// Compresses buf[start, end) as raw deflate, appending to `out`. Matches may
+// reach back to buf[dictStart] (at most 32 KB before start). With final=false
+// the output ends in a sync flush so another range can follow directly.
+inline void deflateRange(const uint8_t *buf, size_t dictStart, size_t start, size_t end,
+                         bool final, const DeflateParams &p, std::vector<uint8_t> &out)
+{
+    using namespace deflate_detail;
+    BitWriter bw(out);
+    if (p.stored)
+    {
+        storedBlocks(bw, buf + start, end - start, final);
+        if (!final)
+            storedBlocks(bw, nullptr, 0, false); // sync flush marker
+        bw.alignByte();
+        return;
+    }
+
+    const FixedCodes &fc = fixedCodes();
+    const size_t outStart = out.size();
+    dictStart = std::max(dictStart, start > (size_t)WINDOW ? start - WINDOW : 0);
+
+    std::vector<int32_t> head((size_t)1 << HASH_BITS, -1);
+    std::vector<int32_t> prev(WINDOW, -1);
+    // positions are stored relative to dictStart
+    auto insert = [&](size_t pos)
+    {
+        const uint32_t h = hash3(buf + pos);
+        const int32_t rel = (int32_t)(pos - dictStart);
+        prev[rel & (WINDOW - 1)] = head[h];
+        head[h] = rel;
+    };
+    for (size_t pos = dictStart; pos + MIN_MATCH <= start; ++pos)
+        insert(pos);
+
+    auto longestMatch = [&](size_t pos, int &dist) -> int
+    {
+        const size_t limit = std::min<size_t>(MAX_MATCH, end - pos);
+        if (limit < (size_t)MIN_MATCH)
+            return 0;
+        int best = 0;
+        int32_t cand = head[hash3(buf + pos)];
+        const int32_t rel = (int32_t)(pos - dictStart);
+        for (int chain = p.maxChain; cand >= 0 && chain > 0; --chain)
+        {
+            const int d = rel - cand;
+            if (d <= 0 || d > WINDOW)
+                break;
+            const uint8_t *a = buf + pos, *b = a - d;
+            if (b[best] == a[best])
+            {
+                size_t l = 0;
+                while (l < limit && a[l] == b[l])
+                    ++l;
+                if ((int)l > best)
+                {
+                    best = (int)l;
+                    dist = d;
+                    if (best >= p.niceLen || (size_t)best == limit)
+                        break;
+                }
+            }
+            cand = prev[cand & (WINDOW - 1)];
+        }
+        return best >= MIN_MATCH ? best : 0;
+    };
+
+    bw.put(final ? 1 : 0, 1);
+    bw.put(1, 2); // BTYPE = 01, fixed Huffman
+
+    size_t pos = start;
+    while (pos < end)
+    {
+        int dist = 0;
+        int len = pos + MIN_MATCH <= end ? longestMatch(pos, dist) : 0;
+        if (len && p.lazy && len < p.niceLen && pos + 1 + MIN_MATCH <= end)
+        {
+            int dist2 = 0;
+            if (pos + MIN_MATCH <= end)
+                insert(pos);
+            const int len2 = longestMatch(pos + 1, dist2);
+            if (len2 > len)
+            {
+                bw.put(fc.lit[buf[pos]], fc.litLen[buf[pos]]);
+                ++pos;
+                len = len2;
+                dist = dist2;
+            }
+            else
+            {
+                // pos was already inserted above; emit the match from here
+                const int ls = fc.lenSym[len];
+                bw.put(fc.lit[257 + ls], fc.litLen[257 + ls]);
+                if (kLenExtra[ls])
+                    bw.put((uint32_t)(len - kLenBase[ls]), kLenExtra[ls]);
+                const int ds = fc.distSymbol(dist);
+                bw.put(fc.dist[ds], 5);
+                if (kDistExtra[ds])
+                    bw.put((uint32_t)(dist - kDistBase[ds]), kDistExtra[ds]);
+                for (size_t k = pos + 1; k < pos + (size_t)len && k + MIN_MATCH <= end; ++k)
+                    insert(k);
+                pos += (size_t)len;
+                continue;
+            }
+        }
+        if (len)
+        {
+            const int ls = fc.lenSym[len];
+            bw.put(fc.lit[257 + ls], fc.litLen[257 + ls]);
+            if (kLenExtra[ls])
+                bw.put((uint32_t)(len - kLenBase[ls]), kLenExtra[ls]);
+            const int ds = fc.distSymbol(dist);
+            bw.put(fc.dist[ds], 5);
+            if (kDistExtra[ds])
+                bw.put((uint32_t)(dist - kDistBase[ds]), kDistExtra[ds]);
+            for (size_t k = pos; k < pos + (size_t)len && k + MIN_MATCH <= end; ++k)
+                insert(k);
+            pos += (size_t)len;
+        }
+        else
+        {
+            if (pos + MIN_MATCH <= end)
+                insert(pos);
+            bw.put(fc.lit[buf[pos]], fc.litLen[buf[pos]]);
+            ++pos;
+        }
+    }
+    bw.put(fc.lit[256], fc.litLen[256]); // end of block
+
+    if (!final)
+    {
+        bw.put(0, 3); // empty stored block = sync flush
+        bw.alignByte();
+        bw.put(0x0000, 16);
+        bw.put(0xffff, 16);
+    }
+    bw.alignByte();
+
+    // incompressible range: redo it as stored blocks
+    const size_t raw = end - start;
+    if (out.size() - outStart > raw + 5 * (raw / 65535 + 1) + 5)
+    {
+        out.resize(outStart);
+        BitWriter sw(out);
+        storedBlocks(sw, buf + start, raw, final);
+        if (!final)
+            storedBlocks(sw, nullptr, 0, false);
+        sw.alignByte();
+    }
+}
@@ -0,0 +1,163 @@
+// deflate_backend.h
+// Selects the deflate implementation behind PNG export: the built-in encoder
+// (deflate.h, always present), system zlib (QT_HAVE_ZLIB) or libdeflate
+// (QT_HAVE_LIBDEFLATE), both detected at configure time. zlib supports preset
+// dictionaries and sync flushes, so it drops into the parallel strip writer;
+// libdeflate only compresses whole buffers, so with it the image is one stream
+// and the full raster is materialized. The default is therefore a strip
+// backend; libdeflate is used only when asked for.
+#pragma once
+
+#include "deflate.h"
+
+#include <string>
+
+#ifdef QT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef QT_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+enum DeflateBackend
+{
+    DEFLATE_BUILTIN,
+    DEFLATE_ZLIB,
+    DEFLATE_LIBDEFLATE,
+    DEFLATE_BACKEND_COUNT
+};
+
+inline const char *deflateBackendName(int b)
+{
+    static const char *names[DEFLATE_BACKEND_COUNT] = {"builtin", "zlib", "libdeflate"};
+    return b >= 0 && b < DEFLATE_BACKEND_COUNT ? names[b] : "?";
+}
+
+inline bool deflateBackendAvailable(int b)
+{
+    switch (b)
+    {
+    case DEFLATE_BUILTIN:
+        return true;
+#ifdef QT_HAVE_ZLIB
+    case DEFLATE_ZLIB:
+        return true;
+#endif
+#ifdef QT_HAVE_LIBDEFLATE
+    case DEFLATE_LIBDEFLATE:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+inline bool parseDeflateBackend(const std::string &s, int &b)
+{
+    for (int i = 0; i < DEFLATE_BACKEND_COUNT; ++i)
+        if (s == deflateBackendName(i))
+        {
+            b = i;
+            return true;
+        }
+    return false;
+}
+
+// Fastest strip-capable backend compiled in: zlib, then the built-in one.
+// Streaming export keeps memory at O(strip) and uses every core only with these.
+inline int defaultDeflateBackend()
+{
+    if (deflateBackendAvailable(DEFLATE_ZLIB))
+        return DEFLATE_ZLIB;
+    return DEFLATE_BUILTIN;
+}
+
+// Strip writers need dictionary priming and sync flushes (see deflateRange).
+inline bool deflateBackendSupportsStrips(int b)
+{
+    return b == DEFLATE_BUILTIN || (b == DEFLATE_ZLIB && deflateBackendAvailable(DEFLATE_ZLIB));
+}
+
+// deflateRange() on the chosen backend; falls back to the built-in encoder.
+inline void deflateStrip(int backend, const uint8_t *buf, size_t dictStart, size_t start, size_t end,
+                         bool final, int level, std::vector<uint8_t> &out)
+{
+#ifdef QT_HAVE_ZLIB
+    if (backend == DEFLATE_ZLIB)
+    {
+        z_stream zs{};
+        if (deflateInit2(&zs, std::clamp(level, 0, 9), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            dictStart = std::max(dictStart, start > 32768 ? start - 32768 : 0);
+            if (start > dictStart)
+                deflateSetDictionary(&zs, buf + dictStart, (uInt)(start - dictStart));
+            const size_t base = out.size();
+            out.resize(base + deflateBound(&zs, (uLong)(end - start)) + 16);
+            zs.next_in = const_cast<Bytef *>(buf + start);
+            zs.avail_in = (uInt)(end - start);
+            int rc;
+            do
+            {
+                if (zs.total_out + 16 > out.size() - base)
+                    out.resize(out.size() * 2);
+                zs.next_out = out.data() + base + zs.total_out;
+                zs.avail_out = (uInt)(out.size() - base - zs.total_out);
+                rc = deflate(&zs, final ? Z_FINISH : Z_SYNC_FLUSH);
+            } while (final ? rc == Z_OK : (rc == Z_OK && zs.avail_out == 0));
+            out.resize(base + zs.total_out);
+            deflateEnd(&zs);
+            if (rc == Z_STREAM_END || (!final && rc == Z_OK))
+                return;
+            out.resize(base);
+        }
+    }
+#endif
+    (void)backend;
+    deflateRange(buf, dictStart, start, end, final, deflateParamsForLevel(level), out);
+}
+
+// Complete zlib stream (header, deflate data, Adler-32) of one buffer.
+inline bool zlibCompressBuffer(int backend, const uint8_t *data, size_t n, int level, std::vector<uint8_t> &out)
+{
+    out.clear();
+#ifdef QT_HAVE_LIBDEFLATE
+    if (backend == DEFLATE_LIBDEFLATE)
+    {
+        // libdeflate levels run 1..12; 10-12 are its slow near-optimal parsers
+        libdeflate_compressor *c = libdeflate_alloc_compressor(std::clamp(level <= 9 ? level : 12, 1, 12));
+        if (c)
+        {
+            out.resize(libdeflate_zlib_compress_bound(c, n));
+            const size_t got = libdeflate_zlib_compress(c, data, n, out.data(), out.size());
+            libdeflate_free_compressor(c);
+            if (got)
+            {
+                out.resize(got);
+                return true;
+            }
+        }
+        out.clear();
+    }
+#endif
+#ifdef QT_HAVE_ZLIB
+    if (backend == DEFLATE_ZLIB)
+    {
+        uLongf len = compressBound((uLong)n);
+        out.resize(len);
+        if (compress2(out.data(), &len, data, (uLong)n, std::clamp(level, 0, 9)) == Z_OK)
+        {
+            out.resize(len);
+            return true;
+        }
+        out.clear();
+    }
+#endif
+    (void)backend;
+    out.push_back(0x78);
+    out.push_back(0x01);
+    deflateRange(data, 0, 0, n, true, deflateParamsForLevel(level), out);
+    const uint32_t adler = adler32(1, data, n);
+    for (int s = 24; s >= 0; s -= 8)
+        out.push_back((uint8_t)(adler >> s));
+    return true;
+}
@@ -0,0 +1,158 @@
+// http.h
+// Just enough HTTP/1.1 over POSIX sockets for the tile server and its load
+// generator: GET requests, Content-Length bodies and keep-alive connections.
+// No chunked encoding, TLS or request bodies beyond Content-Length.
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Listening socket on host:port, or -1.
+inline int httpListen(const std::string &host, int port, int backlog = 256)
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, backlog) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connected socket to host:port (Nagle off), or -1.
+inline int httpConnect(const std::string &host, int port)
+{
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+        return -1;
+    int fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+    {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+inline bool sendAll(int fd, const void *data, size_t n)
+{
+    const char *p = static_cast<const char *>(data);
+    while (n > 0)
+    {
+        const ssize_t k = ::send(fd, p, n, 0);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= (size_t)k;
+    }
+    return true;
+}
+
+// Value of header `name` (case-insensitive) in a message head, or "".
+inline std::string httpHeader(const std::string &head, const char *name)
+{
+    const size_t len = std::strlen(name);
+    for (size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2))
+    {
+        const size_t line = pos + 2;
+        if (line + len < head.size() && head[line + len] == ':' &&
+            strncasecmp(head.c_str() + line, name, len) == 0)
+        {
+            size_t v = line + len + 1;
+            while (v < head.size() && head[v] == ' ')
+                ++v;
+            return head.substr(v, head.find("\r\n", v) - v);
+        }
+    }
+    return "";
+}
+
+// Complete message (head + Content-Length body) at the start of buf: returns
+// its total size and the head size, or 0 while more bytes are needed.
+inline size_t httpMessageSize(const std::string &buf, size_t &headLen)
+{
+    const size_t end = buf.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return 0;
+    headLen = end + 4;
+    const std::string cl = httpHeader(buf.substr(0, headLen), "Content-Length");
+    const size_t total = headLen + (cl.empty() ? 0 : std::strtoull(cl.c_str(), nullptr, 10));
+    return buf.size() >= total ? total : 0;
+}
+
+// Reads until buf starts with a complete message (bytes of the next one may
+// follow). Returns false on EOF, error or a head over maxHead bytes.
+inline bool httpReadMessage(int fd, std::string &buf, size_t &headLen, size_t &total, size_t maxHead = 16384)
+{
+    char tmp[65536];
+    while ((total = httpMessageSize(buf, headLen)) == 0)
+    {
+        if (buf.find("\r\n\r\n") == std::string::npos && buf.size() > maxHead)
+            return false;
+        const ssize_t k = ::recv(fd, tmp, sizeof(tmp), 0);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        buf.append(tmp, (size_t)k);
+    }
+    return true;
+}
+
+inline const char *httpReason(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+inline std::string httpResponseHead(int status, const char *contentType, size_t length, bool keepAlive,
+                                    const char *extra = "")
+{
+    char head[512];
+    std::snprintf(head, sizeof(head),
+                  "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n%s\r\n", status,
+                  httpReason(status), contentType, length, keepAlive ? "keep-alive" : "close", extra);
+    return head;
+}
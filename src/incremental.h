@@ -0,0 +1,285 @@
+// incremental.h
+// A tree that can follow edits to its image without a full rebuild. Every
+// node's block statistics (pixel count, channel sums and sums of squares) are
+// kept beside the tree; after pixels change, only the nodes over the dirty
+// area are revisited. Subtrees outside it are carried over untouched, rebuilt
+// subtrees come from makeNodeQT as usual, and a changed ancestor re-decides
+// leaf vs split from its children's merged statistics. The result is always
+// the tree buildQT would give for the edited image.
+//
+// The squared error of the leaves is kept as a running total per channel:
+// each update adds the leaves it built and takes off the ones it replaced,
+// both from the block statistics, so PSNR follows edits at no pixel cost.
+//
+// Updates are persistent: the new tree shares the unchanged subtrees with the
+// previous one, which stays intact until releasePrevious(), so a caller can
+// diff the two (the .qtv encoder does).
+#pragma once
+
+#include "spill.h"
+
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+struct LeafRect
+{
+    int x, y, w, h;
+    Color avg;
+};
+
+// Leaves an update replaced: renderers repaint `added`; `removed` is what was
+// under them before (the union of both areas is the same).
+struct TreeDelta
+{
+    std::vector<const Node *> added;
+    std::vector<LeafRect> removed;
+    size_t visited = 0; // nodes built or re-decided
+    double ms = 0;
+
+    void clear()
+    {
+        added.clear();
+        removed.clear();
+        visited = 0;
+        ms = 0;
+    }
+};
+
+struct IncrementalTree
+{
+    int minLeaf = 1;
+    double sdThresh = 16.0;
+    Node *root = nullptr;
+    Node *previous = nullptr; // the tree before the last update, until releasePrevious()
+    int W = 0, H = 0;
+    double sse[3] = {0, 0, 0}; // squared error of root's leaves per channel
+
+    IncrementalTree() = default;
+    IncrementalTree(const IncrementalTree &) = delete;
+    IncrementalTree &operator=(const IncrementalTree &) = delete;
+    ~IncrementalTree() { reset(); }
+
+    void reset()
+    {
+        releasePrevious();
+        destroy(root);
+        root = nullptr;
+        stats.clear();
+        W = H = 0;
+        sse[0] = sse[1] = sse[2] = 0;
+    }
+
+    // Full build of px (replaces any tree).
+    void build(const ImageView &px, TreeDelta *delta = nullptr)
+    {
+        reset();
+        W = px.W;
+        H = px.H;
+        BlockStats st;
+        size_t visited = 0;
+        root = buildTracked(px, 0, 0, W, H, st, visited);
+        addLeafError(root, 1.0);
+        if (delta)
+        {
+            delta->visited += visited;
+            collectAdded(root, *delta);
+        }
+    }
+
+    // Brings the tree up to date with px, whose pixels may differ from the
+    // last build or update only where dirty(x, y, w, h) is true for a
+    // rectangle. dirty may be conservative; it must never miss a change.
+    template <class Dirty>
+    void update(const ImageView &px, Dirty &&dirty, TreeDelta *delta = nullptr)
+    {
+        releasePrevious();
+        if (!root || px.W != W || px.H != H)
+        {
+            build(px, delta);
+            return;
+        }
+        kept.clear();
+        BlockStats st;
+        size_t visited = 0;
+        previous = root;
+        root = updateNode(px, previous, 0, 0, W, H, dirty, st, visited);
+        // kept subtrees are in both trees and cancel out
+        addLeafError(previous, -1.0);
+        addLeafError(root, 1.0);
+        if (delta)
+        {
+            delta->visited += visited;
+            collectAdded(root, *delta);
+        }
+    }
+
+    // update() for pixels changed inside one rectangle; the previous tree is
+    // released (and its replaced leaves reported) right away.
+    void updateRect(const ImageView &px, int x, int y, int w, int h, TreeDelta *delta = nullptr)
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        update(
+            px, [&](int nx, int ny, int nw, int nh)
+            { return nx < x + w && x < nx + nw && ny < y + h && y < ny + nh; },
+            delta);
+        releasePrevious(delta);
+        if (delta)
+            delta->ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0)
+                             .count();
+    }
+
+    // Frees the nodes of the previous tree that the current one does not share.
+    void releasePrevious(TreeDelta *delta = nullptr)
+    {
+        releaseUnkept(previous, delta);
+        previous = nullptr;
+        kept.clear();
+    }
+
+    // True when n is a subtree the last update carried over from `previous`.
+    bool reused(const Node *n) const { return kept.count(n) != 0; }
+    size_t reusedCount() const { return kept.size(); }
+
+    const BlockStats *statsOf(const Node *n) const
+    {
+        auto it = stats.find(n);
+        return it == stats.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::unordered_map<const Node *, BlockStats> stats; // every node of root (and previous)
+    std::unordered_set<const Node *> kept;             // roots shared by previous and root
+
+    Node *buildTracked(const ImageView &px, int x, int y, int w, int h, BlockStats &st, size_t &visited)
+    {
+        BuildStats bs{};
+        Node *n = makeNodeQT(px, x, y, w, h, minLeaf, sdThresh, bs, &st);
+        stats[n] = st;
+        visited++;
+        if (n->leaf)
+            return n;
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int i = 0; i < 4; ++i)
+            if (rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            {
+                BlockStats cs;
+                n->ch[i] = buildTracked(px, r[i][0], r[i][1], r[i][2], r[i][3], cs, visited);
+            }
+        return n;
+    }
+
+    template <class Dirty>
+    Node *updateNode(const ImageView &px, Node *prev, int x, int y, int w, int h, Dirty &dirty, BlockStats &st,
+                     size_t &visited)
+    {
+        if (prev && !dirty(x, y, w, h))
+        {
+            kept.insert(prev);
+            st = stats[prev];
+            return prev;
+        }
+        if (!prev || prev->leaf)
+        {
+            Node *n = buildTracked(px, x, y, w, h, st, visited);
+            if (prev && n->leaf && std::memcmp(&n->avg, &prev->avg, sizeof(Color)) == 0)
+            {
+                // still one flat block of the same color: keep the old leaf
+                stats.erase(n);
+                delete n;
+                BlockStats &old = stats[prev];
+                for (int c = 0; c < 3; ++c)
+                    sse[c] += st.sse(c) - old.sse(c);
+                old = st;
+                kept.insert(prev);
+                return prev;
+            }
+            return n;
+        }
+        // a dirty internal node: update the children, then re-decide from their merged stats
+        Node *n = new Node();
+        n->x = x;
+        n->y = y;
+        n->w = w;
+        n->h = h;
+        visited++;
+        st = BlockStats{};
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int i = 0; i < 4; ++i)
+            if (rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            {
+                BlockStats cs;
+                n->ch[i] = updateNode(px, prev->ch[i], r[i][0], r[i][1], r[i][2], r[i][3], dirty, cs, visited);
+                st.add(cs);
+            }
+        n->avg = st.mean();
+        stats[n] = st;
+        if (st.stdDev() <= sdThresh)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                discardNew(n->ch[i]);
+                n->ch[i] = nullptr;
+            }
+            n->leaf = true;
+        }
+        return n;
+    }
+
+    // Drops a subtree built during this update; shared nodes in it stay
+    // with `previous` (and are freed with it).
+    void discardNew(Node *n)
+    {
+        if (!n || kept.erase(n))
+            return;
+        if (!n->leaf)
+            for (int i = 0; i < 4; ++i)
+                discardNew(n->ch[i]);
+        stats.erase(n);
+        delete n;
+    }
+
+    void releaseUnkept(Node *n, TreeDelta *delta)
+    {
+        if (!n || kept.count(n))
+            return;
+        if (n->leaf && delta)
+            delta->removed.push_back(LeafRect{n->x, n->y, n->w, n->h, n->avg});
+        if (!n->leaf)
+            for (int i = 0; i < 4; ++i)
+                releaseUnkept(n->ch[i], delta);
+        stats.erase(n);
+        delete n;
+    }
+
+    // Adds sign * the error of the leaves under n that the last update did not keep.
+    void addLeafError(const Node *n, double sign)
+    {
+        if (!n || kept.count(n))
+            return;
+        if (n->leaf)
+        {
+            const BlockStats &st = stats[n];
+            for (int c = 0; c < 3; ++c)
+                sse[c] += sign * st.sse(c);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            addLeafError(n->ch[i], sign);
+    }
+
+    void collectAdded(const Node *n, TreeDelta &delta) const
+    {
+        if (!n || kept.count(n))
+            return;
+        if (n->leaf)
+        {
+            delta.added.push_back(n);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            collectAdded(n->ch[i], delta);
+    }
+};
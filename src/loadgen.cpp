@@ -0,0 +1,171 @@
+// loadgen.cpp
+// quadtree_loadgen: drives a quadtree_tiled server with tile requests over
+// keep-alive connections and reports throughput and latency percentiles.
+//
+//   quadtree_loadgen --image name [--host 127.0.0.1] [--port 8080] [--connections 8]
+//                    [--requests 10000] [--zoom-min 0] [--zoom-max Z] [--distinct 0] [--seed 1]
+//
+// Tiles are drawn uniformly from the zoom range (uniformly over the tiles of
+// each zoom). --distinct N first picks N tiles and samples only those, which
+// makes the cache hit rate controllable.
+#include "cli_args.h"
+#include "http.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct Client
+{
+    std::string host;
+    int port = 8080;
+    int fd = -1;
+    std::string buf;
+
+    ~Client() { disconnect(); }
+
+    void disconnect()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        buf.clear();
+    }
+
+    // GET on a keep-alive connection (reconnecting once if the server closed
+    // it). Returns the status, or -1 on a transport error.
+    int get(const std::string &path, std::string &body)
+    {
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            if (fd < 0 && (fd = httpConnect(host, port)) < 0)
+                return -1;
+            const std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+            size_t headLen = 0, total = 0;
+            if (!sendAll(fd, req.data(), req.size()) || !httpReadMessage(fd, buf, headLen, total))
+            {
+                disconnect();
+                continue;
+            }
+            int status = -1;
+            std::sscanf(buf.c_str(), "HTTP/%*s %d", &status);
+            if (strcasecmp(httpHeader(buf.substr(0, headLen), "Connection").c_str(), "close") == 0)
+            {
+                body = buf.substr(headLen, total - headLen);
+                disconnect();
+                return status;
+            }
+            body.assign(buf, headLen, total - headLen);
+            buf.erase(0, total);
+            return status;
+        }
+        return -1;
+    }
+};
+
+static int jsonInt(const std::string &json, const char *key, int def)
+{
+    const size_t k = json.find("\"" + std::string(key) + "\":");
+    return k == std::string::npos ? def : std::atoi(json.c_str() + k + std::strlen(key) + 3);
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    const size_t i = (size_t)std::min<double>((double)sorted.size() - 1, p / 100.0 * (double)sorted.size());
+    return sorted[i];
+}
+
+int main(int argc, char **argv)
+{
+    const HeadlessArgs a = parseArgs(argc, argv, 1);
+    if (!a.get("image"))
+    {
+        std::cerr << "usage: quadtree_loadgen --image name [--host 127.0.0.1] [--port 8080] [--connections N]"
+                     " [--requests N] [--zoom-min Z] [--zoom-max Z] [--distinct N] [--seed S]\n";
+        return 2;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    const std::string image = a.get("image");
+    Client probe;
+    probe.host = a.get("host") ? a.get("host") : "127.0.0.1";
+    probe.port = a.getInt("port", 8080);
+    std::string info;
+    if (probe.get("/" + image + ".json", info) != 200)
+    {
+        std::cerr << "No image '" << image << "' on " << probe.host << ":" << probe.port << "\n";
+        return 1;
+    }
+    const int W = jsonInt(info, "width", 0), H = jsonInt(info, "height", 0);
+    const int T = jsonInt(info, "tileSize", 256), maxZoom = jsonInt(info, "maxZoom", 0);
+    const int zMin = std::clamp(a.getInt("zoom-min", 0), 0, maxZoom);
+    const int zMax = std::clamp(a.getInt("zoom-max", maxZoom), zMin, maxZoom);
+    const int connections = std::max(1, a.getInt("connections", 8));
+    const size_t requests = (size_t)std::max(1, a.getInt("requests", 10000));
+
+    // the request list is fixed up front so runs are repeatable (--seed)
+    std::mt19937_64 rng((uint64_t)a.getInt("seed", 1));
+    auto randomTile = [&]()
+    {
+        const int z = std::uniform_int_distribution<int>(zMin, zMax)(rng);
+        const int64_t span = (int64_t)T << (maxZoom - z);
+        const int cols = (int)((W + span - 1) / span), rows = (int)((H + span - 1) / span);
+        const int x = std::uniform_int_distribution<int>(0, cols - 1)(rng);
+        const int y = std::uniform_int_distribution<int>(0, rows - 1)(rng);
+        return "/" + image + "/" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y) + ".png";
+    };
+    std::vector<std::string> pool;
+    for (int i = 0; i < a.getInt("distinct", 0); ++i)
+        pool.push_back(randomTile());
+    std::vector<std::string> paths(requests);
+    for (std::string &p : paths)
+        p = pool.empty() ? randomTile() : pool[std::uniform_int_distribution<size_t>(0, pool.size() - 1)(rng)];
+
+    std::atomic<size_t> next{0}, failed{0}, bytes{0};
+    std::vector<std::vector<double>> latencies((size_t)connections);
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < connections; ++c)
+        threads.emplace_back([&, c]()
+                             {
+            Client cl;
+            cl.host = probe.host;
+            cl.port = probe.port;
+            std::string body;
+            for (size_t i; (i = next.fetch_add(1)) < requests;)
+            {
+                auto s = std::chrono::steady_clock::now();
+                const int status = cl.get(paths[i], body);
+                auto e = std::chrono::steady_clock::now();
+                if (status != 200)
+                {
+                    failed++;
+                    continue;
+                }
+                bytes += body.size();
+                latencies[(size_t)c].push_back(std::chrono::duration<double, std::milli>(e - s).count());
+            } });
+    for (auto &t : threads)
+        t.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::vector<double> all;
+    for (const auto &l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    std::printf("%s %dx%d zoom %d-%d: %zu requests over %d connections in %.2f s, %zu failed\n", image.c_str(), W, H,
+                zMin, zMax, requests, connections, secs, failed.load());
+    std::printf("throughput: %.0f req/s %.1f MB/s\n", all.size() / secs, bytes.load() / secs / (1024.0 * 1024.0));
+    std::printf("latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n", percentile(all, 50), percentile(all, 90),
+                percentile(all, 99), all.empty() ? 0.0 : all.back());
+    std::string stats;
+    if (probe.get("/stats", stats) == 200)
+        std::printf("server: %s", stats.c_str());
+    return failed.load() ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+// lru_cache.h
+// Thread-safe least-recently-used cache of immutable byte blobs (encoded
+// tiles) under a total byte budget. Values are shared, so a blob evicted
+// while a response is still being sent stays alive until the send is done.
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using Blob = std::shared_ptr<const std::vector<uint8_t>>;
+
+struct LruCache
+{
+    struct Stats
+    {
+        uint64_t hits = 0, misses = 0, evictions = 0;
+        size_t entries = 0, bytes = 0;
+    };
+
+    explicit LruCache(size_t budget) : maxBytes(budget) {}
+
+    Blob get(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lk(m);
+        auto it = index.find(key);
+        if (it == index.end())
+        {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        order.splice(order.begin(), order, it->second); // most recent first
+        return it->second->second;
+    }
+
+    void put(const std::string &key, Blob value)
+    {
+        if (!value || value->size() > maxBytes)
+            return;
+        std::lock_guard<std::mutex> lk(m);
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            // another worker rendered the same tile meanwhile
+            order.splice(order.begin(), order, it->second);
+            return;
+        }
+        order.emplace_front(key, std::move(value));
+        index[key] = order.begin();
+        stats.bytes += order.front().second->size();
+        while (stats.bytes > maxBytes)
+        {
+            stats.bytes -= order.back().second->size();
+            index.erase(order.back().first);
+            order.pop_back();
+            stats.evictions++;
+        }
+        stats.entries = order.size();
+    }
+
+    Stats snapshot() const
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return stats;
+    }
+
+private:
+    using Entry = std::pair<std::string, Blob>;
+    size_t maxBytes;
+    std::list<Entry> order;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    Stats stats;
+    mutable std::mutex m;
+};
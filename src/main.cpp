@@ -1,9 +1,6 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
-
 #include <GLFW/glfw3.h>
 #include <cstdio>
 #include <cstdlib>
@@ -15,6 +12,8 @@
 #include <algorithm>
 #include <filesystem> // C++17
 #include <cmath>
+#include <cstring>
+#include <memory>
 
 // ---------------- ImGui ----------------
 #include "imgui/imgui.h"
@@ -22,128 +21,39 @@
 #include "imgui/backends/imgui_impl_opengl2.h"
 #include "ImGuiFileDialog/ImGuiFileDialog.h"
 
+#include "quadtree.h"
+#include "qtc_format.h"
+#include "best_first.h"
+#include "cli_args.h"
+#include "incremental.h"
+#include "mapped_image.h"
+#include "metrics.h"
+#include "palette.h"
+#include "png_writer.h"
+#include "progressive.h"
+#include "pyramid.h"
+#include "qoi.h"
+#include "qti_format.h"
+#include "raster.h"
+#include "rate_control.h"
+#include "raster_cache.h"
+#include "spill.h"
+#include "split_criteria.h"
+#include "sweep.h"
+#include "temporal.h"
+#include "tiled_build.h"
+#include "typed_build.h"
+
 // ---------------- Image buffer ----------------
-struct Color
-{
-    uint8_t r, g, b;
-};
 static int IMG_W = 0, IMG_H = 0;
-static std::vector<std::vector<Color>> image;
+static ImageView image;                // what the builder reads (packed RGB rows)
+static std::shared_ptr<void> gImageOwner; // keeps them alive: stb decode, mmap or heap buffer
 
 // NDC helpers (render image in [-1,1]x[-1,1] or fit-to-window)
 static inline float ndcX(float x, float canvasW) { return (x / canvasW) * 2.0f - 1.0f; }
 static inline float ndcY(float y, float canvasH) { return 1.0f - (y / canvasH) * 2.0f; } // flip Y
 static float gBgColor[3] = {0.f, 20 / 255.f, 26 / 255.f};                                // color de fondo
 
-// ---------------- Quadtree ----------------
-struct Node
-{
-    int x, y, w, h;
-    bool leaf = false;
-    Color avg{};
-    Node *ch[4]{nullptr, nullptr, nullptr, nullptr};
-};
-
-static inline double clamp0(double v) { return v < 0 ? 0 : v; }
-
-static double calcStdDevRGB(const std::vector<std::vector<Color>> &px, int x, int y, int w, int h)
-{
-    double sumR = 0, sumG = 0, sumB = 0, sqR = 0, sqG = 0, sqB = 0;
-    const int cnt = w * h;
-    for (int j = y; j < y + h; ++j)
-    {
-        const auto &row = px[j];
-        for (int i = x; i < x + w; ++i)
-        {
-            const double R = row[i].r, G = row[i].g, B = row[i].b;
-            sumR += R;
-            sumG += G;
-            sumB += B;
-            sqR += R * R;
-            sqG += G * G;
-            sqB += B * B;
-        }
-    }
-    const double mR = sumR / cnt, mG = sumG / cnt, mB = sumB / cnt;
-    const double sdR = std::sqrt(clamp0(sqR / cnt - mR * mR));
-    const double sdG = std::sqrt(clamp0(sqG / cnt - mG * mG));
-    const double sdB = std::sqrt(clamp0(sqB / cnt - mB * mB));
-    return (sdR + sdG + sdB) / 3.0;
-}
-
-static Color averageRGB(const std::vector<std::vector<Color>> &px, int x, int y, int w, int h)
-{
-    uint64_t sumR = 0, sumG = 0, sumB = 0;
-    const int cnt = w * h;
-    for (int j = y; j < y + h; ++j)
-    {
-        const auto &row = px[j];
-        for (int i = x; i < x + w; ++i)
-        {
-            sumR += row[i].r;
-            sumG += row[i].g;
-            sumB += row[i].b;
-        }
-    }
-    Color c;
-    c.r = (uint8_t)(sumR / cnt);
-    c.g = (uint8_t)(sumG / cnt);
-    c.b = (uint8_t)(sumB / cnt);
-    return c;
-}
-
-struct BuildStats
-{
-    size_t nodes = 0, leaves = 0;
-    double ms = 0;
-};
-
-static Node *buildQT(const std::vector<std::vector<Color>> &px,
-                     int x, int y, int w, int h,
-                     int minLeaf, double sdThresh,
-                     BuildStats &stats)
-{
-    Node *n = new Node();
-    n->x = x;
-    n->y = y;
-    n->w = w;
-    n->h = h;
-    stats.nodes++;
-
-    if (w <= minLeaf || h <= minLeaf || calcStdDevRGB(px, x, y, w, h) <= sdThresh)
-    {
-        n->leaf = true;
-        n->avg = averageRGB(px, x, y, w, h);
-        stats.leaves++;
-        return n;
-    }
-
-    const int w2 = w / 2, h2 = h / 2;
-    if (w2 == 0 || h2 == 0)
-    {
-        n->leaf = true;
-        n->avg = averageRGB(px, x, y, w, h);
-        stats.leaves++;
-        return n;
-    }
-
-    n->ch[0] = buildQT(px, x, y, w2, h2, minLeaf, sdThresh, stats);                   // NW
-    n->ch[1] = buildQT(px, x + w2, y, w - w2, h2, minLeaf, sdThresh, stats);          // NE
-    n->ch[2] = buildQT(px, x, y + h2, w2, h - h2, minLeaf, sdThresh, stats);          // SW
-    n->ch[3] = buildQT(px, x + w2, y + h2, w - w2, h - h2, minLeaf, sdThresh, stats); // SE
-    return n;
-}
-
-static void destroy(Node *n)
-{
-    if (!n)
-        return;
-    if (!n->leaf)
-        for (int i = 0; i < 4; ++i)
-            destroy(n->ch[i]);
-    delete n;
-}
-
 // ---------------- Rendering ----------------
 static bool gDrawFill = true;
 static bool gDrawLines = true;
@@ -154,7 +64,7 @@ static float gLineColor[3] = {10 / 255.f, 10 / 255.f, 10 / 255.f}; // valor inic
 // (opcional) grosor de línea
 static float gLineWidth = 1.0f;
 
-static void drawLeafRect(const Node *n)
+static void drawLeafRect(const Node *n, bool fill)
 {
     const float x0 = (float)n->x;
     const float y0 = (float)n->y;
@@ -162,7 +72,7 @@ static void drawLeafRect(const Node *n)
     const float y1 = (float)(n->y + n->h);
     const float r = n->avg.r / 255.f, g = n->avg.g / 255.f, b = n->avg.b / 255.f;
 
-    if (gDrawFill)
+    if (fill)
     {
         glColor3f(r, g, b);
         glBegin(GL_TRIANGLES);
@@ -196,22 +106,122 @@ static void drawLeafRect(const Node *n)
     }
 }
 
-static void renderQT(const Node *n)
+// fill = per-leaf triangles; only used when the fill texture is unavailable
+static void renderQT(const Node *n, bool fill)
 {
     if (!n)
         return;
-    if (n->leaf)
+    if (n->leaf || n->spilled) // spilled subtrees preview as their mean
     {
-        drawLeafRect(n);
+        drawLeafRect(n, fill);
         return;
     }
     for (int i = 0; i < 4; ++i)
-        renderQT(n->ch[i]);
+        renderQT(n->ch[i], fill);
+}
+
+// Fill as a single textured quad of the cached raster: one upload per rebuild
+// instead of two triangles per leaf every frame.
+static GLuint gFillTex = 0;
+static uint64_t gFillTexGen = ~0ull; // RasterCache::generation of the uploaded pixels
+
+static bool uploadFillTexture(const Color *raster, int W, int H, uint64_t generation)
+{
+    GLint maxTex = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTex);
+    if (!raster || W > maxTex || H > maxTex)
+        return false; // too large for one texture: fall back to per-leaf fill
+    if (!gFillTex)
+        glGenTextures(1, &gFillTex);
+    glBindTexture(GL_TEXTURE_2D, gFillTex);
+    if (generation != gFillTexGen)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are W*3 bytes
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, W, H, 0, GL_RGB, GL_UNSIGNED_BYTE, raster);
+        gFillTexGen = generation;
+    }
+    return true;
+}
+
+static void drawFillTexture(int W, int H)
+{
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, gFillTex);
+    glColor3f(1.f, 1.f, 1.f);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.f, 0.f);
+    glVertex2f(0.f, 0.f);
+    glTexCoord2f(1.f, 0.f);
+    glVertex2f((float)W, 0.f);
+    glTexCoord2f(1.f, 1.f);
+    glVertex2f((float)W, (float)H);
+    glTexCoord2f(0.f, 1.f);
+    glVertex2f(0.f, (float)H);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
 }
 
 // ---------------- Image IO ----------------
+static int gRawW = 0, gRawH = 0; // size of headerless .rgb/.raw inputs (--size WxH)
+
+static bool hasExt(const std::string &path, const char *ext)
+{
+    const size_t n = std::strlen(ext);
+    if (path.size() < n)
+        return false;
+    for (size_t i = 0; i < n; ++i)
+        if (std::tolower((unsigned char)path[path.size() - n + i]) != ext[i])
+            return false;
+    return true;
+}
+
+static bool isMappableImage(const std::string &path)
+{
+    return hasExt(path, ".ppm") || hasExt(path, ".pnm") || hasExt(path, ".pam") ||
+           hasExt(path, ".rgb") || hasExt(path, ".raw");
+}
+
 static bool loadImage(const std::string &path)
 {
+    // Uncompressed inputs are mapped and built in place, never copied.
+    if (isMappableImage(path))
+    {
+        auto mapped = std::make_shared<MappedImage>();
+        if (mapped->open(path, gRawW, gRawH))
+        {
+            IMG_W = mapped->img.W;
+            IMG_H = mapped->img.H;
+            image = mapped->img;
+            gImageOwner = mapped;
+            std::cout << "Mapped: " << path << " (" << IMG_W << "x" << IMG_H << ")\n";
+            return true;
+        }
+    }
+
+    // stb_image has no QOI reader
+    if (hasExt(path, ".qoi"))
+    {
+        std::vector<uint8_t> bytes;
+        auto px = std::make_shared<std::vector<uint8_t>>();
+        int w = 0, h = 0;
+        if (!readFileBytes(path, bytes) || !qoiDecode(bytes.data(), bytes.size(), w, h, 3, *px))
+        {
+            std::cerr << "Failed to load image: " << path << "\n";
+            return false;
+        }
+        IMG_W = w;
+        IMG_H = h;
+        image.data = px->data();
+        image.W = IMG_W;
+        image.H = IMG_H;
+        image.stride = (size_t)IMG_W * sizeof(Color);
+        gImageOwner = px;
+        std::cout << "Loaded: " << path << " (" << IMG_W << "x" << IMG_H << ")\n";
+        return true;
+    }
+
     int w, h, ch;
     stbi_uc *data = stbi_load(path.c_str(), &w, &h, &ch, 3); // force RGB
     if (!data)
@@ -221,16 +231,12 @@ static bool loadImage(const std::string &path)
     }
     IMG_W = w;
     IMG_H = h;
-    image.assign(IMG_H, std::vector<Color>(IMG_W));
-    for (int j = 0; j < IMG_H; ++j)
-    {
-        for (int i = 0; i < IMG_W; ++i)
-        {
-            const int idx = (j * IMG_W + i) * 3;
-            image[j][i] = {data[idx + 0], data[idx + 1], data[idx + 2]};
-        }
-    }
-    stbi_image_free(data);
+    // the decoded buffer already is packed RGB: view it instead of copying
+    gImageOwner = std::shared_ptr<void>(data, stbi_image_free);
+    image.data = data;
+    image.W = IMG_W;
+    image.H = IMG_H;
+    image.stride = (size_t)IMG_W * sizeof(Color);
     std::cout << "Loaded: " << path << " (" << IMG_W << "x" << IMG_H << ")\n";
     return true;
 }
@@ -293,47 +299,160 @@ static size_t estimateQuadtreeBytes(size_t leaves, bool includeRects = true)
     return leaves * (rgbBytes + rectBytes);
 }
 
-// -------- Rasterize quadtree to buffer --------
-static void blitRect(std::vector<Color> &buf, int W, int H, int x, int y, int w, int h, Color c)
+// -------- Save current quadtree view as PNG --------
+static int gPngPreset = PNG_PRESET_DEFAULT; // fast / default / max (png_writer.h)
+static bool gPngPalette = false;  // write 8-bit indexed PNG when leaf colors fit in 256
+static bool gPngQuantize = false; // ...or after median-cut reduction to 256
+static int gPngLevel = -1;         // deflate level override; -1 = the preset's
+static int gDeflateBackend = defaultDeflateBackend();
+
+// PNG export settings: the encoder's parameters and the palette choice.
+struct QuadtreePngOptions
 {
-    int x0 = std::max(0, x), y0 = std::max(0, y);
-    int x1 = std::min(W, x + w), y1 = std::min(H, y + h);
-    for (int j = y0; j < y1; ++j)
-    {
-        Color *row = &buf[j * W];
-        for (int i = x0; i < x1; ++i)
-            row[i] = c;
-    }
+    PngParams params;
+    bool palette = false;  // 8-bit indexed PNG when leaf colors fit in 256
+    bool quantize = false; // ...or after median-cut reduction to 256
+};
+
+// What one PNG encode did.
+struct PngEncodeStats
+{
+    size_t bytes = 0;
+    int paletteColors = 0; // palette entries (0 = RGB)
+    double ms = 0;
+    size_t peakBytes = 0; // encoder buffers
+};
+
+static PngEncodeStats gLastPng; // the viewer's last encode of the current tree
+
+// The options selected by the flags or the viewer's controls.
+static QuadtreePngOptions currentPngOptions()
+{
+    QuadtreePngOptions o;
+    o.params = pngPresetParams(gPngPreset);
+    o.params.backend = gDeflateBackend;
+    if (gPngLevel >= 0)
+        o.params.level = gPngLevel;
+    o.palette = gPngPalette;
+    o.quantize = gPngQuantize;
+    return o;
 }
 
-static void rasterizeQT(const Node *n, int W, int H, std::vector<Color> &out)
+// Streams the rendering of root to `sink`: the tree is rasterized strip by
+// strip (only the leaves crossing each strip are visited) while the previous
+// strips are deflated, so no W*H raster is allocated. The leaf layout tells
+// the encoder which rows repeat the one above, so those are written with the
+// Up filter without any trial filtering. In palette mode the strips hold
+// palette indices instead of RGB. Keeps no state, so trees can be encoded
+// from several threads at once. With a `raster` cache (one thread only), RGB
+// rows are copied from its pixels instead of being rasterized again.
+static bool streamQuadtreePNG(const Node *root, const SpillStore *store, int W, int H,
+                              const QuadtreePngOptions &opt, const PngByteSink &sink, PngEncodeStats &stats,
+                              RasterCache *raster = nullptr)
 {
-    if (!n)
-        return;
-    if (n->leaf)
+    stats = PngEncodeStats{};
+    if (!root || W <= 0 || H <= 0)
+        return false;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    // filled by the row source as it goes: a row's flag is set with its strip,
+    // before the encoder filters it
+    std::vector<uint8_t> repeat((size_t)H, 1);
+    repeat[0] = 0;
+    PngParams params = opt.params;
+    params.repeatRows = repeat.data();
+    SpillPager pager(store, H); // every spilled subtree is paged in once for the whole image
+    SpillPager *paging = store ? &pager : nullptr;
+    const PngByteSink counted = [&](const uint8_t *data, size_t n)
     {
-        blitRect(out, W, H, n->x, n->y, n->w, n->h, n->avg);
-        return;
+        stats.bytes += n;
+        return sink(data, n);
+    };
+
+    LeafPalette pal;
+    PngImage shape = pngImageRGB(nullptr, W, H);
+    PngRowSource rows = [&](int y0, int y1, uint8_t *dst)
+    { rasterizeQTBand(root, W, y0, y1, reinterpret_cast<Color *>(dst), paging, y0, repeat.data()); };
+    if ((opt.palette || opt.quantize) && buildLeafPalette(root, W, H, store, opt.quantize, pal))
+    {
+        shape = pngImageIndexed(nullptr, W, H, reinterpret_cast<const uint8_t *>(pal.colors.data()),
+                                (int)pal.colors.size());
+        rows = [&](int y0, int y1, uint8_t *dst)
+        { rasterizeIndexBand(root, W, y0, y1, dst, paging, pal, y0, repeat.data()); };
+        stats.paletteColors = (int)pal.colors.size();
     }
-    for (int i = 0; i < 4; ++i)
-        rasterizeQT(n->ch[i], W, H, out);
+    else if (const Color *px = raster ? raster->get(root, W, H, store) : nullptr; px && !raster->repeat.empty())
+    {
+        params.repeatRows = raster->repeat.data();
+        rows = [&, px](int y0, int y1, uint8_t *dst)
+        { std::memcpy(dst, px + (size_t)y0 * W, (size_t)(y1 - y0) * W * sizeof(Color)); };
+    }
+
+    bool ok;
+    if (deflateBackendSupportsStrips(params.backend))
+        ok = encodePNGStreaming(shape, rows, params, counted, &stats.peakBytes);
+    else
+    {
+        // whole-buffer backend (libdeflate): materialize the raster once
+        const size_t rowBytes = (size_t)W * shape.bpp;
+        std::vector<uint8_t> raster((size_t)H * rowBytes), bytes;
+        const int band = 64;
+        parallelFor(((size_t)H + band - 1) / band, params.threads, [&](size_t b)
+                    {
+            const int y0 = (int)b * band;
+            rows(y0, std::min(H, y0 + band), raster.data() + (size_t)y0 * rowBytes); });
+        shape.data = raster.data();
+        shape.stride = rowBytes;
+        ok = encodePNG(shape, params, bytes) && counted(bytes.data(), bytes.size());
+        stats.peakBytes = raster.size() * 2 + bytes.size();
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    stats.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    return ok;
 }
 
-// -------- Save current quadtree view as PNG --------
-static bool saveQuadtreePNG(const std::string &path, const Node *root, int W, int H)
+static bool saveQuadtreePNG(const std::string &path, const Node *root, const SpillStore *store, int W, int H,
+                            const QuadtreePngOptions &opt, PngEncodeStats *stats = nullptr)
 {
-    if (!root || W <= 0 || H <= 0)
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
         return false;
+    PngEncodeStats local;
+    const bool ok = streamQuadtreePNG(root, store, W, H, opt, [&](const uint8_t *data, size_t n)
+                                      { return std::fwrite(data, 1, n, f) == n; }, stats ? *stats : local);
+    return std::fclose(f) == 0 && ok;
+}
 
-    std::vector<Color> buf(W * H);
-    rasterizeQT(root, W, H, buf);
+// -------- QOI export (chosen by the .qoi extension) --------
+static size_t gLastQoiBytes = 0;
+static double gLastQoiMs = 0;
 
-    // stbi_write_png expects rows as contiguous bytes
-    const int stride = W * 3;
-    // Convert to raw bytes view without copying:
-    unsigned char *data = reinterpret_cast<unsigned char *>(buf.data());
-    int ok = stbi_write_png(path.c_str(), W, H, 3, data, stride);
-    return ok != 0;
+static bool encodeQuadtreeQOI(const Node *root, const SpillStore *store, RasterCache &raster,
+                              int W, int H, std::vector<uint8_t> &out)
+{
+    if ((uint64_t)W * H > qoi_detail::MAX_PIXELS) // qoiEncode refuses it; don't rasterize first
+        return false;
+    const Color *rgb = raster.get(root, W, H, store);
+    if (!rgb)
+        return false;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    const bool ok = qoiEncode(reinterpret_cast<const uint8_t *>(rgb), W, H, 3, (size_t)W * sizeof(Color), out);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    gLastQoiMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    gLastQoiBytes = ok ? out.size() : 0;
+    return ok;
+}
+
+static bool saveQuadtreeQOI(const std::string &path, const Node *root, const SpillStore *store,
+                            RasterCache &raster, int W, int H)
+{
+    std::vector<uint8_t> bytes;
+    return encodeQuadtreeQOI(root, store, raster, W, H, bytes) && writeFileBytes(path, bytes);
+}
+
+// Raw RGB megabytes per second for an encode of a W*H image.
+static double encodeMBps(int W, int H, double ms)
+{
+    return ms > 0 ? (double)W * H * sizeof(Color) / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0;
 }
 
 // ---------------- Helpers (GUI bindings) ----------------
@@ -350,35 +469,1088 @@ static inline double sdFromIdx(int idx)
     return double(1 << idx);
 }
 
+// Rate control (Segmentation panel): when applied, the searched threshold and
+// leaf size replace the two sliders until either slider moves.
+static int gRateKind = RATE_OFF;
+static float gRateKB = 200.0f;
+static float gRateDb = 35.0f;
+static bool gRateSearchLeaf = false;
+static bool gRatePngBudget = false; // budget on the PNG export instead of the .qtc tree
+static bool gRateApplied = false;
+static RateResult gRateLast;
+static RateModel gRateModel; // analysis of the current image, made on first search
+
+// Best-first build (Segmentation panel): split the worst leaf until a leaf
+// count or a deadline, instead of using the StdDev threshold.
+static bool gBestFirst = false;
+static int gBestFirstLeaves = 20000;
+static float gBestFirstMs = 0.0f; // 0 = no deadline
+static int gBestFirstStop = BEST_FIRST_COMPLETE;
+
+// Split criterion (Segmentation panel); anything but "mean" builds from
+// summed-area tables of the current image, made on first use.
+static int gSplit = SPLIT_MEAN;
+static SplitSums gSplitSums;
+
+static QualityMetrics gQuality; // current tree against the source image
+
+static int currentLeaf() { return gRateApplied ? gRateLast.minLeaf : leafFromIdx(gPowIdx); }
+static double currentSd() { return gRateApplied ? gRateLast.sdThresh : sdFromIdx(gSdIdx); }
+
 // Track sizes we want to show in UI
 static uintmax_t gOriginalFileBytes = 0; // size on disk of the source image
 static size_t gLastPngBytes = 0;         // size of current quadtree-render as PNG
 static size_t gLeafDataBytes = 0;        // raw leaf data size (uncompressed)
 
-// Encode current quadtree image to PNG in memory and return byte size
-static size_t pngSizeOfCurrent(const Node *root, int W, int H)
+// Out-of-core mode: spill completed subtrees to a scratch file above a memory ceiling
+static bool gOutOfCore = false;
+static int gMemLimitMB = 256;
+static int gSpillDepth = 4;
+static SpillStore gSpill; // owned by the current tree; reset on rebuild
+
+// Rasterization of the current tree, shared by save, size readout and the fill texture
+static RasterPool gRasterPool;
+static RasterCache gRaster(&gRasterPool);
+
+// Encodes the tree's rendering as PNG without keeping it; bytes is 0 on
+// failure. RGB rows come from `raster` when given.
+static PngEncodeStats pngSizeOf(const Node *root, const SpillStore *store, int W, int H,
+                                const QuadtreePngOptions &opt, RasterCache *raster = nullptr)
 {
-    if (!root || W <= 0 || H <= 0)
+    PngEncodeStats stats;
+    if (!streamQuadtreePNG(root, store, W, H, opt, [](const uint8_t *, size_t) { return true; }, stats, raster))
+        stats.bytes = 0;
+    return stats;
+}
+
+// Size of the file saving root to `path` would write, by its extension (0 on
+// failure). Nothing is written; the QOI encode reuses raster.
+static size_t outputBytes(const std::string &path, const Node *root, const SpillStore *store, RasterCache &raster,
+                          int W, int H, int indexDepth = -1)
+{
+    if (!root)
         return 0;
-    std::vector<Color> buf(W * H);
-    rasterizeQT(root, W, H, buf); // already provided in your code
+    const QtcHeader h{(uint32_t)W, (uint32_t)H, (uint32_t)root->w, (uint32_t)root->h};
+    std::vector<uint8_t> bytes;
+    if (hasExt(path, ".qtc"))
+        return serializeQT(root, bytes, store) ? QTC_HEADER_BYTES + bytes.size() : 0;
+    if (hasExt(path, ".qti"))
+    {
+        std::vector<QtiEntry> entries;
+        std::vector<uint8_t> head;
+        int depth = 0;
+        if (!serializeQT(root, bytes, store) || !buildQtiIndex(h, bytes.data(), bytes.size(), indexDepth, entries, depth))
+            return 0;
+        writeQtiHeader(head, h, depth, entries);
+        return head.size() + bytes.size();
+    }
+    if (hasExt(path, ".qtp"))
+    {
+        writeQtpHeader(bytes, h);
+        return serializeProgressive(root, W, H, bytes, store) ? bytes.size() : 0;
+    }
+    if (hasExt(path, ".qoi"))
+        return encodeQuadtreeQOI(root, store, raster, W, H, bytes) ? bytes.size() : 0;
+    return pngSizeOf(root, store, W, H, currentPngOptions()).bytes;
+}
+
+// ---------------- JSON output ----------------
+static std::string jsonString(const std::string &v)
+{
+    std::string out = "\"";
+    for (char c : v)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Non-finite values (PSNR of an exact tree) have no JSON spelling: null.
+static std::string jsonNumber(double v)
+{
+    if (!std::isfinite(v))
+        return "null";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    return buf;
+}
+
+static std::string qualityJson(const QualityMetrics &q)
+{
+    return "{\"mse\":[" + jsonNumber(q.mse[0]) + "," + jsonNumber(q.mse[1]) + "," + jsonNumber(q.mse[2]) +
+           "],\"psnr\":[" + jsonNumber(q.psnr[0]) + "," + jsonNumber(q.psnr[1]) + "," + jsonNumber(q.psnr[2]) +
+           "],\"mse_all\":" + jsonNumber(q.mseAll) + ",\"psnr_all\":" + jsonNumber(q.psnrAll) +
+           ",\"ssim\":" + jsonNumber(q.ssim) + ",\"mse_ms\":" + jsonNumber(q.mseMs) +
+           ",\"ssim_ms\":" + jsonNumber(q.ssimMs) + "}";
+}
+
+static void printQuality(const QualityMetrics &q)
+{
+    std::printf("quality: psnr=%.2f dB (r %.2f g %.2f b %.2f) mse=%.3f ssim=%.4f (mse %.1f ms, ssim %.1f ms)\n",
+                q.psnrAll, q.psnr[0], q.psnr[1], q.psnr[2], q.mseAll, q.ssim, q.mseMs, q.ssimMs);
+}
+
+// ---------------- Headless mode ----------------
+// Command line tools that run without opening a window:
+//   quadtree_viewer --build <image> <out.qtc|out.qtp|out.qti|out.png|out.qoi> [--leaf 1] [--sd 16]
+//                   [--out-of-core] [--mem-limit MB] [--spill-depth 4] [--png-preset default]
+//                   [--palette] [--quantize] [--level 0-12] [--deflate builtin|zlib|libdeflate]
+//                   [--index-depth D] [--target-kb K | --target-bytes N | --target-psnr dB [--search-leaf]]
+//                   [--best-first [--max-leaves N] [--max-bytes N] [--max-ms T]]
+//                   [--split mean|luma|max|ycbcr|edge] [--metrics] [--json]
+//   quadtree_viewer --build <image> <out.png|out.pfm> --native [--leaf 1] [--sd 16]
+//   quadtree_viewer --bench <image...> [--leaf 1] [--sd 16] [--runs 3] [--threads 0] [--json]
+//   quadtree_viewer --sweep <image> <out.csv> [--leaf-list 1,2,..,256] [--sd-list 1,2,..,64 | --sd-range lo,hi,step
+//                   | --sd-cuts [--sd-max 64]] [--png] [--no-build] [--threads 0]
+//   quadtree_viewer --tiled <in.ppm|image> <out.qtc|out.qti> [--tile 1024] [--leaf 1] [--sd 16] [--threads 0]
+//   quadtree_viewer --preview <in.qtp> <out.png> [--bytes N | --percent P] [--chunk 4096]
+//   quadtree_viewer --index <in.qtc> <out.qti> [--index-depth D]
+//   quadtree_viewer --region <in.qti> <out.png> --rect x,y,w,h [--scale 1]
+//   quadtree_viewer --pyramid <image|in.qtc> <out.dzi|outdir> [--layout dzi|xyz] [--tile 256]
+//                   [--threads 0] [--png-preset fast] [--leaf 1] [--sd 16]
+//   quadtree_viewer --edit <image> <out.png|out.qtc> --rect x,y,w,h [--fill r,g,b] [--leaf 1] [--sd 16]
+//   quadtree_viewer --video <frames...|anim.gif> <out.qtv> [--leaf 1] [--sd 16] [--block 16] [--fps 30]
+//   quadtree_viewer --video-decode <in.qtv> <out_prefix>
+// Headerless raw RGB inputs (.rgb/.raw) need --size WxH.
+// argv[1] is the command (--build, --tiled, ...); the rest are its arguments.
+static HeadlessArgs parseHeadlessArgs(int argc, char **argv)
+{
+    HeadlessArgs a = parseArgs(argc, argv, 2);
+    a.cmd = argv[1] + 2;
+    return a;
+}
+
+static int runTiled(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --tiled <in.ppm|image> <out.qtc|out.qti> [--tile N] [--leaf N] [--sd X] [--threads N]"
+                     " [--index-depth D]\n";
+        return 2;
+    }
+    TiledBuildParams p;
+    p.tileSize = a.getInt("tile", p.tileSize);
+    p.minLeaf = std::max(1, a.getInt("leaf", p.minLeaf));
+    p.sdThresh = a.getDouble("sd", p.sdThresh);
+    p.threads = a.getInt("threads", p.threads);
+
+    // Uncompressed inputs are mapped (or, failing that, streamed from a PPM)
+    // tile by tile; anything else is decoded up front.
+    std::unique_ptr<TileSource> src;
+    MappedImage mapped;
+    if (isMappableImage(a.pos[0]) && mapped.open(a.pos[0], gRawW, gRawH))
+    {
+#ifndef _WIN32
+        src = std::make_unique<MappedTileSource>(mapped);
+#endif
+    }
+    else if (hasExt(a.pos[0], ".ppm"))
+    {
+        auto ppm = std::make_unique<PpmTileSource>();
+        if (!ppm->open(a.pos[0]))
+        {
+            std::cerr << "Failed to open PPM: " << a.pos[0] << "\n";
+            return 1;
+        }
+        src = std::move(ppm);
+    }
+    else
+    {
+        if (!loadImage(a.pos[0]))
+            return 1;
+        src = std::make_unique<MemoryTileSource>(image);
+    }
+
+    TiledBuildResult res;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if (!buildTiled(*src, p, res))
+    {
+        std::cerr << "Tiled build failed (read error)\n";
+        return 1;
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    res.stats.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    size_t indexBytes = 0;
+    const bool ok = hasExt(a.pos[1], ".qti")
+                        ? saveQtiFromQtc(a.pos[1], res.bytes, a.getInt("index-depth", -1), &indexBytes)
+                        : writeFileBytes(a.pos[1], res.bytes);
+    if (!ok)
+    {
+        std::cerr << "Failed to write: " << a.pos[1] << "\n";
+        return 1;
+    }
+    if (indexBytes)
+        std::printf("index: %zu bytes (%.2f%% of the tree)\n", indexBytes, 100.0 * indexBytes / res.bytes.size());
+    std::printf("%dx%d root=%d tiles=%zu nodes=%zu leaves=%zu bytes=%zu peak_tile=%.1f MB build=%.1f ms"
+                " psnr=%.2f dB\n",
+                src->width(), src->height(), res.rootSize, res.tiles, res.stats.nodes, res.stats.leaves,
+                res.bytes.size(), res.peakTileBytes / (1024.0 * 1024.0), res.stats.ms,
+                psnrFromSSE(res.stats.totalSSE(), 3.0 * src->width() * src->height()));
+    return 0;
+}
+
+// --build --native: the tree at the input's own channels and depth.
+template <int C, class T>
+static int buildNative(const HeadlessArgs &a, const T *samples, int W, int H)
+{
+    PixelView<C, T> px;
+    px.data = reinterpret_cast<const uint8_t *>(samples);
+    px.W = W;
+    px.H = H;
+    px.stride = (size_t)W * C * sizeof(T);
+    const int minLeaf = std::max(1, a.getInt("leaf", 1));
+    const double sd = a.getDouble("sd", 16.0);
+    TypedBuildStats<C> stats;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    TypedNode<C, T> *root = buildTyped(px, 0, 0, W, H, minLeaf, sd, stats);
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    std::vector<T> raster((size_t)W * H * C);
+    rasterizeTyped(root, W, H, raster.data());
+    destroy(root);
+    const std::string &out = a.pos[1];
+    bool ok = false;
+    if (hasExt(out, ".pfm"))
+    {
+        if constexpr (std::is_floating_point_v<T> && C != 4)
+            ok = writePFM<C>(out, raster, W, H);
+        else
+        {
+            std::cerr << "PFM output needs a float (HDR) input without alpha\n";
+            return 2;
+        }
+    }
+    else
+    {
+        std::vector<uint8_t> bytes;
+        int depth = 8;
+        pngSamplesOf(raster, bytes, depth);
+        ok = writePNG(out, pngImageSamples(bytes.data(), W, H, C, depth), currentPngOptions().params);
+    }
+    if (!ok)
+    {
+        std::cerr << "Failed to write: " << out << "\n";
+        return 1;
+    }
+    double sse = 0;
+    for (double e : stats.sse)
+        sse += e;
+    const char *type = std::is_same_v<T, uint8_t> ? "8-bit" : std::is_same_v<T, uint16_t> ? "16-bit" : "float";
+    std::printf("%dx%d %s x%d nodes=%zu leaves=%zu build=%.1f ms psnr=%.2f dB\n", W, H, type, C, stats.nodes,
+                stats.leaves, stats.ms,
+                10.0 * std::log10(SampleTraits<T>::peak * SampleTraits<T>::peak * C * W * H / std::max(sse, 1e-300)));
+    return 0;
+}
+
+template <class T>
+static int buildNativeChannels(const HeadlessArgs &a, const T *samples, int W, int H, int channels)
+{
+    switch (channels)
+    {
+    case 1:
+        return buildNative<1>(a, samples, W, H);
+    case 3:
+        return buildNative<3>(a, samples, W, H);
+    default:
+        return buildNative<4>(a, samples, W, H);
+    }
+}
+
+// Loads with stbi_loadf (HDR), stbi_load_16 (16-bit) or stbi_load at the
+// file's channel count; gray + alpha is widened to RGBA.
+static int runBuildNative(const HeadlessArgs &a)
+{
+    const char *path = a.pos[0].c_str();
+    int w = 0, h = 0, ch = 0;
+    if (!stbi_info(path, &w, &h, &ch))
+    {
+        std::cerr << "Failed to load image: " << a.pos[0] << "\n";
+        return 1;
+    }
+    const int C = ch == 1 ? 1 : ch == 3 ? 3 : 4;
+    void *data = stbi_is_hdr(path)      ? (void *)stbi_loadf(path, &w, &h, &ch, C)
+                 : stbi_is_16_bit(path) ? (void *)stbi_load_16(path, &w, &h, &ch, C)
+                                        : (void *)stbi_load(path, &w, &h, &ch, C);
+    if (!data)
+    {
+        std::cerr << "Failed to load image: " << a.pos[0] << "\n";
+        return 1;
+    }
+    std::unique_ptr<void, void (*)(void *)> owner(data, stbi_image_free);
+    if (stbi_is_hdr(path))
+        return buildNativeChannels(a, (const float *)data, w, h, C);
+    if (stbi_is_16_bit(path))
+        return buildNativeChannels(a, (const uint16_t *)data, w, h, C);
+    return buildNativeChannels(a, (const uint8_t *)data, w, h, C);
+}
+
+// Plain in-memory build; .ppm/.pam/.rgb inputs are built straight from the mapping.
+static int runBuild(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --build <image> <out.qtc|out.qtp|out.qti|out.png|out.qoi> [--leaf N] [--sd X] [--size WxH]"
+                     " [--out-of-core] [--mem-limit MB] [--spill-depth D] [--png-preset fast|default|max]"
+                     " [--palette] [--quantize] [--level 0-12] [--deflate builtin|zlib|libdeflate]"
+                     " [--index-depth D] [--target-kb K | --target-bytes N | --target-psnr dB [--search-leaf]]"
+                     " [--best-first [--max-leaves N] [--max-bytes N] [--max-ms T]]"
+                     " [--split mean|luma|max|ycbcr|edge] [--metrics] [--json] | --native\n";
+        return 2;
+    }
+    if (const char *preset = a.get("png-preset"))
+        if (!parsePngPreset(preset, gPngPreset))
+        {
+            std::cerr << "Unknown PNG preset: " << preset << " (fast, default, max)\n";
+            return 2;
+        }
+    if (const char *backend = a.get("deflate"))
+        if (!parseDeflateBackend(backend, gDeflateBackend) || !deflateBackendAvailable(gDeflateBackend))
+        {
+            std::cerr << "Deflate backend not available: " << backend << "\n";
+            return 2;
+        }
+    gPngLevel = std::min(a.getInt("level", -1), 12);
+    gPngPalette = a.has("palette");
+    gPngQuantize = a.has("quantize");
+    if (a.has("native"))
+        return runBuildNative(a);
+    if (!loadImage(a.pos[0]))
+        return 1;
+    int minLeaf = std::max(1, a.getInt("leaf", 1));
+    double sd = a.getDouble("sd", 16.0);
+    RateTarget target;
+    target.kind = a.has("target-psnr") ? RATE_PSNR : a.has("target-kb") || a.has("target-bytes") ? RATE_BYTES : RATE_OFF;
+    target.value = a.has("target-psnr") ? a.getDouble("target-psnr", 0)
+                   : a.has("target-kb") ? a.getDouble("target-kb", 0) * 1024.0
+                                        : a.getDouble("target-bytes", 0);
+    target.searchLeaf = a.has("search-leaf");
+    target.minLeaf = minLeaf;
+    if (target.kind != RATE_OFF)
+    {
+        RateModel model;
+        model.analyse(image);
+        RateResult r = model.search(target);
+        // the model counts .qtc bytes; any other output is fitted on its real size
+        const std::string &out = a.pos[1];
+        if (target.kind == RATE_BYTES && !hasExt(out, ".qtc"))
+        {
+            const int indexDepth = a.getInt("index-depth", -1);
+            r = model.fitEncoded(target, r, [&](double s, int leaf)
+                                 {
+                                     BuildStats bs{};
+                                     Node *n = buildQT(image, 0, 0, IMG_W, IMG_H, leaf, s, bs);
+                                     RasterCache raster(&gRasterPool); // n's raster, gone with it
+                                     const size_t bytes = outputBytes(out, n, nullptr, raster, IMG_W, IMG_H, indexDepth);
+                                     destroy(n);
+                                     return bytes; });
+        }
+        else
+            r.fileBytes = r.bytes;
+        std::printf("rate: %s %s %.2f -> sd=%.4f leaf=%d qtc_bytes=%zu file_bytes=%zu psnr=%.2f dB probes=%d"
+                    " encodes=%d analyse=%.1f ms search=%.1f ms\n",
+                    r.met ? "met" : "missed", target.kind == RATE_PSNR ? "psnr >=" : "bytes <=", target.value,
+                    r.sdThresh, r.minLeaf, r.bytes, r.fileBytes, r.psnr, r.probes, r.encodes, r.analyseMs,
+                    r.searchMs);
+        minLeaf = r.minLeaf;
+        sd = r.sdThresh;
+    }
+    SpillStore spill;
+    spill.params.memLimitBytes = (size_t)std::max(1, a.getInt("mem-limit", 256)) << 20;
+    spill.params.spillDepth = a.getInt("spill-depth", spill.params.spillDepth);
+
+    int split = SPLIT_MEAN;
+    SplitSums sums;
+    if (const char *name = a.get("split"))
+    {
+        if (!parseSplitCriterion(name, split))
+        {
+            std::cerr << "Unknown split criterion: " << name << " (mean, luma, max, ycbcr, edge)\n";
+            return 2;
+        }
+        auto s0 = std::chrono::high_resolution_clock::now();
+        sums.build(image, splitPlanes(split));
+        std::printf("split: %s sums=%.1f ms\n", splitCriterionName(split),
+                    std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - s0).count());
+    }
+
+    BuildStats stats{};
+    auto t0 = std::chrono::high_resolution_clock::now();
+    Node *root = nullptr;
+    if (a.has("best-first"))
+    {
+        BestFirstBuilder bf;
+        BestFirstLimits lim;
+        lim.maxLeaves = (size_t)std::max(0, a.getInt("max-leaves", 0));
+        lim.maxBytes = (size_t)std::max(0.0, a.getDouble("max-bytes", 0));
+        lim.maxMs = a.getDouble("max-ms", 0);
+        bf.start(image, minLeaf);
+        const int stop = bf.run(lim);
+        root = bf.root;
+        stats.nodes = bf.nodes;
+        stats.leaves = bf.leaves;
+        std::copy(bf.sse, bf.sse + 3, stats.sse);
+        std::printf("best-first: stopped on %s after %zu splits\n", bestFirstStopName(stop), bf.splits);
+    }
+    else if (a.has("split"))
+        root = buildQTSplit(split, sums, minLeaf, sd, stats);
+    else
+        root = a.has("out-of-core") ? buildQTOutOfCore(image, 0, 0, IMG_W, IMG_H, minLeaf, sd, stats, spill)
+                                    : buildQT(image, 0, 0, IMG_W, IMG_H, minLeaf, sd, stats);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    stats.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    const std::string &out = a.pos[1];
+    RasterCache raster(&gRasterPool);
+    PngEncodeStats png;
+    const bool ok = hasExt(out, ".qtc")   ? saveQtc(out, root, IMG_W, IMG_H, &spill)
+                    : hasExt(out, ".qtp") ? saveQtp(out, root, IMG_W, IMG_H, &spill)
+                    : hasExt(out, ".qti") ? saveQti(out, root, IMG_W, IMG_H, &spill, a.getInt("index-depth", -1))
+                    : hasExt(out, ".qoi") ? saveQuadtreeQOI(out, root, &spill, raster, IMG_W, IMG_H)
+                                          : saveQuadtreePNG(out, root, &spill, IMG_W, IMG_H, currentPngOptions(), &png);
+    std::printf("%dx%d nodes=%zu leaves=%zu qtc_bytes=%zu build=%.1f ms psnr=%.2f dB spilled=%zu bytes (%zu subtrees)"
+                " resident=%.1f MB\n",
+                IMG_W, IMG_H, stats.nodes, stats.leaves, qtcBytes(stats.nodes, stats.leaves), stats.ms,
+                psnrFromSSE(stats.totalSSE(), 3.0 * IMG_W * IMG_H), spill.bytesSpilled, spill.refs.size(), spill.residentBytes(stats) / (1024.0 * 1024.0));
+    if (ok && hasExt(out, ".qoi"))
+        std::printf("qoi: %zu bytes encode=%.1f ms (%.0f MB/s)\n", gLastQoiBytes, gLastQoiMs,
+                    encodeMBps(IMG_W, IMG_H, gLastQoiMs));
+    else if (ok && !hasExt(out, ".qtc") && !hasExt(out, ".qtp") && !hasExt(out, ".qti"))
+        std::printf("png: %s (%d colors) deflate=%s encode=%.1f ms (%.0f MB/s) buffers=%.2f MB\n",
+                    png.paletteColors ? "palette" : "rgb", png.paletteColors, deflateBackendName(gDeflateBackend),
+                    png.ms, encodeMBps(IMG_W, IMG_H, png.ms), png.peakBytes / (1024.0 * 1024.0));
+    if (ok && (a.has("metrics") || a.has("json")))
+    {
+        const QualityMetrics q = qualityFromStats(stats, root, image, nullptr, &spill);
+        if (a.has("json"))
+            std::printf("{\"image\":%s,\"output\":%s,\"width\":%d,\"height\":%d,\"leaf\":%d,\"sd\":%s,"
+                        "\"nodes\":%zu,\"leaves\":%zu,\"qtc_bytes\":%zu,\"build_ms\":%s,\"quality\":%s}\n",
+                        jsonString(a.pos[0]).c_str(), jsonString(out).c_str(), IMG_W, IMG_H, minLeaf,
+                        jsonNumber(sd).c_str(), stats.nodes, stats.leaves, qtcBytes(stats.nodes, stats.leaves),
+                        jsonNumber(stats.ms).c_str(), qualityJson(q).c_str());
+        else
+            printQuality(q);
+    }
+    destroy(root);
+    if (!ok)
+    {
+        std::cerr << "Failed to write: " << out << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Times each stage (build, rasterize, PNG, QOI, quality metrics) on every
+// image, keeping the best of --runs, and reports the tree's quality.
+static int runBench(const HeadlessArgs &a)
+{
+    if (a.pos.empty())
+    {
+        std::cerr << "usage: --bench <image...> [--leaf N] [--sd X] [--runs 3] [--threads N] [--json]\n";
+        return 2;
+    }
+    const int minLeaf = std::max(1, a.getInt("leaf", 1));
+    const double sd = a.getDouble("sd", 16.0);
+    const int runs = std::max(1, a.getInt("runs", 3));
+    const int threads = a.getInt("threads", 0);
+    const bool json = a.has("json");
+    auto since = [](std::chrono::high_resolution_clock::time_point t0)
+    { return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count(); };
+    if (!json)
+        std::printf("%-24s %11s %9s %9s %9s %9s %9s %9s %8s %7s\n", "image", "size", "leaves", "build", "raster",
+                    "png", "qoi", "metrics", "psnr", "ssim");
+    for (const std::string &path : a.pos)
+    {
+        if (!loadImage(path))
+            return 1;
+        double best[5] = {1e300, 1e300, 1e300, 1e300, 1e300};
+        BuildStats stats{};
+        QualityMetrics q;
+        size_t pngBytes = 0;
+        for (int r = 0; r < runs; ++r)
+        {
+            stats = {};
+            auto t = std::chrono::high_resolution_clock::now();
+            Node *root = buildQT(image, 0, 0, IMG_W, IMG_H, minLeaf, sd, stats);
+            best[0] = std::min(best[0], since(t));
+            RasterCache raster(&gRasterPool);
+            t = std::chrono::high_resolution_clock::now();
+            raster.get(root, IMG_W, IMG_H, nullptr, threads);
+            best[1] = std::min(best[1], since(t));
+            const PngEncodeStats png = pngSizeOf(root, nullptr, IMG_W, IMG_H, currentPngOptions());
+            pngBytes = png.bytes;
+            best[2] = std::min(best[2], png.ms);
+            std::vector<uint8_t> qoi;
+            encodeQuadtreeQOI(root, nullptr, raster, IMG_W, IMG_H, qoi);
+            best[3] = std::min(best[3], gLastQoiMs);
+            q = qualityFromStats(stats, root, image, raster.get(root, IMG_W, IMG_H, nullptr, threads), nullptr,
+                                 threads);
+            best[4] = std::min(best[4], q.mseMs + q.ssimMs);
+            destroy(root);
+        }
+        if (json)
+            std::printf("{\"image\":%s,\"width\":%d,\"height\":%d,\"leaf\":%d,\"sd\":%s,\"leaves\":%zu,"
+                        "\"qtc_bytes\":%zu,\"png_bytes\":%zu,\"build_ms\":%s,\"raster_ms\":%s,\"png_ms\":%s,"
+                        "\"qoi_ms\":%s,\"metrics_ms\":%s,\"quality\":%s}\n",
+                        jsonString(path).c_str(), IMG_W, IMG_H, minLeaf, jsonNumber(sd).c_str(), stats.leaves,
+                        qtcBytes(stats.nodes, stats.leaves), pngBytes, jsonNumber(best[0]).c_str(),
+                        jsonNumber(best[1]).c_str(), jsonNumber(best[2]).c_str(), jsonNumber(best[3]).c_str(),
+                        jsonNumber(best[4]).c_str(), qualityJson(q).c_str());
+        else
+        {
+            char size[32];
+            std::snprintf(size, sizeof(size), "%dx%d", IMG_W, IMG_H);
+            std::printf("%-24s %11s %9zu %7.1fms %7.1fms %7.1fms %7.1fms %7.1fms %6.2fdB %7.4f\n",
+                        std::filesystem::path(path).filename().string().c_str(), size, stats.leaves, best[0],
+                        best[1], best[2], best[3], best[4], q.psnrAll, q.ssim);
+        }
+    }
+    return 0;
+}
 
-    int out_len = 0;
-    unsigned char *mem = stbi_write_png_to_mem(
-        reinterpret_cast<unsigned char *>(buf.data()),
-        W * 3,   // stride in bytes
-        W, H, 3, // w, h, channels
-        &out_len);
-    if (mem)
+// Size and quality over a leaf x threshold grid (the viewer's sliders by
+// default) as CSV, with the Pareto frontier printed.
+static int runSweep(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --sweep <image> <out.csv> [--leaf-list 1,2,4] [--sd-list 1,2,4 | --sd-range lo,hi,step"
+                     " | --sd-cuts [--sd-max X]] [--png] [--no-build] [--threads N]\n";
+        return 2;
+    }
+    std::vector<int> leaves;
+    for (double v : a.getList("leaf-list"))
+        leaves.push_back(std::max(1, (int)v));
+    if (leaves.empty())
+        for (int i = 0; i <= 8; ++i)
+            leaves.push_back(leafFromIdx(i));
+    if (!loadImage(a.pos[0]))
+        return 1;
+    RateModel model;
+    model.analyse(image);
+    std::vector<double> sds = a.getList("sd-list");
+    const std::vector<double> range = a.getList("sd-range");
+    if (a.has("sd-cuts"))
+        sds = sweepCuts(model, 0.0, a.getDouble("sd-max", 64.0));
+    else if (range.size() == 3 && range[2] > 0)
+        for (double v = range[0]; v <= range[1] + 1e-9; v += range[2])
+            sds.push_back(v);
+    if (sds.empty())
+        for (int i = 0; i <= 6; ++i)
+            sds.push_back(sdFromIdx(i));
+
+    SweepOptions opt;
+    opt.build = !a.has("no-build");
+    opt.threads = a.getInt("threads", 0);
+    QuadtreePngOptions png = currentPngOptions();
+    png.params.threads = 1; // the points are encoded in parallel instead
+    if (a.has("png"))
+        opt.pngSize = [&png](const Node *root) { return pngSizeOf(root, nullptr, IMG_W, IMG_H, png).bytes; };
+    auto t0 = std::chrono::high_resolution_clock::now();
+    const std::vector<SweepPoint> points = runSweep(model, image, leaves, sds, opt);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    FILE *f = std::fopen(a.pos[1].c_str(), "w");
+    if (!f)
     {
-        STBIW_FREE(mem);
+        std::cerr << "Failed to write: " << a.pos[1] << "\n";
+        return 1;
     }
-    return (size_t)out_len;
+    std::fprintf(f, "leaf,sd,leaves,nodes,qtc_bytes,png_bytes,psnr,build_ms,pareto\n");
+    for (const SweepPoint &p : points)
+        std::fprintf(f, "%d,%.6g,%zu,%zu,%zu,%zu,%.4f,%.3f,%d\n", p.minLeaf, p.sdThresh, p.leaves, p.nodes, p.bytes,
+                     p.pngBytes, p.psnr, p.buildMs, p.pareto ? 1 : 0);
+    if (std::fclose(f) != 0)
+    {
+        std::cerr << "Failed to write: " << a.pos[1] << "\n";
+        return 1;
+    }
+    std::printf("%dx%d points=%zu (%zu leaf sizes x %zu thresholds) analyse=%.1f ms sweep=%.1f ms\n", IMG_W, IMG_H,
+                points.size(), leaves.size(), sds.size(), model.ms, ms);
+    std::printf("pareto frontier (%s bytes vs psnr):\n%6s %10s %10s %12s %9s\n", opt.pngSize ? "png" : "qtc",
+                "leaf", "sd", "leaves", "bytes", "psnr");
+    std::vector<const SweepPoint *> front;
+    for (const SweepPoint &p : points)
+        if (p.pareto)
+            front.push_back(&p);
+    std::sort(front.begin(), front.end(), [](const SweepPoint *x, const SweepPoint *y) { return x->size() < y->size(); });
+    for (const SweepPoint *p : front)
+        std::printf("%6d %10.4g %10zu %12zu %7.2fdB\n", p->minLeaf, p->sdThresh, p->leaves, p->size(), p->psnr);
+    return 0;
+}
+
+// Decodes a prefix of a progressive .qtp file, fed in network-sized chunks,
+// and writes the preview it yields.
+static int runPreview(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --preview <in.qtp> <out.png> [--bytes N | --percent P] [--chunk 4096]\n";
+        return 2;
+    }
+    std::vector<uint8_t> bytes;
+    if (!readFileBytes(a.pos[0], bytes))
+    {
+        std::cerr << "Failed to read: " << a.pos[0] << "\n";
+        return 1;
+    }
+    size_t limit = bytes.size();
+    if (a.has("bytes"))
+        limit = std::min(limit, (size_t)std::max(0, a.getInt("bytes", 0)));
+    else if (a.has("percent"))
+        limit = (size_t)((double)bytes.size() * std::clamp(a.getDouble("percent", 100.0), 0.0, 100.0) / 100.0);
+    const size_t chunk = (size_t)std::max(1, a.getInt("chunk", 4096));
+
+    ProgressiveDecoder dec;
+    size_t feeds = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (size_t off = 0; off < limit && !dec.failed(); off += chunk, ++feeds)
+        dec.feed(bytes.data() + off, std::min(chunk, limit - off));
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (dec.failed() || !dec.hasHeader())
+    {
+        std::cerr << (dec.failed() ? "Malformed .qtp stream\n" : "Not enough bytes for the header\n");
+        return 1;
+    }
+    const int W = (int)dec.header.W, H = (int)dec.header.H;
+    if (!writePNG(a.pos[1], pngImageRGB(reinterpret_cast<const uint8_t *>(dec.raster.data()), W, H)))
+    {
+        std::cerr << "Failed to write: " << a.pos[1] << "\n";
+        return 1;
+    }
+    std::printf("%dx%d fed=%zu/%zu bytes in %zu chunks nodes=%zu complete=%s decode=%.1f ms\n", W, H, limit,
+                bytes.size(), feeds, dec.nodes, dec.done() ? "yes" : "no",
+                std::chrono::duration<double, std::milli>(t1 - t0).count());
+    return 0;
+}
+
+// Adds the subtree offset index to an existing .qtc file.
+static int runIndex(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --index <in.qtc> <out.qti> [--index-depth D]\n";
+        return 2;
+    }
+    std::vector<uint8_t> bytes;
+    if (!readFileBytes(a.pos[0], bytes))
+    {
+        std::cerr << "Failed to read: " << a.pos[0] << "\n";
+        return 1;
+    }
+    size_t indexBytes = 0;
+    if (!saveQtiFromQtc(a.pos[1], bytes, a.getInt("index-depth", -1), &indexBytes))
+    {
+        std::cerr << "Failed to index " << a.pos[0] << " into " << a.pos[1] << "\n";
+        return 1;
+    }
+    std::printf("index: %zu bytes (%.2f%% of the tree)\n", indexBytes, 100.0 * indexBytes / bytes.size());
+    return 0;
+}
+
+// Decodes one rectangle of a .qti file, reading only the subtrees it touches.
+static int runRegion(const HeadlessArgs &a)
+{
+    int x = 0, y = 0, w = 0, h = 0;
+    const char *rect = a.get("rect");
+    if (a.pos.size() < 2 || !rect || std::sscanf(rect, "%d,%d,%d,%d", &x, &y, &w, &h) != 4)
+    {
+        std::cerr << "usage: --region <in.qti> <out.png> --rect x,y,w,h [--scale S]\n";
+        return 2;
+    }
+    QtiReader reader;
+    if (!reader.open(a.pos[0]))
+    {
+        std::cerr << "Failed to open .qti: " << a.pos[0] << "\n";
+        return 1;
+    }
+    std::vector<Color> px;
+    int outW = 0, outH = 0;
+    QtiRegionStats rs;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if (!reader.decodeRegion(x, y, w, h, a.getInt("scale", 1), px, outW, outH, &rs))
+    {
+        std::cerr << "Region outside the image or malformed file\n";
+        return 1;
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (!writePNG(a.pos[1], pngImageRGB(reinterpret_cast<const uint8_t *>(px.data()), outW, outH)))
+    {
+        std::cerr << "Failed to write: " << a.pos[1] << "\n";
+        return 1;
+    }
+    std::printf("%dx%d out of %ux%u index_depth=%d subtrees=%zu read=%llu/%llu bytes leaves=%zu decode=%.1f ms\n",
+                outW, outH, reader.header.W, reader.header.H, reader.indexDepth, rs.subtrees,
+                (unsigned long long)rs.bytesRead, (unsigned long long)reader.bodyBytes, rs.leaves,
+                std::chrono::duration<double, std::milli>(t1 - t0).count());
+    return 0;
+}
+
+// Writes a DZI or XYZ tile pyramid of an image's tree (built here) or of a .qtc.
+static int runPyramid(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --pyramid <image|in.qtc> <out.dzi|outdir> [--layout dzi|xyz] [--tile N] [--threads N]"
+                     " [--png-preset fast|default|max] [--leaf N] [--sd X]\n";
+        return 2;
+    }
+    PyramidParams pp;
+    pp.layout = hasExt(a.pos[1], ".dzi") ? PYRAMID_DZI : PYRAMID_XYZ;
+    if (const char *layout = a.get("layout"))
+        if (!parsePyramidLayout(layout, pp.layout))
+        {
+            std::cerr << "Unknown layout: " << layout << " (dzi, xyz)\n";
+            return 2;
+        }
+    int preset = PNG_PRESET_FAST;
+    if (const char *p = a.get("png-preset"))
+        if (!parsePngPreset(p, preset))
+        {
+            std::cerr << "Unknown PNG preset: " << p << " (fast, default, max)\n";
+            return 2;
+        }
+    pp.png = pngPresetParams(preset);
+    pp.tileSize = std::clamp(a.getInt("tile", pp.tileSize), 16, 4096);
+    pp.threads = a.getInt("threads", 0);
+
+    Node *root = nullptr;
+    int W = 0, H = 0;
+    BuildStats stats{};
+    if (hasExt(a.pos[0], ".qtc"))
+    {
+        QtcHeader h;
+        root = loadQtc(a.pos[0], h, &stats);
+        W = (int)h.W;
+        H = (int)h.H;
+    }
+    else if (loadImage(a.pos[0]))
+    {
+        root = buildQT(image, 0, 0, IMG_W, IMG_H, std::max(1, a.getInt("leaf", 1)), a.getDouble("sd", 16.0), stats);
+        W = IMG_W;
+        H = IMG_H;
+    }
+    if (!root)
+    {
+        std::cerr << "Failed to load: " << a.pos[0] << "\n";
+        return 1;
+    }
+    PyramidStats ps;
+    const bool ok = exportPyramid(root, W, H, nullptr, a.pos[1], pp, ps);
+    destroy(root);
+    if (!ok)
+    {
+        std::cerr << "Failed to write pyramid: " << a.pos[1] << "\n";
+        return 1;
+    }
+    std::printf("%dx%d %s levels=%d tiles=%zu bytes=%llu export=%.1f ms (%.0f tiles/s)\n", W, H,
+                pyramidLayoutName(pp.layout), ps.levels, ps.tiles, (unsigned long long)ps.bytes, ps.ms,
+                ps.tiles / std::max(ps.ms / 1000.0, 1e-9));
+    return 0;
+}
+
+// True when both trees have the same nodes and the same leaf colors.
+static bool sameTree(const Node *a, const Node *b)
+{
+    if (!a || !b)
+        return a == b;
+    if (a->x != b->x || a->y != b->y || a->w != b->w || a->h != b->h || a->leaf != b->leaf)
+        return false;
+    if (a->leaf)
+        return a->avg.r == b->avg.r && a->avg.g == b->avg.g && a->avg.b == b->avg.b;
+    for (int i = 0; i < 4; ++i)
+        if (!sameTree(a->ch[i], b->ch[i]))
+            return false;
+    return true;
+}
+
+// Stamps a rectangle onto an image, updates its tree incrementally and
+// repaints only the leaves that changed, then checks the result against a
+// full rebuild (same nodes, leaf colors and squared error).
+static int runEdit(const HeadlessArgs &a)
+{
+    int x = 0, y = 0, w = 0, h = 0, r = 255, g = 0, b = 255;
+    const char *rect = a.get("rect");
+    if (a.pos.size() < 2 || !rect || std::sscanf(rect, "%d,%d,%d,%d", &x, &y, &w, &h) != 4)
+    {
+        std::cerr << "usage: --edit <image> <out.png|out.qtc> --rect x,y,w,h [--fill r,g,b] [--leaf N] [--sd X]\n";
+        return 2;
+    }
+    if (const char *fill = a.get("fill"))
+        std::sscanf(fill, "%d,%d,%d", &r, &g, &b);
+    if (!loadImage(a.pos[0]))
+        return 1;
+    ImageView px = image;
+    int ex = x, ey = y, ew = w, eh = h;
+    if (!clipToImage(px, ex, ey, ew, eh))
+    {
+        std::cerr << "Rectangle outside the image\n";
+        return 2;
+    }
+    // a private copy to edit (the loaded pixels may be a read-only mapping)
+    std::vector<uint8_t> pixels((size_t)IMG_W * IMG_H * sizeof(Color));
+    for (int j = 0; j < IMG_H; ++j)
+        std::memcpy(&pixels[(size_t)j * IMG_W * sizeof(Color)], px.data + (size_t)j * px.stride,
+                    (size_t)IMG_W * sizeof(Color));
+    px.data = pixels.data();
+    px.stride = (size_t)IMG_W * sizeof(Color);
+
+    IncrementalTree tree;
+    tree.minLeaf = std::max(1, a.getInt("leaf", 1));
+    tree.sdThresh = a.getDouble("sd", 16.0);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    tree.build(px);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    RasterCache raster(&gRasterPool);
+    raster.get(tree.root, IMG_W, IMG_H);
+
+    const Color c{(uint8_t)std::clamp(r, 0, 255), (uint8_t)std::clamp(g, 0, 255), (uint8_t)std::clamp(b, 0, 255)};
+    for (int j = ey; j < ey + eh; ++j)
+        fillSpanRGB(reinterpret_cast<Color *>(&pixels[((size_t)j * IMG_W + ex) * sizeof(Color)]), (size_t)ew, c);
+    TreeDelta delta;
+    tree.updateRect(px, ex, ey, ew, eh, &delta);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    raster.repaint(delta.added);
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    BuildStats full{};
+    Node *check = buildQT(px, 0, 0, IMG_W, IMG_H, tree.minLeaf, tree.sdThresh, full);
+    auto t4 = std::chrono::high_resolution_clock::now();
+    const double sse = tree.sse[0] + tree.sse[1] + tree.sse[2];
+    // the incremental SSE is kept by adding and subtracting subtree sums, so allow rounding
+    const bool matches = sameTree(tree.root, check) &&
+                         std::fabs(sse - full.totalSSE()) <= 1e-9 * std::max(1.0, full.totalSSE());
+    destroy(check);
+    if (!matches)
+    {
+        std::cerr << "Incremental update differs from a full rebuild (sse " << sse << " vs " << full.totalSSE()
+                  << ")\n";
+        return 1;
+    }
+
+    const std::string &out = a.pos[1];
+    const bool ok = hasExt(out, ".qtc") ? saveQtc(out, tree.root, IMG_W, IMG_H)
+                                        : writePNG(out, pngImageRGB(reinterpret_cast<const uint8_t *>(
+                                                                        raster.get(tree.root, IMG_W, IMG_H)),
+                                                                    IMG_W, IMG_H));
+    if (!ok)
+    {
+        std::cerr << "Failed to write: " << out << "\n";
+        return 1;
+    }
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::printf("%dx%d edit %d,%d %dx%d: leaves removed=%zu added=%zu nodes visited=%zu update=%.2f ms"
+                " repaint=%.2f ms psnr=%.2f dB (build=%.1f ms, rebuild=%.1f ms, identical)\n",
+                IMG_W, IMG_H, ex, ey, ew, eh, delta.removed.size(), delta.added.size(), delta.visited, delta.ms,
+                ms(t3 - t2), psnrFromSSE(sse, 3.0 * IMG_W * IMG_H), ms(t1 - t0), ms(t4 - t3));
+    return 0;
+}
+
+// Encodes image files (in order) or the frames of animated GIFs as one .qtv
+// stream; each frame rebuilds only the subtrees over changed pixels.
+static int runVideo(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --video <frames...|anim.gif> <out.qtv> [--leaf N] [--sd X] [--block N] [--fps N]\n";
+        return 2;
+    }
+    TemporalParams tp;
+    tp.minLeaf = std::max(1, a.getInt("leaf", tp.minLeaf));
+    tp.sdThresh = a.getDouble("sd", tp.sdThresh);
+    tp.block = std::clamp(a.getInt("block", tp.block), 1, 1024);
+    const int frameMs = 1000 / std::clamp(a.getInt("fps", 30), 1, 1000);
+    const std::string &out = a.pos.back();
+    std::FILE *f = std::fopen(out.c_str(), "wb");
+    if (!f)
+    {
+        std::cerr << "Failed to write: " << out << "\n";
+        return 1;
+    }
+
+    TemporalEncoder enc(tp);
+    std::vector<uint8_t> payload, buf;
+    size_t frames = 0, bytes = 0, keyBytes = 0;
+    double ms = 0, keyMs = 0;
+    bool ok = true;
+    auto encodeFrame = [&](const ImageView &px, int delayMs)
+    {
+        if (frames > 0 && (px.W != enc.tree.W || px.H != enc.tree.H))
+        {
+            std::cerr << "Frame " << frames << " is " << px.W << "x" << px.H << ", the stream is " << enc.tree.W
+                      << "x" << enc.tree.H << "\n";
+            return ok = false;
+        }
+        TemporalFrameStats fs;
+        enc.encodeFrame(px, payload, fs);
+        buf.clear();
+        if (frames == 0)
+            writeQtvHeader(buf, QtcHeader{(uint32_t)px.W, (uint32_t)px.H, (uint32_t)px.W, (uint32_t)px.H});
+        appendQtvFrame(buf, payload, delayMs, fs.keyframe);
+        if (std::fwrite(buf.data(), 1, buf.size(), f) != buf.size())
+            return ok = false;
+        const double frameTotal = fs.detectMs + fs.updateMs + fs.encodeMs;
+        std::printf("frame %zu: changed=%zu/%zu blocks reused=%zu subtrees rebuilt=%zu nodes=%zu bytes=%zu"
+                    " detect=%.2f update=%.2f encode=%.2f ms\n",
+                    frames, fs.changedBlocks, fs.blocks, fs.reused, fs.rebuilt, fs.nodes, fs.bytes, fs.detectMs,
+                    fs.updateMs, fs.encodeMs);
+        if (fs.keyframe)
+        {
+            keyBytes = fs.bytes;
+            keyMs = frameTotal;
+        }
+        frames++;
+        bytes += buf.size();
+        ms += frameTotal;
+        return true;
+    };
+
+    for (size_t i = 0; i + 1 < a.pos.size() && ok; ++i)
+    {
+        const std::string &path = a.pos[i];
+        if (!hasExt(path, ".gif"))
+        {
+            ok = loadImage(path) && encodeFrame(image, frameMs);
+            continue;
+        }
+        std::vector<uint8_t> gif;
+        int *delays = nullptr, w = 0, h = 0, z = 0, comp = 0;
+        stbi_uc *rgba = readFileBytes(path, gif) ? stbi_load_gif_from_memory(gif.data(), (int)gif.size(), &delays,
+                                                                              &w, &h, &z, &comp, 4)
+                                                 : nullptr;
+        if (!rgba)
+        {
+            std::cerr << "Failed to load GIF: " << path << "\n";
+            ok = false;
+            break;
+        }
+        // frames come back composited, as RGBA
+        std::vector<uint8_t> rgb((size_t)w * h * 3);
+        for (int k = 0; k < z && ok; ++k)
+        {
+            const stbi_uc *src = rgba + (size_t)k * w * h * 4;
+            for (size_t p = 0; p < (size_t)w * h; ++p)
+                std::memcpy(&rgb[p * 3], src + p * 4, 3);
+            ImageView px;
+            px.data = rgb.data();
+            px.W = w;
+            px.H = h;
+            px.stride = (size_t)w * 3;
+            encodeFrame(px, delays && delays[k] > 0 ? delays[k] : frameMs);
+        }
+        stbi_image_free(rgba);
+        stbi_image_free(delays);
+    }
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || frames == 0)
+    {
+        std::cerr << "Failed to encode: " << out << "\n";
+        return 1;
+    }
+    // the keyframe is a full build; the rest is what a live feed sustains
+    const size_t deltas = frames - 1;
+    const double deltaMs = deltas ? (ms - keyMs) / deltas : keyMs;
+    std::printf("%dx%d frames=%zu bytes=%zu keyframe=%zu bytes %.1f ms, then %.1f bytes %.2f ms per frame (%.0f fps)\n",
+                enc.tree.W, enc.tree.H, frames, bytes, keyBytes, keyMs,
+                deltas ? (double)(bytes - QTV_HEADER_BYTES - (frames * QTV_FRAME_HEADER_BYTES) - keyBytes) / deltas
+                       : 0.0,
+                deltaMs, 1000.0 / std::max(deltaMs, 1e-6));
+    return 0;
+}
+
+// Decodes a .qtv stream and writes every frame as <prefix>_NNNN.png.
+static int runVideoDecode(const HeadlessArgs &a)
+{
+    if (a.pos.size() < 2)
+    {
+        std::cerr << "usage: --video-decode <in.qtv> <out_prefix>\n";
+        return 2;
+    }
+    std::vector<uint8_t> bytes;
+    TemporalDecoder dec;
+    if (!readFileBytes(a.pos[0], bytes) || !readQtvHeader(bytes.data(), bytes.size(), dec.header))
+    {
+        std::cerr << "Failed to read .qtv: " << a.pos[0] << "\n";
+        return 1;
+    }
+    // every frame is rasterized into a PNG, so the size is bounded as qoiDecode bounds it
+    if (!qtcRasterFits(dec.header))
+    {
+        std::cerr << "Frame size too large: " << dec.header.W << "x" << dec.header.H << "\n";
+        return 1;
+    }
+    const int W = (int)dec.header.W, H = (int)dec.header.H;
+    size_t frames = 0;
+    double ms = 0;
+    for (size_t off = QTV_HEADER_BYTES; off < bytes.size(); ++frames)
+    {
+        if (bytes.size() - off < QTV_FRAME_HEADER_BYTES)
+            break;
+        const size_t len = getU32(&bytes[off]);
+        const bool key = bytes[off + 6] & 1;
+        off += QTV_FRAME_HEADER_BYTES;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        if (len > bytes.size() - off || !dec.decodeFrame(&bytes[off], len, key))
+        {
+            std::cerr << "Malformed frame " << frames << "\n";
+            return 1;
+        }
+        ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        off += len;
+        char name[32];
+        std::snprintf(name, sizeof(name), "_%04zu.png", frames);
+        if (!saveQuadtreePNG(a.pos[1] + name, dec.tree, nullptr, W, H, currentPngOptions()))
+        {
+            std::cerr << "Failed to write: " << a.pos[1] << name << "\n";
+            return 1;
+        }
+    }
+    std::printf("%dx%d frames=%zu decode=%.2f ms/frame\n", W, H, frames, frames ? ms / frames : 0.0);
+    return 0;
+}
+
+// Returns -1 when argv is not a headless invocation (open the viewer instead).
+static int runHeadless(int argc, char **argv)
+{
+    if (argc < 2 || std::strncmp(argv[1], "--", 2) != 0)
+        return -1;
+    const HeadlessArgs a = parseHeadlessArgs(argc, argv);
+    if (const char *size = a.get("size"))
+        std::sscanf(size, "%dx%d", &gRawW, &gRawH);
+    if (a.cmd == "tiled")
+        return runTiled(a);
+    if (a.cmd == "build")
+        return runBuild(a);
+    if (a.cmd == "bench")
+        return runBench(a);
+    if (a.cmd == "sweep")
+        return runSweep(a);
+    if (a.cmd == "preview")
+        return runPreview(a);
+    if (a.cmd == "index")
+        return runIndex(a);
+    if (a.cmd == "region")
+        return runRegion(a);
+    if (a.cmd == "pyramid")
+        return runPyramid(a);
+    if (a.cmd == "edit")
+        return runEdit(a);
+    if (a.cmd == "video")
+        return runVideo(a);
+    if (a.cmd == "video-decode")
+        return runVideoDecode(a);
+    std::cerr << "Unknown command: " << argv[1] << "\n";
+    return 2;
 }
 
 // ---------------- Main ----------------
 int main(int argc, char **argv)
 {
+    const int headless = runHeadless(argc, argv);
+    if (headless >= 0)
+        return headless;
+
     // Persistent current path shown in UI
     gCurrentImagePath = (argc >= 2) ? argv[1] : "./images/image.png"; // change default if you like
     // One-shot pending path that triggers a single load/rebuild
@@ -421,13 +1593,15 @@ int main(int argc, char **argv)
     {
         // Fallback to tiny checker
         IMG_W = IMG_H = 64;
-        image.assign(IMG_H, std::vector<Color>(IMG_W));
+        auto checker = std::make_shared<std::vector<Color>>((size_t)IMG_W * IMG_H);
         for (int y = 0; y < IMG_H; ++y)
             for (int x = 0; x < IMG_W; ++x)
             {
                 bool b = ((x / 8 + y / 8) & 1) == 0;
-                image[y][x] = b ? Color{220, 220, 220} : Color{40, 40, 40};
+                (*checker)[(size_t)y * IMG_W + x] = b ? Color{220, 220, 220} : Color{40, 40, 40};
             }
+        image = viewOf(*checker, IMG_W, IMG_H);
+        gImageOwner = checker;
     }
 
     // Build first quadtree
@@ -435,16 +1609,43 @@ int main(int argc, char **argv)
     BuildStats stats{};
     auto rebuild = [&]()
     {
+        gRaster.invalidate();
         destroy(root);
+        gSpill.reset();
         stats = {};
         auto t0 = std::chrono::high_resolution_clock::now();
-        root = buildQT(image, 0, 0, IMG_W, IMG_H, leafFromIdx(gPowIdx), sdFromIdx(gSdIdx), stats);
+        if (gBestFirst)
+        {
+            BestFirstLimits lim;
+            lim.maxLeaves = (size_t)std::max(1, gBestFirstLeaves);
+            lim.maxMs = gBestFirstMs;
+            root = buildQTBestFirst(image, currentLeaf(), lim, stats, &gBestFirstStop);
+        }
+        else if (gOutOfCore)
+        {
+            gSpill.params.memLimitBytes = (size_t)gMemLimitMB << 20;
+            gSpill.params.spillDepth = gSpillDepth;
+            root = buildQTOutOfCore(image, 0, 0, IMG_W, IMG_H, currentLeaf(), currentSd(), stats, gSpill);
+        }
+        else if (gSplit != SPLIT_MEAN)
+        {
+            if (!gSplitSums.holds(image, splitPlanes(gSplit)))
+                gSplitSums.build(image, gSplitSums.planes | splitPlanes(gSplit));
+            root = buildQTSplit(gSplit, gSplitSums, currentLeaf(), currentSd(), stats);
+        }
+        else
+            root = buildQT(image, 0, 0, IMG_W, IMG_H, currentLeaf(), currentSd(), stats);
         auto t1 = std::chrono::high_resolution_clock::now();
         stats.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
 
         // Update size readouts whenever we rebuild
         gLeafDataBytes = estimateQuadtreeBytes(stats.leaves, true);
-        gLastPngBytes = pngSizeOfCurrent(root, IMG_W, IMG_H);
+        // PNG size, QOI and metrics all read the one rasterization in gRaster
+        gLastPng = pngSizeOf(root, &gSpill, IMG_W, IMG_H, currentPngOptions(), &gRaster);
+        gLastPngBytes = gLastPng.bytes;
+        std::vector<uint8_t> qoi;
+        encodeQuadtreeQOI(root, &gSpill, gRaster, IMG_W, IMG_H, qoi);
+        gQuality = qualityFromStats(stats, root, image, gRaster.get(root, IMG_W, IMG_H, &gSpill), &gSpill);
     };
     rebuild();
 
@@ -460,6 +1661,9 @@ int main(int argc, char **argv)
             if (loadImage(gCurrentImagePath))
             {
                 gOriginalFileBytes = getFileSize(gCurrentImagePath);
+                gRateModel.clear();
+                gRateApplied = false;
+                gSplitSums = SplitSums{};
                 rebuild();
             }
             gPendingImagePath.clear(); // consume the pending request
@@ -574,7 +1778,7 @@ int main(int argc, char **argv)
                 ImGuiFileDialog::Instance()->OpenDialog(
                     "PickImage",
                     "Open image",
-                    ".*,.png,.jpg,.jpeg,.bmp,.tga,.gif,.tiff,.webp", // image formats + all
+                    ".*,.png,.jpg,.jpeg,.bmp,.tga,.gif,.tiff,.webp,.ppm,.pam,.qoi", // image formats + all
                     config);
                 ImGuiFileDialog::Instance()->Display("PickImage", ImGuiWindowFlags_NoCollapse, ImVec2(400, 400));
             }
@@ -614,27 +1818,79 @@ int main(int argc, char **argv)
             // --- Save button ---
             static char outPath[512] = "output/output.png";
             ImGui::InputTextWithHint("##out", "output filename", outPath, sizeof(outPath));
+            ImGui::SetNextItemWidth(120);
+            bool pngChanged = ImGui::Combo("PNG preset", &gPngPreset, "fast\0default\0max\0");
+            ImGui::SetNextItemWidth(120);
+            pngChanged |= ImGui::SliderInt("Level", &gPngLevel, -1, 12, gPngLevel < 0 ? "preset" : "%d");
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::BeginCombo("Deflate", deflateBackendName(gDeflateBackend)))
+            {
+                for (int b = 0; b < DEFLATE_BACKEND_COUNT; ++b)
+                    if (deflateBackendAvailable(b) && ImGui::Selectable(deflateBackendName(b), b == gDeflateBackend))
+                    {
+                        gDeflateBackend = b;
+                        pngChanged = true;
+                    }
+                ImGui::EndCombo();
+            }
+            pngChanged |= ImGui::Checkbox("Palette PNG", &gPngPalette);
+            ImGui::SameLine();
+            pngChanged |= ImGui::Checkbox("Quantize to 256", &gPngQuantize);
+            if (pngChanged)
+            {
+                gLastPng = pngSizeOf(root, &gSpill, IMG_W, IMG_H, currentPngOptions(), &gRaster);
+                gLastPngBytes = gLastPng.bytes;
+            }
             if (ImGui::Button("Save quadtree PNG"))
             {
-                bool ok = saveQuadtreePNG(outPath, root, IMG_W, IMG_H);
-                if (ok)
+                // .qtc/.qtp/.qti write the tree itself instead of its rendering
+                if (hasExt(outPath, ".qtc") || hasExt(outPath, ".qtp") || hasExt(outPath, ".qti"))
                 {
-                    std::cout << "Saved: " << outPath << "\n";
-                    // Optional: also report actual file size on disk if you saved to disk
-                    try
+                    const bool ok = hasExt(outPath, ".qtp")   ? saveQtp(outPath, root, IMG_W, IMG_H, &gSpill)
+                                    : hasExt(outPath, ".qti") ? saveQti(outPath, root, IMG_W, IMG_H, &gSpill)
+                                                              : saveQtc(outPath, root, IMG_W, IMG_H, &gSpill);
+                    if (ok)
+                        std::cout << "Saved: " << outPath << "\n";
+                    else
+                        std::cerr << "Failed to save: " << outPath << "\n";
+                }
+                else if (hasExt(outPath, ".qoi"))
+                {
+                    if (saveQuadtreeQOI(outPath, root, &gSpill, gRaster, IMG_W, IMG_H))
+                        std::cout << "Saved: " << outPath << "\n";
+                    else
+                        std::cerr << "Failed to save: " << outPath << "\n";
+                }
+                else if (hasExt(outPath, ".dzi"))
+                {
+                    PyramidStats ps;
+                    if (exportPyramid(root, IMG_W, IMG_H, &gSpill, outPath, PyramidParams{}, ps))
+                        std::cout << "Saved: " << outPath << " (" << ps.tiles << " tiles, " << ps.ms << " ms)\n";
+                    else
+                        std::cerr << "Failed to save: " << outPath << "\n";
+                }
+                else
+                {
+                    bool ok = saveQuadtreePNG(outPath, root, &gSpill, IMG_W, IMG_H, currentPngOptions(), &gLastPng);
+                    if (ok)
                     {
-                        gLastPngBytes = (size_t)std::filesystem::file_size(outPath);
+                        std::cout << "Saved: " << outPath << "\n";
+                        // Optional: also report actual file size on disk if you saved to disk
+                        try
+                        {
+                            gLastPngBytes = (size_t)std::filesystem::file_size(outPath);
+                        }
+                        catch (...)
+                        {
+                            // fallback: keep in-memory size
+                            gLastPngBytes = gLastPng.bytes;
+                        }
                     }
-                    catch (...)
+                    else
                     {
-                        // fallback: keep in-memory size
-                        gLastPngBytes = pngSizeOfCurrent(root, IMG_W, IMG_H);
+                        std::cerr << "Failed to save: " << outPath << "\n";
                     }
                 }
-                else
-                {
-                    std::cerr << "Failed to save: " << outPath << "\n";
-                }
             }
         }
 
@@ -658,13 +1914,85 @@ int main(int argc, char **argv)
             ImGui::Text("StdDev threshold: %.0f", sdFromIdx(sdIdxTmp));
 
             bool changed = (powIdxTmp != gPowIdx) || (sdIdxTmp != gSdIdx);
+            if (changed)
+                gRateApplied = false;
             gPowIdx = powIdxTmp;
             gSdIdx = sdIdxTmp;
 
+            // Rate control: search the threshold (and leaf size) for a target
+            ImGui::Separator();
+            ImGui::Text("Rate control");
+            ImGui::RadioButton("Off", &gRateKind, RATE_OFF);
+            ImGui::SameLine();
+            ImGui::RadioButton("Max size", &gRateKind, RATE_BYTES);
+            ImGui::SameLine();
+            ImGui::RadioButton("Min PSNR", &gRateKind, RATE_PSNR);
+            if (gRateKind == RATE_BYTES)
+            {
+                ImGui::InputFloat(gRatePngBudget ? "Budget (KB, PNG)" : "Budget (KB, .qtc)", &gRateKB, 10.0f, 100.0f,
+                                  "%.1f");
+                ImGui::Checkbox("Budget the PNG export", &gRatePngBudget);
+            }
+            else if (gRateKind == RATE_PSNR)
+                ImGui::InputFloat("Target (dB)", &gRateDb, 0.5f, 2.0f, "%.2f");
+            if (gRateKind != RATE_OFF)
+            {
+                ImGui::Checkbox("Search leaf size too", &gRateSearchLeaf);
+                if (ImGui::Button("Fit to target"))
+                {
+                    if (gRateModel.empty() || gRateModel.W != IMG_W || gRateModel.H != IMG_H)
+                        gRateModel.analyse(image);
+                    RateTarget t;
+                    t.kind = gRateKind;
+                    t.value = gRateKind == RATE_BYTES ? gRateKB * 1024.0 : gRateDb;
+                    t.searchLeaf = gRateSearchLeaf;
+                    t.minLeaf = leafFromIdx(gPowIdx);
+                    gRateLast = gRateModel.search(t);
+                    if (gRateKind == RATE_BYTES && gRatePngBudget)
+                        gRateLast = gRateModel.fitEncoded(t, gRateLast, [png = currentPngOptions()](double s, int leaf)
+                                                          {
+                                                              BuildStats bs{};
+                                                              Node *n = buildQT(image, 0, 0, IMG_W, IMG_H, leaf, s, bs);
+                                                              const size_t bytes = pngSizeOf(n, nullptr, IMG_W, IMG_H, png).bytes;
+                                                              destroy(n);
+                                                              return bytes; });
+                    else
+                        gRateLast.fileBytes = gRateLast.bytes;
+                    gRateApplied = true;
+                    changed = true;
+                }
+            }
+            if (gRateApplied)
+            {
+                ImGui::Text("%s: sd %.3f, leaf %d px", gRateLast.met ? "Target met" : "Target missed",
+                            gRateLast.sdThresh, gRateLast.minLeaf);
+                ImGui::Text("%.2f KB, %.2f dB, %d probes, %d encodes (%.1f + %.1f ms)", gRateLast.fileBytes / 1024.0,
+                            gRateLast.psnr, gRateLast.probes, gRateLast.encodes, gRateLast.analyseMs,
+                            gRateLast.searchMs);
+            }
+            ImGui::Separator();
+            changed |= ImGui::Checkbox("Best-first (leaf budget)", &gBestFirst);
+            if (gBestFirst)
+            {
+                changed |= ImGui::InputInt("Max leaves", &gBestFirstLeaves, 1000, 10000);
+                changed |= ImGui::InputFloat("Deadline (ms, 0 = none)", &gBestFirstMs, 1.0f, 10.0f, "%.1f");
+                ImGui::Text("Stopped on: %s", bestFirstStopName(gBestFirstStop));
+            }
+            if (!gBestFirst && !gOutOfCore)
+                changed |= ImGui::Combo("Split criterion", &gSplit, "mean StdDev\0luma\0max channel\0YCbCr\0edge\0");
+
             ImGui::Separator();
             ImGui::Checkbox("Fill", &gDrawFill);
             ImGui::SameLine();
             ImGui::Checkbox("Grid", &gDrawLines);
+
+            ImGui::Separator();
+            changed |= ImGui::Checkbox("Out-of-core (spill subtrees to disk)", &gOutOfCore);
+            if (gOutOfCore)
+            {
+                changed |= ImGui::SliderInt("Memory limit (MB)", &gMemLimitMB, 1, 4096);
+                changed |= ImGui::SliderInt("Spill depth", &gSpillDepth, 1, 12);
+            }
             if (ImGui::Button("Rebuild") || changed)
                 rebuild();
         }
@@ -679,9 +2007,38 @@ int main(int argc, char **argv)
             ImGui::Text("Raw leaf data: %.2f KB (%zu bytes)",
                         gLeafDataBytes / 1024.0, gLeafDataBytes);
 
+            // Native .qtc encoding (1 tag byte per node + RGB per leaf)
+            const size_t qtcSize = qtcBytes(stats.nodes, stats.leaves);
+            ImGui::Text("Native .qtc size: %.2f KB (%zu bytes)", qtcSize / 1024.0, qtcSize);
+
             // Accurate (compressed) PNG size of current quadtree render
             ImGui::Text("Quadtree PNG size: %.2f KB (%zu bytes)",
                         gLastPngBytes / 1024.0, gLastPngBytes);
+            if (gLastPng.paletteColors > 0)
+                ImGui::Text("PNG encode: %.3f ms, %.0f MB/s (palette, %d colors)", gLastPng.ms,
+                            encodeMBps(IMG_W, IMG_H, gLastPng.ms), gLastPng.paletteColors);
+            else
+                ImGui::Text("PNG encode: %.3f ms, %.0f MB/s (RGB)", gLastPng.ms, encodeMBps(IMG_W, IMG_H, gLastPng.ms));
+            ImGui::Text("PNG encoder buffers: %.2f MB", gLastPng.peakBytes / (1024.0 * 1024.0));
+            ImGui::Text("QOI size: %.2f KB (%zu bytes)", gLastQoiBytes / 1024.0, gLastQoiBytes);
+            ImGui::Text("QOI encode: %.3f ms, %.0f MB/s", gLastQoiMs, encodeMBps(IMG_W, IMG_H, gLastQoiMs));
+
+            ImGui::Text("Rasterize: %.3f ms (buffer allocations: %zu)", gRaster.lastMs, gRasterPool.allocations);
+
+            ImGui::Separator();
+            ImGui::Text("PSNR: %.2f dB (R %.2f, G %.2f, B %.2f)", gQuality.psnrAll, gQuality.psnr[0], gQuality.psnr[1],
+                        gQuality.psnr[2]);
+            ImGui::Text("MSE:  %.3f (R %.2f, G %.2f, B %.2f)", gQuality.mseAll, gQuality.mse[0], gQuality.mse[1],
+                        gQuality.mse[2]);
+            ImGui::Text("SSIM: %.4f (luma, 8x8 windows)", gQuality.ssim);
+            ImGui::Text("Metrics: %.3f ms SSIM (MSE from the build stats)", gQuality.ssimMs);
+
+            if (gOutOfCore)
+            {
+                ImGui::Text("Spilled: %.2f MB (%zu bytes, %zu subtrees)",
+                            gSpill.bytesSpilled / (1024.0 * 1024.0), gSpill.bytesSpilled, gSpill.refs.size());
+                ImGui::Text("Resident nodes: %.2f MB", gSpill.residentBytes(stats) / (1024.0 * 1024.0));
+            }
 
             float leavesPct = stats.nodes ? (100.0f * (float)stats.leaves / (float)stats.nodes) : 0.f;
             ImGui::ProgressBar(leavesPct / 100.f, ImVec2(-FLT_MIN, 0),
@@ -712,7 +2069,12 @@ int main(int argc, char **argv)
         glLoadIdentity();
 
         // Dibuja el quadtree en coords de imagen
-        renderQT(root);
+        const bool texFill = gDrawFill &&
+                             uploadFillTexture(gRaster.get(root, IMG_W, IMG_H, &gSpill), IMG_W, IMG_H, gRaster.generation);
+        if (texFill)
+            drawFillTexture(IMG_W, IMG_H);
+        if ((gDrawFill && !texFill) || gDrawLines)
+            renderQT(root, gDrawFill && !texFill);
 
         // ImGui draw
         ImGui::Render();
@@ -720,6 +2082,9 @@ int main(int argc, char **argv)
         glfwSwapBuffers(win);
     }
 
+    gRaster.invalidate();
+    if (gFillTex)
+        glDeleteTextures(1, &gFillTex);
     destroy(root);
     ImGui_ImplOpenGL2_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -0,0 +1,232 @@
+// mapped_image.h
+// Zero-copy input for large uncompressed images: binary PPM (P6), PAM (P7,
+// DEPTH 3) and headerless raw RGB. The file is mmap'ed read-only and the
+// builder reads the page cache directly through an ImageView, so the pixels
+// are never copied into the heap.
+#pragma once
+
+#include "quadtree.h"
+
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Location of the RGB raster inside a PNM/PAM file.
+struct PnmInfo
+{
+    int W = 0, H = 0;
+    size_t dataOffset = 0;
+};
+
+namespace pnm_detail
+{
+    inline void skipSpaceAndComments(const uint8_t *p, size_t len, size_t &i)
+    {
+        while (i < len && (std::isspace(p[i]) || p[i] == '#'))
+        {
+            if (p[i] == '#')
+                while (i < len && p[i] != '\n')
+                    ++i;
+            else
+                ++i;
+        }
+    }
+
+    inline bool readNumber(const uint8_t *p, size_t len, size_t &i, long &v)
+    {
+        skipSpaceAndComments(p, len, i);
+        if (i >= len || !std::isdigit(p[i]))
+            return false;
+        v = 0;
+        while (i < len && std::isdigit(p[i]))
+            v = v * 10 + (p[i++] - '0');
+        return true;
+    }
+
+    inline bool readToken(const uint8_t *p, size_t len, size_t &i, std::string &tok)
+    {
+        skipSpaceAndComments(p, len, i);
+        tok.clear();
+        while (i < len && !std::isspace(p[i]))
+            tok.push_back((char)p[i++]);
+        return !tok.empty();
+    }
+
+    // P7 header: "KEY value" lines terminated by ENDHDR.
+    inline bool parsePam(const uint8_t *p, size_t len, PnmInfo &info)
+    {
+        size_t i = 2;
+        long w = 0, h = 0, depth = 0, maxval = 0;
+        std::string key, tuple;
+        while (readToken(p, len, i, key))
+        {
+            if (key == "ENDHDR")
+            {
+                // the raster starts after the newline ending the ENDHDR line
+                while (i < len && p[i] != '\n')
+                    ++i;
+                if (i >= len || depth != 3 || maxval != 255 || w <= 0 || h <= 0)
+                    return false;
+                if (!tuple.empty() && tuple != "RGB")
+                    return false;
+                info.W = (int)w;
+                info.H = (int)h;
+                info.dataOffset = i + 1;
+                return true;
+            }
+            bool ok = true;
+            if (key == "WIDTH")
+                ok = readNumber(p, len, i, w);
+            else if (key == "HEIGHT")
+                ok = readNumber(p, len, i, h);
+            else if (key == "DEPTH")
+                ok = readNumber(p, len, i, depth);
+            else if (key == "MAXVAL")
+                ok = readNumber(p, len, i, maxval);
+            else if (key == "TUPLTYPE")
+                ok = readToken(p, len, i, tuple);
+            else
+                return false;
+            if (!ok)
+                return false;
+        }
+        return false;
+    }
+}
+
+// Accepts P6 (maxval 255) and P7 (DEPTH 3, MAXVAL 255).
+inline bool parsePnmHeader(const uint8_t *p, size_t len, PnmInfo &info)
+{
+    if (len < 3 || p[0] != 'P')
+        return false;
+    if (p[1] == '7')
+        return pnm_detail::parsePam(p, len, info);
+    if (p[1] != '6')
+        return false;
+    size_t i = 2;
+    long vals[3];
+    for (int k = 0; k < 3; ++k)
+        if (!pnm_detail::readNumber(p, len, i, vals[k]))
+            return false;
+    if (i >= len || !std::isspace(p[i]) || vals[2] != 255 || vals[0] <= 0 || vals[1] <= 0)
+        return false;
+    info.W = (int)vals[0];
+    info.H = (int)vals[1];
+    info.dataOffset = i + 1; // exactly one whitespace byte before the raster
+    return true;
+}
+
+struct MappedImage
+{
+    const uint8_t *base = nullptr;
+    size_t len = 0;
+    int fd = -1;
+    ImageView img; // RGB raster inside the mapping
+
+    MappedImage() = default;
+    MappedImage(const MappedImage &) = delete;
+    MappedImage &operator=(const MappedImage &) = delete;
+    ~MappedImage() { close(); }
+
+    // rawW/rawH give the size of headerless RGB files; PNM/PAM carry their own.
+    bool open(const std::string &path, int rawW = 0, int rawH = 0)
+    {
+        close();
+#ifdef _WIN32
+        (void)path;
+        (void)rawW;
+        (void)rawH;
+        return false; // no mmap path on Windows; callers fall back to stb
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            close();
+            return false;
+        }
+        len = (size_t)st.st_size;
+        void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        base = static_cast<const uint8_t *>(m);
+
+        PnmInfo info;
+        if (!parsePnmHeader(base, std::min<size_t>(len, 4096), info))
+        {
+            if (rawW <= 0 || rawH <= 0)
+            {
+                close();
+                return false;
+            }
+            info.W = rawW;
+            info.H = rawH;
+            info.dataOffset = 0;
+        }
+        if (info.dataOffset + (size_t)info.W * info.H * sizeof(Color) > len)
+        {
+            close();
+            return false;
+        }
+        img.data = base + info.dataOffset;
+        img.W = info.W;
+        img.H = info.H;
+        img.stride = (size_t)info.W * sizeof(Color);
+        // the first thing every build does is a row-major scan of the root
+        adviseRows(0, info.H, MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (base)
+            munmap(const_cast<uint8_t *>(base), len);
+        if (fd >= 0)
+            ::close(fd);
+#endif
+        base = nullptr;
+        len = 0;
+        fd = -1;
+        img = ImageView{};
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+#ifndef _WIN32
+    // madvise() over rows [y0, y1): the pages covering them, or with inward
+    // only the pages wholly inside them (for advice that must not reach the
+    // rows around).
+    void adviseRows(int y0, int y1, int advice, bool inward = false) const
+    {
+        if (!base || y1 <= y0)
+            return;
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t a = (size_t)(img.data - base) + (size_t)y0 * img.stride;
+        size_t b = std::min(len, (size_t)(img.data - base) + (size_t)y1 * img.stride);
+        if (inward)
+        {
+            a += (page - a % page) % page;
+            if (b < len)
+                b -= b % page;
+        }
+        else
+            a -= a % page;
+        if (b > a)
+            madvise(const_cast<uint8_t *>(base) + a, b - a, advice);
+    }
+#endif
+};
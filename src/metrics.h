@@ -0,0 +1,281 @@
+// metrics.h
+// Quality of a tree against its source image: MSE and PSNR per channel and
+// overall, and windowed SSIM. MSE needs no raster: every leaf is one flat
+// color, so its error is summed straight from the source pixels under it
+// (SSE2 when available), with the leaves shared out between workers. The
+// builders already know it, though (BuildStats::sse, from each leaf's block
+// statistics), so qualityFromStats only has SSIM left to measure. SSIM
+// compares luma over 8x8 windows on a 4 pixel grid (as x264 does); bands of
+// rows are rasterized into small strips unless a full raster is at hand.
+#pragma once
+
+#include "raster.h"
+
+#include <array>
+#include <chrono>
+#include <limits>
+
+struct QualityMetrics
+{
+    double mse[3] = {0, 0, 0}; // R, G, B
+    double psnr[3] = {0, 0, 0};
+    double mseAll = 0, psnrAll = 0;
+    double ssim = 0;    // mean over windows, luma
+    double mseMs = 0, ssimMs = 0;
+};
+
+inline double psnrFromSSE(double sse, double samples)
+{
+    if (samples <= 0)
+        return 0;
+    if (sse <= 0)
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 * samples / sse);
+}
+
+// Fills the MSE and PSNR fields of q from per-channel squared error.
+inline void setErrorMetrics(QualityMetrics &q, const double sse[3], double pixels)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        q.mse[c] = pixels > 0 ? sse[c] / pixels : 0;
+        q.psnr[c] = psnrFromSSE(sse[c], pixels);
+    }
+    const double all = sse[0] + sse[1] + sse[2];
+    q.mseAll = pixels > 0 ? all / (3 * pixels) : 0;
+    q.psnrAll = psnrFromSSE(all, 3 * pixels);
+}
+
+namespace metrics_detail
+{
+    // Adds sum((p - c)^2) per channel over `pixels` RGB pixels to out.
+    inline void spanSSE(const uint8_t *p, size_t pixels, Color c, uint64_t out[3])
+    {
+        size_t bytes = pixels * 3;
+#if defined(__SSE2__) || defined(_M_X64)
+        if (bytes >= 48)
+        {
+            alignas(16) uint8_t pattern[48];
+            for (int i = 0; i < 48; i += 3)
+            {
+                pattern[i] = c.r;
+                pattern[i + 1] = c.g;
+                pattern[i + 2] = c.b;
+            }
+            const __m128i z = _mm_setzero_si128();
+            __m128i col[3];
+            for (int k = 0; k < 3; ++k)
+                col[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(pattern + 16 * k));
+            while (bytes >= 48)
+            {
+                // squares stay below 2^16 and 32-bit lanes take 65536 of them
+                size_t groups = std::min<size_t>(bytes / 48, 65536);
+                bytes -= groups * 48;
+                __m128i acc[12];
+                for (auto &a : acc)
+                    a = z;
+                for (; groups; --groups, p += 48)
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * k));
+                        const __m128i d = _mm_or_si128(_mm_subs_epu8(a, col[k]), _mm_subs_epu8(col[k], a));
+                        const __m128i lo = _mm_unpacklo_epi8(d, z), hi = _mm_unpackhi_epi8(d, z);
+                        const __m128i lo2 = _mm_mullo_epi16(lo, lo), hi2 = _mm_mullo_epi16(hi, hi);
+                        acc[4 * k] = _mm_add_epi32(acc[4 * k], _mm_unpacklo_epi16(lo2, z));
+                        acc[4 * k + 1] = _mm_add_epi32(acc[4 * k + 1], _mm_unpackhi_epi16(lo2, z));
+                        acc[4 * k + 2] = _mm_add_epi32(acc[4 * k + 2], _mm_unpacklo_epi16(hi2, z));
+                        acc[4 * k + 3] = _mm_add_epi32(acc[4 * k + 3], _mm_unpackhi_epi16(hi2, z));
+                    }
+                // lane i of the 48 holds byte i of each group: channel i % 3
+                alignas(16) uint32_t lanes[48];
+                for (int m = 0; m < 12; ++m)
+                    _mm_store_si128(reinterpret_cast<__m128i *>(lanes + 4 * m), acc[m]);
+                for (int i = 0; i < 48; ++i)
+                    out[i % 3] += lanes[i];
+            }
+        }
+#endif
+        for (size_t i = 0; i < bytes; i += 3)
+        {
+            const int dr = p[i] - c.r, dg = p[i + 1] - c.g, db = p[i + 2] - c.b;
+            out[0] += (uint64_t)(dr * dr);
+            out[1] += (uint64_t)(dg * dg);
+            out[2] += (uint64_t)(db * db);
+        }
+    }
+
+    inline void leafSSE(const ImageView &px, const Node *n, uint64_t out[3])
+    {
+        int x = n->x, y = n->y, w = n->w, h = n->h;
+        if (!clipToImage(px, x, y, w, h))
+            return;
+        for (int j = y; j < y + h; ++j)
+            spanSSE(reinterpret_cast<const uint8_t *>(px[j] + x), (size_t)w, n->avg, out);
+    }
+
+    // Leaves (and spilled handles, paged in by the worker) as units of work.
+    inline void collect(const Node *n, std::vector<const Node *> &out)
+    {
+        if (!n)
+            return;
+        if (n->leaf || n->spilled)
+        {
+            out.push_back(n);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            collect(n->ch[i], out);
+    }
+
+    inline void subtreeSSE(const ImageView &px, const Node *n, uint64_t out[3])
+    {
+        if (!n)
+            return;
+        if (n->leaf)
+        {
+            leafSSE(px, n, out);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            subtreeSSE(px, n->ch[i], out);
+    }
+
+    inline int luma(const Color &c) { return (77 * c.r + 150 * c.g + 29 * c.b + 128) >> 8; }
+
+    // x264's ssim_end1 for one 8x8 window from its four 4x4 block sums.
+    inline double windowSSIM(double s1, double s2, double ss, double s12)
+    {
+        const double c1 = .01 * .01 * 255 * 255 * 64, c2 = .03 * .03 * 255 * 255 * 64 * 63;
+        const double vars = ss * 64 - s1 * s1 - s2 * s2, covar = s12 * 64 - s1 * s2;
+        return (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+    }
+}
+
+// Per-channel and overall squared error of the tree's leaves against px.
+inline void treeSSE(const Node *root, const ImageView &px, double sse[3], const SpillStore *store = nullptr,
+                    int threads = 0)
+{
+    using namespace metrics_detail;
+    std::vector<const Node *> units;
+    collect(root, units);
+    const size_t per = 1024, chunks = (units.size() + per - 1) / per;
+    std::vector<std::array<uint64_t, 3>> part(chunks, std::array<uint64_t, 3>{0, 0, 0});
+    parallelFor(chunks, threads, [&](size_t ci)
+                {
+        uint64_t *acc = part[ci].data();
+        for (size_t i = ci * per; i < std::min(units.size(), (ci + 1) * per); ++i)
+        {
+            const Node *n = units[i];
+            if (n->leaf || !store)
+            {
+                leafSSE(px, n, acc);
+                continue;
+            }
+            Node *sub = store->load(n);
+            if (sub)
+                subtreeSSE(px, sub, acc);
+            else
+                leafSSE(px, n, acc); // unreadable: counts as its mean color, as drawn
+            destroy(sub);
+        } });
+    sse[0] = sse[1] = sse[2] = 0;
+    for (const auto &p : part)
+        for (int c = 0; c < 3; ++c)
+            sse[c] += (double)p[c];
+}
+
+// Mean SSIM of the tree's luma against the source's. `raster`, when given, is
+// the tree already rasterized (W*H); otherwise bands are rasterized on the fly.
+inline double treeSSIM(const Node *root, const ImageView &px, const Color *raster = nullptr,
+                       const SpillStore *store = nullptr, int threads = 0)
+{
+    using namespace metrics_detail;
+    const int W = px.W, H = px.H, BW = W / 4, BH = H / 4;
+    if (BW < 2 || BH < 2)
+        return 1.0;
+    const unsigned nt = workerCount(threads);
+    const int bands = std::min(BH - 1, (int)nt * 4);
+    const int perBand = (BH - 1 + bands - 1) / bands; // window rows (of blocks) per band
+    std::vector<double> sums((size_t)bands, 0.0);
+    SpillPager pager(store, H);
+    parallelFor((size_t)bands, (int)nt, [&](size_t b)
+                {
+        const int r0 = (int)b * perBand, r1 = std::min(BH - 1, r0 + perBand);
+        if (r0 >= r1)
+            return;
+        // 4x4 block sums for block rows r0..r1 (windows reach one row down)
+        const int rows = r1 - r0 + 1, y0 = r0 * 4, y1 = (r1 + 1) * 4;
+        std::vector<Color> strip;
+        const Color *rec = raster ? raster + (size_t)y0 * W : nullptr;
+        if (!rec)
+        {
+            strip.resize((size_t)W * (y1 - y0));
+            rasterizeQTBand(root, W, y0, y1, strip.data(), store ? &pager : nullptr, y0);
+            rec = strip.data();
+        }
+        std::vector<std::array<int64_t, 4>> blk((size_t)rows * BW, std::array<int64_t, 4>{0, 0, 0, 0});
+        for (int y = y0; y < y1; ++y)
+        {
+            const Color *a = px[y], *d = rec + (size_t)(y - y0) * W;
+            std::array<int64_t, 4> *row = blk.data() + (size_t)((y - y0) / 4) * BW;
+            for (int x = 0; x < BW * 4; ++x)
+            {
+                const int64_t la = luma(a[x]), ld = luma(d[x]);
+                std::array<int64_t, 4> &s = row[x / 4];
+                s[0] += la;
+                s[1] += ld;
+                s[2] += la * la + ld * ld;
+                s[3] += la * ld;
+            }
+        }
+        double acc = 0;
+        for (int r = 0; r + 1 < rows; ++r)
+            for (int bx = 0; bx + 1 < BW; ++bx)
+            {
+                double s[4] = {0, 0, 0, 0};
+                for (int dy = 0; dy < 2; ++dy)
+                    for (int dx = 0; dx < 2; ++dx)
+                        for (int k = 0; k < 4; ++k)
+                            s[k] += (double)blk[(size_t)(r + dy) * BW + bx + dx][k];
+                acc += windowSSIM(s[0], s[1], s[2], s[3]);
+            }
+        sums[b] = acc; });
+    double total = 0;
+    for (double s : sums)
+        total += s;
+    return total / ((double)(BH - 1) * (BW - 1));
+}
+
+inline QualityMetrics measureQuality(const Node *root, const ImageView &px, const Color *raster = nullptr,
+                                     const SpillStore *store = nullptr, int threads = 0)
+{
+    QualityMetrics q;
+    if (!root || px.W <= 0 || px.H <= 0)
+        return q;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    double sse[3];
+    treeSSE(root, px, sse, store, threads);
+    setErrorMetrics(q, sse, (double)px.W * px.H);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    q.ssim = treeSSIM(root, px, raster, store, threads);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    q.mseMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    q.ssimMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    return q;
+}
+
+// measureQuality for a tree whose build filled stats.sse: MSE and PSNR come
+// from the totals in O(1) (mseMs stays 0) and only SSIM reads pixels.
+inline QualityMetrics qualityFromStats(const BuildStats &stats, const Node *root, const ImageView &px,
+                                       const Color *raster = nullptr, const SpillStore *store = nullptr,
+                                       int threads = 0)
+{
+    QualityMetrics q;
+    if (!root || px.W <= 0 || px.H <= 0)
+        return q;
+    setErrorMetrics(q, stats.sse, (double)px.W * px.H);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    q.ssim = treeSSIM(root, px, raster, store, threads);
+    q.ssimMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+    return q;
+}
@@ -0,0 +1,202 @@
+// palette.h
+// Indexed-color export. Every pixel of a rendered tree is some leaf's average,
+// so the image has exactly as many colors as there are distinct leaf colors.
+// When those fit in 256 (or after median-cut quantization of the leaf colors)
+// the tree is rasterized straight to 8-bit palette indices.
+#pragma once
+
+#include "spill.h"
+
+#include <unordered_map>
+
+inline uint32_t packColor(Color c)
+{
+    return (uint32_t)c.r << 16 | (uint32_t)c.g << 8 | c.b;
+}
+
+struct LeafPalette
+{
+    std::vector<Color> colors;                   // palette entries (<= 256)
+    std::unordered_map<uint32_t, uint8_t> index; // leaf color -> entry
+    size_t distinct = 0;                         // distinct leaf colors in the tree
+    bool quantized = false;
+
+    uint8_t lookup(Color c) const
+    {
+        auto it = index.find(packColor(c));
+        return it != index.end() ? it->second : 0;
+    }
+};
+
+namespace palette_detail
+{
+    struct Weighted
+    {
+        Color c;
+        double area;
+    };
+
+    // Visible area of every distinct leaf color. Stops early (returns false)
+    // once more than `limit` colors have been seen.
+    inline bool collect(const Node *n, int W, int H, const SpillStore *store, size_t limit,
+                        std::unordered_map<uint32_t, double> &area)
+    {
+        if (!n)
+            return true;
+        if (n->spilled && store)
+        {
+            Node *sub = store->load(n);
+            const bool ok = collect(sub, W, H, nullptr, limit, area);
+            destroy(sub);
+            return ok;
+        }
+        if (n->leaf || n->spilled)
+        {
+            const double a = (double)(std::min(W, n->x + n->w) - std::max(0, n->x)) *
+                             (std::min(H, n->y + n->h) - std::max(0, n->y));
+            area[packColor(n->avg)] += a;
+            return area.size() <= limit;
+        }
+        for (int i = 0; i < 4; ++i)
+            if (!collect(n->ch[i], W, H, store, limit, area))
+                return false;
+        return true;
+    }
+
+    // Median cut of `colors` into at most maxColors boxes; appends one entry
+    // per box (its weighted mean) and maps every color to its box.
+    inline void medianCut(std::vector<Weighted> &colors, int maxColors, LeafPalette &pal)
+    {
+        struct Box
+        {
+            size_t begin, end;
+            int axis, range; // widest channel and its extent
+        };
+        auto measure = [&](Box &b)
+        {
+            int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+            for (size_t i = b.begin; i < b.end; ++i)
+            {
+                const uint8_t v[3] = {colors[i].c.r, colors[i].c.g, colors[i].c.b};
+                for (int k = 0; k < 3; ++k)
+                {
+                    lo[k] = std::min(lo[k], (int)v[k]);
+                    hi[k] = std::max(hi[k], (int)v[k]);
+                }
+            }
+            b.axis = 0;
+            for (int k = 1; k < 3; ++k)
+                if (hi[k] - lo[k] > hi[b.axis] - lo[b.axis])
+                    b.axis = k;
+            b.range = b.end - b.begin < 2 ? 0 : hi[b.axis] - lo[b.axis];
+        };
+        auto channel = [](const Color &c, int axis)
+        { return axis == 0 ? c.r : axis == 1 ? c.g : c.b; };
+
+        std::vector<Box> boxes{{0, colors.size(), 0, 0}};
+        measure(boxes[0]);
+        while ((int)boxes.size() < maxColors)
+        {
+            // split the box with the widest channel range
+            int best = -1, bestRange = 0;
+            for (size_t i = 0; i < boxes.size(); ++i)
+                if (boxes[i].range > bestRange)
+                {
+                    bestRange = boxes[i].range;
+                    best = (int)i;
+                }
+            if (best < 0)
+                break;
+            Box &b = boxes[best];
+            const int bestAxis = b.axis;
+            std::sort(colors.begin() + (std::ptrdiff_t)b.begin, colors.begin() + (std::ptrdiff_t)b.end,
+                      [&](const Weighted &a, const Weighted &c)
+                      { return channel(a.c, bestAxis) < channel(c.c, bestAxis); });
+            double total = 0;
+            for (size_t i = b.begin; i < b.end; ++i)
+                total += colors[i].area;
+            // area-weighted median, keeping both halves non-empty
+            size_t mid = b.begin + 1;
+            for (double acc = colors[b.begin].area; mid < b.end - 1 && acc < total / 2; ++mid)
+                acc += colors[mid].area;
+            Box upper{mid, b.end, 0, 0};
+            b.end = mid;
+            measure(b);
+            measure(upper);
+            boxes.push_back(upper);
+        }
+
+        for (const Box &b : boxes)
+        {
+            double acc[3] = {0, 0, 0}, area = 0;
+            for (size_t i = b.begin; i < b.end; ++i)
+            {
+                const double a = std::max(colors[i].area, 1e-9);
+                acc[0] += a * colors[i].c.r;
+                acc[1] += a * colors[i].c.g;
+                acc[2] += a * colors[i].c.b;
+                area += a;
+            }
+            const uint8_t entry = (uint8_t)pal.colors.size();
+            pal.colors.push_back(Color{(uint8_t)(acc[0] / area + 0.5), (uint8_t)(acc[1] / area + 0.5),
+                                       (uint8_t)(acc[2] / area + 0.5)});
+            for (size_t i = b.begin; i < b.end; ++i)
+                pal.index[packColor(colors[i].c)] = entry;
+        }
+    }
+}
+
+// Collects the leaf colors of the tree. Without `quantize` this fails when
+// there are more than 256; with it, they are reduced to 256 by median cut
+// (weighted by visible area).
+inline bool buildLeafPalette(const Node *root, int W, int H, const SpillStore *store, bool quantize,
+                             LeafPalette &pal)
+{
+    using namespace palette_detail;
+    pal = LeafPalette{};
+    std::unordered_map<uint32_t, double> area;
+    if (!collect(root, W, H, store, quantize ? SIZE_MAX : 256, area))
+    {
+        pal.distinct = area.size(); // lower bound; the walk stopped early
+        return false;
+    }
+    pal.distinct = area.size();
+    std::vector<Weighted> colors;
+    colors.reserve(area.size());
+    for (const auto &kv : area)
+        colors.push_back({Color{(uint8_t)(kv.first >> 16), (uint8_t)(kv.first >> 8), (uint8_t)kv.first}, kv.second});
+    // deterministic palette order regardless of hash iteration order
+    std::sort(colors.begin(), colors.end(), [](const Weighted &a, const Weighted &b)
+              { return packColor(a.c) < packColor(b.c); });
+
+    if (colors.size() <= 256)
+    {
+        for (const Weighted &w : colors)
+        {
+            pal.index[packColor(w.c)] = (uint8_t)pal.colors.size();
+            pal.colors.push_back(w.c);
+        }
+        return true;
+    }
+    pal.quantized = true;
+    medianCut(colors, 256, pal);
+    return true;
+}
+
+// Rows [y0, y1) of the index raster (one byte per pixel); `out` holds rows
+// from outY0 on. Paging and `tops` as in rasterizeQTBand.
+inline void rasterizeIndexBand(const Node *root, int W, int y0, int y1, uint8_t *out, SpillPager *pager,
+                               const LeafPalette &pal, int outY0 = 0, uint8_t *tops = nullptr)
+{
+    forEachLeafInBand(root, y0, y1, pager, [&](const Node *n)
+                      {
+        if (tops && n->y >= y0)
+            tops[n->y] = 0;
+        const int x0 = std::max(0, n->x), x1 = std::min(W, n->x + n->w);
+        const int ya = std::max(y0, n->y), yb = std::min(y1, n->y + n->h);
+        if (x1 <= x0)
+            return;
+        const uint8_t v = pal.lookup(n->avg);
+        for (int j = ya; j < yb; ++j)
+            std::memset(out + (size_t)(j - outY0) * W + x0, v, (size_t)(x1 - x0)); });
+}
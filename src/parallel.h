@@ -0,0 +1,45 @@
+// parallel.h
+// Minimal work distribution on std::thread: items are handed out through an
+// atomic counter so uneven work (tiles, bands, strips) balances itself.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// requested <= 0 means "one per hardware thread".
+inline unsigned workerCount(int requested)
+{
+    if (requested > 0)
+        return (unsigned)requested;
+    const unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+// Calls fn(i) for every i in [0, n) from up to `threads` workers.
+template <class Fn>
+inline void parallelFor(size_t n, int threads, Fn &&fn)
+{
+    const unsigned nt = (unsigned)std::min<size_t>(workerCount(threads), n);
+    if (nt <= 1)
+    {
+        for (size_t i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(nt - 1);
+    for (unsigned t = 1; t < nt; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+}
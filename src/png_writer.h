@@ -0,0 +1,485 @@
+// png_writer.h
+// Multi-threaded PNG encoder. The image is cut into horizontal strips; each
+// strip is filtered and deflated by its own worker (deflate.h), primed with
+// the 32 KB of filtered data before it, and ends in a sync flush. The strips
+// are written as consecutive IDAT chunks that together form one zlib stream;
+// its Adler-32 is combined from the per-strip checksums. Backends that can
+// only compress whole buffers (deflate_backend.h) get the image in one piece.
+#pragma once
+
+#include "deflate_backend.h"
+#include "parallel.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <string>
+
+struct PngImage
+{
+    const uint8_t *data = nullptr;
+    int W = 0, H = 0;
+    size_t stride = 0;  // bytes between rows
+    int bpp = 3;        // bytes per pixel
+    int colorType = 2;  // 2 = RGB, 3 = palette indices
+    int bitDepth = 8;
+    const uint8_t *palette = nullptr; // colorType 3: RGB triples
+    int paletteSize = 0;
+};
+
+// Filter candidates, as a bit mask over PNG filter types 0..4.
+constexpr unsigned PNG_FILTER_NONE = 1u << 0, PNG_FILTER_SUB = 1u << 1, PNG_FILTER_UP = 1u << 2,
+                   PNG_FILTER_AVG = 1u << 3, PNG_FILTER_PAETH = 1u << 4, PNG_FILTER_ALL = 0x1f;
+
+struct PngParams
+{
+    int level = 6;                   // deflate level 0..9 (10-12: libdeflate only)
+    int backend = defaultDeflateBackend(); // see deflate_backend.h
+    int threads = 0;                 // 0 = one per hardware thread
+    size_t stripBytes = 256u << 10;  // minimum filtered bytes per strip
+    unsigned filters = PNG_FILTER_ALL; // candidates tried per row
+    // Optional, one flag per row: nonzero means the row equals the one above
+    // and is written with Up (all zeros) without trying anything else.
+    const uint8_t *repeatRows = nullptr;
+};
+
+enum PngPreset
+{
+    PNG_PRESET_FAST,
+    PNG_PRESET_DEFAULT,
+    PNG_PRESET_MAX,
+    PNG_PRESET_COUNT
+};
+
+inline const char *pngPresetName(int p)
+{
+    static const char *names[PNG_PRESET_COUNT] = {"fast", "default", "max"};
+    return p >= 0 && p < PNG_PRESET_COUNT ? names[p] : "?";
+}
+
+inline bool parsePngPreset(const std::string &s, int &p)
+{
+    for (int i = 0; i < PNG_PRESET_COUNT; ++i)
+        if (s == pngPresetName(i))
+        {
+            p = i;
+            return true;
+        }
+    return false;
+}
+
+// Speed/size trade-offs for flat-shaded rasters. Rows that are not repeats
+// start some leaves and continue others, so the choice is between Sub (new
+// constant runs) and Up (spans carried over from the row above); the
+// Avg/Paeth residuals score well under the heuristic but deflate worse here.
+inline PngParams pngPresetParams(int preset)
+{
+    PngParams p;
+    switch (preset)
+    {
+    case PNG_PRESET_FAST:
+        p.level = 1;
+        p.filters = PNG_FILTER_SUB | PNG_FILTER_UP;
+        break;
+    case PNG_PRESET_MAX:
+        p.level = 9;
+        p.filters = PNG_FILTER_NONE | PNG_FILTER_SUB | PNG_FILTER_UP;
+        break;
+    default:
+        p.level = 6;
+        p.filters = PNG_FILTER_SUB | PNG_FILTER_UP;
+        break;
+    }
+    return p;
+}
+
+namespace png_detail
+{
+    inline void putBE32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        out.push_back((uint8_t)(v >> 24));
+        out.push_back((uint8_t)(v >> 16));
+        out.push_back((uint8_t)(v >> 8));
+        out.push_back((uint8_t)v);
+    }
+
+    // Length, type, data and CRC of one chunk.
+    inline void writeChunk(std::vector<uint8_t> &out, const char type[4], const uint8_t *data, size_t n)
+    {
+        putBE32(out, (uint32_t)n);
+        const size_t at = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (n)
+            out.insert(out.end(), data, data + n);
+        putBE32(out, crc32Update(0, out.data() + at, n + 4));
+    }
+
+    inline uint8_t paeth(int a, int b, int c)
+    {
+        const int p = a + b - c;
+        const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return (uint8_t)a;
+        return (uint8_t)(pb <= pc ? b : c);
+    }
+
+    // Applies filter `type` to one row; prev is null for the first row.
+    inline void filterRow(int type, const uint8_t *cur, const uint8_t *prev, int bpp, size_t n, uint8_t *out)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+            const int b = prev ? prev[i] : 0;
+            const int c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+            int v = cur[i];
+            switch (type)
+            {
+            case 1: v -= a; break;
+            case 2: v -= b; break;
+            case 3: v -= (a + b) >> 1; break;
+            case 4: v -= paeth(a, b, c); break;
+            default: break;
+            }
+            out[i] = (uint8_t)v;
+        }
+    }
+
+    // Picks the candidate with the smallest sum of |signed residual| (the
+    // usual libpng heuristic) and writes the type byte followed by the row.
+    inline void filterRowBest(const uint8_t *cur, const uint8_t *prev, int bpp, size_t n,
+                              unsigned candidates, uint8_t *out, std::vector<uint8_t> &scratch)
+    {
+        if ((candidates & (candidates - 1)) == 0)
+        {
+            // a single candidate needs no scoring
+            int type = 0;
+            while (type < 4 && !(candidates & (1u << type)))
+                ++type;
+            out[0] = (uint8_t)type;
+            filterRow(type, cur, prev, bpp, n, out + 1);
+            return;
+        }
+        scratch.resize(n);
+        int bestType = 0;
+        uint64_t bestCost = ~0ull;
+        for (int type = 0; type < 5; ++type)
+        {
+            if (!(candidates & (1u << type)))
+                continue;
+            filterRow(type, cur, prev, bpp, n, scratch.data());
+            uint64_t cost = 0;
+            for (size_t i = 0; i < n; ++i)
+                cost += (uint64_t)std::abs((int)(int8_t)scratch[i]);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestType = type;
+                std::memcpy(out + 1, scratch.data(), n);
+            }
+        }
+        out[0] = (uint8_t)bestType;
+    }
+
+    // Filter byte + filtered row y. Rows flagged in params.repeatRows are
+    // written as Up (an all-zero residual) without trying anything else.
+    inline void filterLine(const uint8_t *cur, const uint8_t *prev, size_t y, const PngImage &img,
+                           const PngParams &params, uint8_t *line, std::vector<uint8_t> &scratch)
+    {
+        const size_t rowBytes = (size_t)img.W * img.bpp;
+        if (prev && params.repeatRows && params.repeatRows[y])
+        {
+            line[0] = 2;
+            std::memset(line + 1, 0, rowBytes);
+            return;
+        }
+        const unsigned candidates = params.filters & PNG_FILTER_ALL ? params.filters & PNG_FILTER_ALL : PNG_FILTER_ALL;
+        filterRowBest(cur, prev, img.bpp, rowBytes, candidates, line, scratch);
+    }
+
+    // Minimum rows per strip for params.stripBytes of filtered data.
+    inline size_t minStripRows(const PngParams &params, size_t lineBytes)
+    {
+        return std::max<size_t>(1, (params.stripBytes + lineBytes - 1) / lineBytes);
+    }
+
+    // Prepends the CMF/FLG pair that opens the zlib stream.
+    inline void zlibHeader(int level, std::vector<uint8_t> &out)
+    {
+        const int flevel = level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3;
+        const uint8_t cmf = 0x78;
+        uint8_t flg = (uint8_t)(flevel << 6);
+        flg += (uint8_t)(31 - ((cmf << 8) | flg) % 31);
+        out.insert(out.begin(), {cmf, flg});
+    }
+
+    // Signature, IHDR and (for palette images) PLTE.
+    inline void writeHeaderChunks(std::vector<uint8_t> &out, const PngImage &img)
+    {
+        static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        out.insert(out.end(), sig, sig + 8);
+        std::vector<uint8_t> ihdr;
+        putBE32(ihdr, (uint32_t)img.W);
+        putBE32(ihdr, (uint32_t)img.H);
+        ihdr.insert(ihdr.end(), {(uint8_t)img.bitDepth, (uint8_t)img.colorType, 0, 0, 0});
+        writeChunk(out, "IHDR", ihdr.data(), ihdr.size());
+        if (img.colorType == 3)
+            writeChunk(out, "PLTE", img.palette, (size_t)img.paletteSize * 3);
+    }
+
+    inline bool validShape(const PngImage &img)
+    {
+        if (img.W <= 0 || img.H <= 0)
+            return false;
+        return img.colorType != 3 || (img.palette && img.paletteSize >= 1 && img.paletteSize <= 256);
+    }
+}
+
+// Encodes img into a complete PNG file image in `out`.
+inline bool encodePNG(const PngImage &img, const PngParams &params, std::vector<uint8_t> &out)
+{
+    using namespace png_detail;
+    if (!img.data || !validShape(img))
+        return false;
+    const size_t rowBytes = (size_t)img.W * img.bpp;
+    const size_t lineBytes = rowBytes + 1; // filter type byte + row
+    const int threads = (int)workerCount(params.threads);
+
+    // Strip height: enough strips to keep every worker busy, each big enough
+    // that the restart of the Huffman block stays negligible.
+    size_t rowsPerStrip = minStripRows(params, lineBytes);
+    rowsPerStrip = std::max(rowsPerStrip, ((size_t)img.H + threads * 4 - 1) / ((size_t)threads * 4));
+    rowsPerStrip = std::min(rowsPerStrip, (size_t)img.H);
+    const size_t strips = ((size_t)img.H + rowsPerStrip - 1) / rowsPerStrip;
+
+    // Phase 1: filter. Strips only read the raw row above them, so they are independent.
+    std::vector<uint8_t> filtered((size_t)img.H * lineBytes);
+    parallelFor(strips, threads, [&](size_t s)
+    {
+        std::vector<uint8_t> scratch;
+        const size_t y1 = std::min((size_t)img.H, (s + 1) * rowsPerStrip);
+        for (size_t y = s * rowsPerStrip; y < y1; ++y)
+        {
+            const uint8_t *cur = img.data + y * img.stride;
+            filterLine(cur, y ? cur - img.stride : nullptr, y, img, params, filtered.data() + y * lineBytes, scratch);
+        }
+    });
+
+    std::vector<std::vector<uint8_t>> parts;
+    if (!deflateBackendSupportsStrips(params.backend))
+    {
+        // whole-buffer backend: one zlib stream in a single IDAT
+        parts.resize(1);
+        zlibCompressBuffer(params.backend, filtered.data(), filtered.size(), params.level, parts[0]);
+    }
+    else
+    {
+        // Phase 2: deflate each strip against the previous 32 KB of filtered data.
+        parts.resize(strips);
+        std::vector<uint32_t> adlers(strips);
+        parallelFor(strips, threads, [&](size_t s)
+        {
+            const size_t start = s * rowsPerStrip * lineBytes;
+            const size_t end = std::min(filtered.size(), (s + 1) * rowsPerStrip * lineBytes);
+            const size_t dict = start > 32768 ? start - 32768 : 0;
+            parts[s].reserve((end - start) / 4);
+            deflateStrip(params.backend, filtered.data(), dict, start, end, s + 1 == strips, params.level, parts[s]);
+            adlers[s] = adler32(1, filtered.data() + start, end - start);
+        });
+
+        uint32_t adler = adlers[0];
+        for (size_t s = 1; s < strips; ++s)
+        {
+            const size_t len = std::min(filtered.size(), (s + 1) * rowsPerStrip * lineBytes) - s * rowsPerStrip * lineBytes;
+            adler = adler32Combine(adler, adlers[s], len);
+        }
+
+        // zlib framing: header on the first IDAT, checksum on the last
+        zlibHeader(params.level, parts[0]);
+        putBE32(parts.back(), adler);
+    }
+    filtered = std::vector<uint8_t>();
+
+    size_t total = 8 + 25 + 12 + (img.colorType == 3 ? 12 + (size_t)img.paletteSize * 3 : 0);
+    for (const auto &p : parts)
+        total += p.size() + 12;
+    out.clear();
+    out.reserve(total);
+    writeHeaderChunks(out, img);
+    for (const auto &p : parts)
+        writeChunk(out, "IDAT", p.data(), p.size());
+    writeChunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+// Produces rows [y0, y1) packed into dst (first row = y0, W*bpp bytes each).
+using PngRowSource = std::function<void(int y0, int y1, uint8_t *dst)>;
+// Receives the file bytes in order; returning false aborts the encode.
+using PngByteSink = std::function<bool(const uint8_t *data, size_t n)>;
+
+// Streaming variant of encodePNG: rows are pulled from `rows` one batch of
+// strips at a time (one strip per worker) while the previous batch is being
+// filtered and deflated, and every finished IDAT goes straight to `sink`.
+// Memory stays at two raw batches plus one filtered batch. Whole-buffer
+// backends (libdeflate) cannot stream and are replaced by zlib or the
+// built-in encoder here. img.data and img.stride are ignored.
+inline bool encodePNGStreaming(const PngImage &img, const PngRowSource &rows, const PngParams &params,
+                               const PngByteSink &sink, size_t *peakBytes = nullptr)
+{
+    using namespace png_detail;
+    if (!validShape(img) || !rows || !sink)
+        return false;
+    int backend = params.backend;
+    if (!deflateBackendSupportsStrips(backend))
+        backend = deflateBackendSupportsStrips(DEFLATE_ZLIB) ? DEFLATE_ZLIB : DEFLATE_BUILTIN;
+
+    const size_t rowBytes = (size_t)img.W * img.bpp;
+    const size_t lineBytes = rowBytes + 1;
+    const int threads = (int)workerCount(params.threads);
+    const size_t rowsPerStrip = std::min(minStripRows(params, lineBytes), (size_t)img.H);
+    const size_t batchRows = std::min(rowsPerStrip * threads, (size_t)img.H);
+    const size_t batches = ((size_t)img.H + batchRows - 1) / batchRows;
+    constexpr size_t DICT = 32768;
+
+    std::vector<uint8_t> raw[2] = {std::vector<uint8_t>(batchRows * rowBytes), std::vector<uint8_t>(batchRows * rowBytes)};
+    std::vector<uint8_t> prevRow(rowBytes);              // last raw row of the previous batch
+    std::vector<uint8_t> filtered(DICT + batchRows * lineBytes); // dictionary tail + this batch
+    size_t dictLen = 0;
+    if (peakBytes)
+        *peakBytes = raw[0].size() * 2 + filtered.size() + prevRow.size();
+
+    std::vector<uint8_t> chunk;
+    writeHeaderChunks(chunk, img);
+    if (!sink(chunk.data(), chunk.size()))
+        return false;
+
+    auto produce = [&](size_t b)
+    {
+        const int y0 = (int)(b * batchRows);
+        const int y1 = std::min(img.H, (int)((b + 1) * batchRows));
+        rows(y0, y1, raw[b & 1].data());
+    };
+    produce(0);
+
+    uint32_t adler = 1;
+    bool first = true;
+    std::vector<std::vector<uint8_t>> parts(threads);
+    std::vector<uint32_t> adlers(threads);
+    for (size_t b = 0; b < batches; ++b)
+    {
+        // rasterize the next batch while this one is compressed
+        std::future<void> next;
+        if (b + 1 < batches)
+            next = std::async(std::launch::async, produce, b + 1);
+
+        const size_t y0 = b * batchRows;
+        const size_t n = std::min((size_t)img.H, y0 + batchRows) - y0;
+        const uint8_t *src = raw[b & 1].data();
+        const size_t strips = (n + rowsPerStrip - 1) / rowsPerStrip;
+        const bool lastBatch = b + 1 == batches;
+
+        parallelFor(strips, threads, [&](size_t s)
+        {
+            std::vector<uint8_t> scratch;
+            const size_t r1 = std::min(n, (s + 1) * rowsPerStrip);
+            for (size_t r = s * rowsPerStrip; r < r1; ++r)
+            {
+                const uint8_t *cur = src + r * rowBytes;
+                const uint8_t *prev = r ? cur - rowBytes : (y0 ? prevRow.data() : nullptr);
+                filterLine(cur, prev, y0 + r, img, params, filtered.data() + DICT + r * lineBytes, scratch);
+            }
+        });
+        parallelFor(strips, threads, [&](size_t s)
+        {
+            const size_t start = DICT + s * rowsPerStrip * lineBytes;
+            const size_t end = DICT + std::min(n, (s + 1) * rowsPerStrip) * lineBytes;
+            parts[s].clear();
+            deflateStrip(backend, filtered.data(), DICT - dictLen, start, end,
+                         lastBatch && s + 1 == strips, params.level, parts[s]);
+            adlers[s] = adler32(1, filtered.data() + start, end - start);
+        });
+
+        for (size_t s = 0; s < strips; ++s)
+        {
+            const size_t len = (std::min(n, (s + 1) * rowsPerStrip) - s * rowsPerStrip) * lineBytes;
+            adler = first ? adlers[s] : adler32Combine(adler, adlers[s], len);
+            if (first)
+                zlibHeader(params.level, parts[s]);
+            first = false;
+            if (lastBatch && s + 1 == strips)
+                putBE32(parts[s], adler);
+            chunk.clear();
+            writeChunk(chunk, "IDAT", parts[s].data(), parts[s].size());
+            if (!sink(chunk.data(), chunk.size()))
+            {
+                if (next.valid())
+                    next.wait();
+                return false;
+            }
+        }
+
+        // carry the last raw row and the last 32 KB of filtered data forward
+        std::memcpy(prevRow.data(), src + (n - 1) * rowBytes, rowBytes);
+        const size_t produced = n * lineBytes;
+        const size_t keep = std::min(DICT, dictLen + produced);
+        std::memmove(filtered.data() + DICT - keep, filtered.data() + DICT + produced - keep, keep);
+        dictLen = keep;
+        if (next.valid())
+            next.get();
+    }
+    chunk.clear();
+    writeChunk(chunk, "IEND", nullptr, 0);
+    return sink(chunk.data(), chunk.size());
+}
+
+// Packed 8-bit RGB convenience wrapper.
+inline PngImage pngImageRGB(const uint8_t *rgb, int W, int H)
+{
+    PngImage img;
+    img.data = rgb;
+    img.W = W;
+    img.H = H;
+    img.stride = (size_t)W * 3;
+    return img;
+}
+
+// Packed gray (1), RGB (3) or RGBA (4) samples of 8 or 16 bits (big-endian).
+inline PngImage pngImageSamples(const uint8_t *samples, int W, int H, int channels, int bitDepth)
+{
+    PngImage img;
+    img.data = samples;
+    img.W = W;
+    img.H = H;
+    img.bpp = channels * bitDepth / 8;
+    img.stride = (size_t)W * img.bpp;
+    img.colorType = channels == 1 ? 0 : channels == 4 ? 6 : 2;
+    img.bitDepth = bitDepth;
+    return img;
+}
+
+// 8-bit palette indices with `entries` RGB palette colors.
+inline PngImage pngImageIndexed(const uint8_t *indices, int W, int H, const uint8_t *palette, int entries)
+{
+    PngImage img;
+    img.data = indices;
+    img.W = W;
+    img.H = H;
+    img.stride = (size_t)W;
+    img.bpp = 1;
+    img.colorType = 3;
+    img.palette = palette;
+    img.paletteSize = entries;
+    return img;
+}
+
+inline bool writePNG(const std::string &path, const PngImage &img, const PngParams &params = PngParams{})
+{
+    std::vector<uint8_t> bytes;
+    if (!encodePNG(img, params, bytes))
+        return false;
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return std::fclose(f) == 0 && ok;
+}
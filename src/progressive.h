@@ -0,0 +1,265 @@
+// progressive.h
+// Progressive quadtree file (.qtp): the tree in breadth-first order with the
+// average color of every node, internal ones included, so any prefix of the
+// stream decodes to a complete (coarser) image.
+//
+//   "QTP1"  u32 W  u32 H  u32 rootW  u32 rootH        (little endian)
+//   root  := flags r g b                               flags bit 0 = splits
+//   group := flags (r g b)*                            one per split node, BFS order
+//
+// A group holds the children of the next split node in breadth-first order:
+// bit i of flags says whether child i (NW, NE, SW, SE) splits in turn, and
+// one RGB triple follows per child that lies inside the image (geometry is
+// implicit, as in .qtc).
+#pragma once
+
+#include "spill.h"
+
+#include <deque>
+#include <memory>
+
+constexpr size_t QTP_HEADER_BYTES = 20;
+
+inline void writeQtpHeader(std::vector<uint8_t> &out, const QtcHeader &h)
+{
+    out.insert(out.end(), {'Q', 'T', 'P', '1'});
+    putU32(out, h.W);
+    putU32(out, h.H);
+    putU32(out, h.rootW);
+    putU32(out, h.rootH);
+}
+
+inline bool readQtpHeader(const uint8_t *p, size_t len, QtcHeader &h)
+{
+    if (len < QTP_HEADER_BYTES || std::memcmp(p, "QTP1", 4) != 0)
+        return false;
+    h.W = getU32(p + 4);
+    h.H = getU32(p + 8);
+    h.rootW = getU32(p + 12);
+    h.rootH = getU32(p + 16);
+    return qtcHeaderValid(h);
+}
+
+// Breadth-first encoding of the tree below the header. Spilled subtrees are
+// paged in when their level is reached and freed as soon as the last of their
+// queued nodes has been emitted, so only the subtrees the current levels cut
+// through are resident.
+inline bool serializeProgressive(const Node *root, int W, int H, std::vector<uint8_t> &out,
+                                 const SpillStore *store = nullptr)
+{
+    if (!root)
+        return false;
+    struct Paged
+    {
+        std::unique_ptr<Node, void (*)(Node *)> tree{nullptr, destroy};
+        size_t queued = 0; // its nodes still in the queue
+    };
+    std::deque<Paged> paged;
+    // queue entries: a node and the paged subtree it belongs to (-1: root tree)
+    struct Item
+    {
+        const Node *n;
+        long owner;
+    };
+    // resolves spilled handles to their paged-in subtree, which owns n's children
+    auto expand = [&](const Node *n, long &owner) -> const Node *
+    {
+        if (!n->spilled || !store)
+            return n;
+        Node *sub = store->load(n);
+        if (!sub)
+            return nullptr;
+        fillInternalAverages(sub, W, H);
+        paged.emplace_back();
+        paged.back().tree.reset(sub);
+        owner = (long)paged.size() - 1;
+        return sub;
+    };
+    auto splits = [&](const Node *n)
+    { return !n->leaf && (!n->spilled || store); };
+    auto putColor = [&](Color c)
+    {
+        out.push_back(c.r);
+        out.push_back(c.g);
+        out.push_back(c.b);
+    };
+
+    std::deque<Item> queue;
+    out.push_back(splits(root) ? 1 : 0);
+    putColor(root->avg);
+    if (splits(root))
+        queue.push_back(Item{root, -1});
+    while (!queue.empty())
+    {
+        const long from = queue.front().owner;
+        long owner = from;
+        const Node *n = expand(queue.front().n, owner);
+        queue.pop_front();
+        if (!n)
+            return false;
+        uint8_t flags = 0;
+        for (int i = 0; i < 4; ++i)
+            if (n->ch[i] && splits(n->ch[i]))
+                flags |= (uint8_t)(1u << i);
+        out.push_back(flags);
+        for (int i = 0; i < 4; ++i)
+        {
+            if (!n->ch[i])
+                continue;
+            putColor(n->ch[i]->avg);
+            if (flags & (1u << i))
+            {
+                queue.push_back(Item{n->ch[i], owner});
+                if (owner >= 0)
+                    paged[owner].queued++;
+            }
+        }
+        // a subtree with nothing left queued has been emitted completely
+        if (from >= 0 && --paged[from].queued == 0)
+            paged[from].tree.reset();
+        if (owner != from && owner >= 0 && paged[owner].queued == 0)
+            paged[owner].tree.reset();
+    }
+    return true;
+}
+
+inline bool saveQtp(const std::string &path, const Node *root, int W, int H, const SpillStore *store = nullptr)
+{
+    if (!root)
+        return false;
+    std::vector<uint8_t> bytes;
+    writeQtpHeader(bytes, QtcHeader{(uint32_t)W, (uint32_t)H, (uint32_t)root->w, (uint32_t)root->h});
+    return serializeProgressive(root, W, H, bytes, store) && writeFileBytes(path, bytes);
+}
+
+// Incremental .qtp decoder. feed() consumes whatever bytes have arrived and
+// paints every newly decoded node over its parent's area, so the raster is
+// always a complete image at the detail received so far; nothing is decoded
+// twice and a partial group simply waits for the next feed().
+struct ProgressiveDecoder
+{
+    struct Rect
+    {
+        int x, y, w, h;
+    };
+
+    QtcHeader header;
+    std::vector<Color> raster; // W*H, valid once hasHeader()
+    size_t nodes = 0;          // nodes decoded so far
+    size_t bytesConsumed = 0;
+    int dirty[4] = {0, 0, 0, 0}; // x0, y0, x1, y1 painted since the last takeDirty()
+
+    bool hasHeader() const { return headerRead; }
+    bool done() const { return rootRead && queue.empty(); }
+    bool failed() const { return error; }
+
+    // Appends n bytes of the stream. Returns false once the stream is malformed.
+    bool feed(const uint8_t *data, size_t n)
+    {
+        if (error)
+            return false;
+        pending.insert(pending.end(), data, data + n);
+        size_t pos = 0;
+        if (!headerRead)
+        {
+            if (pending.size() < QTP_HEADER_BYTES)
+                return true;
+            // checked before the raster is allocated from it
+            if (!readQtpHeader(pending.data(), pending.size(), header) || !qtcRasterFits(header))
+                return fail();
+            raster.assign((size_t)header.W * header.H, Color{0, 0, 0});
+            headerRead = true;
+            pos = QTP_HEADER_BYTES;
+        }
+        if (!rootRead && pending.size() - pos >= 4)
+        {
+            const Rect r{0, 0, (int)header.rootW, (int)header.rootH};
+            paint(r, Color{pending[pos + 1], pending[pos + 2], pending[pos + 3]});
+            if (pending[pos] & 1)
+                queue.push_back(r);
+            pos += 4;
+            rootRead = true;
+        }
+        while (rootRead && !queue.empty() && pos < pending.size())
+        {
+            const Rect parent = queue.front();
+            int r[4][4];
+            childRects(parent.x, parent.y, parent.w, parent.h, r);
+            int present = 0;
+            for (int i = 0; i < 4; ++i)
+                present += rectInImage((int)header.W, (int)header.H, r[i][0], r[i][1], r[i][2], r[i][3]);
+            if (pending.size() - pos < 1 + 3 * (size_t)present)
+                break; // group not complete yet
+            const uint8_t flags = pending[pos++];
+            for (int i = 0; i < 4; ++i)
+            {
+                if (!rectInImage((int)header.W, (int)header.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                {
+                    if (flags & (1u << i))
+                        return fail();
+                    continue;
+                }
+                const Rect child{r[i][0], r[i][1], r[i][2], r[i][3]};
+                paint(child, Color{pending[pos], pending[pos + 1], pending[pos + 2]});
+                pos += 3;
+                if (flags & (1u << i))
+                {
+                    if (child.w / 2 == 0 || child.h / 2 == 0)
+                        return fail(); // cannot split further
+                    queue.push_back(child);
+                }
+            }
+            queue.pop_front();
+        }
+        bytesConsumed += pos;
+        pending.erase(pending.begin(), pending.begin() + (std::ptrdiff_t)pos);
+        if (done() && !pending.empty())
+            return fail(); // trailing garbage
+        return true;
+    }
+
+    // Returns the area painted since the last call (false when nothing changed).
+    bool takeDirty(int &x0, int &y0, int &x1, int &y1)
+    {
+        if (dirty[2] <= dirty[0] || dirty[3] <= dirty[1])
+            return false;
+        x0 = dirty[0];
+        y0 = dirty[1];
+        x1 = dirty[2];
+        y1 = dirty[3];
+        dirty[0] = dirty[1] = dirty[2] = dirty[3] = 0;
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> pending; // received but not yet decoded
+    std::deque<Rect> queue;       // split nodes whose children are still to come
+    bool headerRead = false, rootRead = false, error = false;
+
+    bool fail()
+    {
+        error = true;
+        return false;
+    }
+
+    void paint(const Rect &r, Color c)
+    {
+        nodes++;
+        const int W = (int)header.W, H = (int)header.H;
+        blitRectBand(raster.data(), W, 0, H, r.x, r.y, r.w, r.h, c);
+        const int x0 = std::max(0, r.x), y0 = std::max(0, r.y);
+        const int x1 = std::min(W, r.x + r.w), y1 = std::min(H, r.y + r.h);
+        if (dirty[2] <= dirty[0] || dirty[3] <= dirty[1])
+        {
+            dirty[0] = x0;
+            dirty[1] = y0;
+            dirty[2] = x1;
+            dirty[3] = y1;
+            return;
+        }
+        dirty[0] = std::min(dirty[0], x0);
+        dirty[1] = std::min(dirty[1], y0);
+        dirty[2] = std::max(dirty[2], x1);
+        dirty[3] = std::max(dirty[3], y1);
+    }
+};
@@ -0,0 +1,170 @@
+// pyramid.h
+// Deep-zoom pyramid export straight from the tree. Every level of a DZI
+// (Deep Zoom Image) or XYZ tile pyramid is rendered with renderScaled(): a
+// level at 1/s resolution walks nodes down to size s and uses their average
+// color, so coarse tiles cost the same as fine ones and no full-resolution
+// raster is ever downsampled. All tiles of all levels form one work list.
+//
+//   DZI: out.dzi + out_files/{level}/{col}_{row}.png, level L = image / 2^(maxLevel - L),
+//        maxLevel = ceil(log2(max(W, H))); edge tiles are cropped to the level size
+//   XYZ: out/{z}/{x}/{y}.png, tileSize squares, z = 0 is the tile covering the image
+#pragma once
+
+#include "png_writer.h"
+#include "tile_render.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+enum PyramidLayout
+{
+    PYRAMID_DZI,
+    PYRAMID_XYZ,
+    PYRAMID_LAYOUT_COUNT
+};
+
+inline const char *pyramidLayoutName(int l)
+{
+    static const char *names[PYRAMID_LAYOUT_COUNT] = {"dzi", "xyz"};
+    return l >= 0 && l < PYRAMID_LAYOUT_COUNT ? names[l] : "?";
+}
+
+inline bool parsePyramidLayout(const std::string &s, int &l)
+{
+    for (int i = 0; i < PYRAMID_LAYOUT_COUNT; ++i)
+        if (s == pyramidLayoutName(i))
+        {
+            l = i;
+            return true;
+        }
+    return false;
+}
+
+struct PyramidParams
+{
+    int layout = PYRAMID_DZI;
+    int tileSize = 256;
+    int threads = 0; // 0 = one per hardware thread
+    PngParams png = pngPresetParams(PNG_PRESET_FAST);
+};
+
+struct PyramidStats
+{
+    int levels = 0;
+    size_t tiles = 0;
+    uint64_t bytes = 0; // encoded tile bytes
+    double ms = 0;
+};
+
+namespace pyramid_detail
+{
+    struct Tile
+    {
+        int level, col, row;
+        int64_t ox, oy, scale;
+        int w, h;
+    };
+
+    inline int ceilLog2(int64_t v)
+    {
+        int k = 0;
+        while (((int64_t)1 << k) < v)
+            k++;
+        return k;
+    }
+
+    inline std::string dziXml(int W, int H, int tileSize)
+    {
+        char s[512];
+        std::snprintf(s, sizeof(s),
+                      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" "
+                      "TileSize=\"%d\">\n  <Size Width=\"%d\" Height=\"%d\"/>\n</Image>\n",
+                      tileSize, W, H);
+        return s;
+    }
+}
+
+// Writes the pyramid of the tree. For DZI, `out` is the .dzi path and tiles go
+// to the sibling "<stem>_files" directory; for XYZ it is the tile directory.
+inline bool exportPyramid(const Node *root, int W, int H, const SpillStore *store, const std::string &out,
+                          const PyramidParams &params, PyramidStats &stats)
+{
+    using namespace pyramid_detail;
+    namespace fs = std::filesystem;
+    stats = PyramidStats{};
+    if (!root || W <= 0 || H <= 0 || params.tileSize <= 0)
+        return false;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    const int T = params.tileSize;
+    const bool dzi = params.layout == PYRAMID_DZI;
+    const fs::path dir = dzi ? fs::path(fs::path(out).replace_extension().string() + "_files") : fs::path(out);
+
+    // every tile of every level, coarse levels first
+    std::vector<Tile> tiles;
+    const int maxLevel = dzi ? ceilLog2(std::max(W, H)) : TileGrid(W, H, T).maxZoom;
+    for (int level = 0; level <= maxLevel; ++level)
+    {
+        const int64_t s = (int64_t)1 << (maxLevel - level);
+        // DZI levels are the image at 1/s (rounded up); XYZ tiles are always full squares
+        const int64_t lw = dzi ? (W + s - 1) / s : 0, lh = dzi ? (H + s - 1) / s : 0;
+        const int cols = (int)(dzi ? (lw + T - 1) / T : (W + T * s - 1) / (T * s));
+        const int rows = (int)(dzi ? (lh + T - 1) / T : (H + T * s - 1) / (T * s));
+        // XYZ keeps one directory per column
+        for (int c = 0; c < (dzi ? 1 : cols); ++c)
+        {
+            const fs::path d = dzi ? dir / std::to_string(level) : dir / std::to_string(level) / std::to_string(c);
+            std::error_code ec;
+            fs::create_directories(d, ec);
+            if (ec)
+            {
+                std::cerr << "Cannot create " << d.string() << ": " << ec.message() << "\n";
+                return false;
+            }
+        }
+        for (int r = 0; r < rows; ++r)
+            for (int c = 0; c < cols; ++c)
+            {
+                const int w = dzi ? (int)std::min<int64_t>(T, lw - (int64_t)c * T) : T;
+                const int h = dzi ? (int)std::min<int64_t>(T, lh - (int64_t)r * T) : T;
+                tiles.push_back(Tile{level, c, r, (int64_t)c * T * s, (int64_t)r * T * s, s, w, h});
+            }
+    }
+    if (dzi)
+    {
+        const std::string xml = dziXml(W, H, T);
+        if (!writeFileBytes(out, std::vector<uint8_t>(xml.begin(), xml.end())))
+            return false;
+    }
+
+    PngParams png = params.png;
+    png.threads = 1; // tiles are the unit of parallelism
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<bool> ok{true};
+    parallelFor(tiles.size(), params.threads, [&](size_t i)
+                {
+        if (!ok)
+            return;
+        thread_local std::vector<Color> px;
+        thread_local std::vector<uint8_t> enc;
+        const Tile &t = tiles[i];
+        renderScaled(root, W, H, t.ox, t.oy, t.scale, t.w, t.h, px, store);
+        const std::string name = dzi ? std::to_string(t.col) + "_" + std::to_string(t.row) + ".png"
+                                     : std::to_string(t.col) + "/" + std::to_string(t.row) + ".png";
+        const fs::path file = dir / std::to_string(t.level) / name;
+        if (!encodePNG(pngImageRGB(reinterpret_cast<const uint8_t *>(px.data()), t.w, t.h), png, enc) ||
+            !writeFileBytes(file.string(), enc))
+        {
+            ok = false;
+            return;
+        }
+        bytes += enc.size(); });
+    auto t1 = std::chrono::high_resolution_clock::now();
+    stats.levels = maxLevel + 1;
+    stats.tiles = tiles.size();
+    stats.bytes = bytes;
+    stats.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    return ok;
+}
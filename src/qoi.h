@@ -0,0 +1,214 @@
+// qoi.h
+// "Quite OK Image" codec (qoiformat.org, 8-bit RGB/RGBA). A single pass with
+// run, 64-entry index and small-delta ops; rasterized trees are mostly runs
+// and repeated leaf colors, so encoding is roughly a memory-speed scan.
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace qoi_detail
+{
+    constexpr uint8_t OP_INDEX = 0x00, OP_DIFF = 0x40, OP_LUMA = 0x80, OP_RUN = 0xc0,
+                      OP_RGB = 0xfe, OP_RGBA = 0xff, MASK_2 = 0xc0;
+    constexpr size_t HEADER_BYTES = 14;
+    constexpr uint64_t MAX_PIXELS = 400000000; // the reference limit, kept by encoder and decoder
+    constexpr size_t MAX_RUN = 62;             // pixels one op byte can produce
+    static const uint8_t kPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    struct Px
+    {
+        uint8_t r, g, b, a;
+    };
+
+    inline int hash(const Px &p) { return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64; }
+    inline bool same(const Px &x, const Px &y) { return x.r == y.r && x.g == y.g && x.b == y.b && x.a == y.a; }
+
+    inline void putBE32(uint8_t *p, uint32_t v)
+    {
+        p[0] = (uint8_t)(v >> 24);
+        p[1] = (uint8_t)(v >> 16);
+        p[2] = (uint8_t)(v >> 8);
+        p[3] = (uint8_t)v;
+    }
+    inline uint32_t getBE32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+}
+
+// Encodes W*H pixels of `channels` (3 or 4) bytes, rows `stride` bytes apart.
+// Fails beyond MAX_PIXELS, which no conforming decoder would open.
+inline bool qoiEncode(const uint8_t *px, int W, int H, int channels, size_t stride, std::vector<uint8_t> &out)
+{
+    using namespace qoi_detail;
+    if (!px || W <= 0 || H <= 0 || (channels != 3 && channels != 4) || (uint64_t)W * H > MAX_PIXELS)
+        return false;
+    // worst case: one OP_RGBA (5 bytes) per pixel
+    out.resize(HEADER_BYTES + (size_t)W * H * (channels + 1) + sizeof(kPadding));
+    uint8_t *o = out.data();
+    o[0] = 'q';
+    o[1] = 'o';
+    o[2] = 'i';
+    o[3] = 'f';
+    putBE32(o + 4, (uint32_t)W);
+    putBE32(o + 8, (uint32_t)H);
+    o[12] = (uint8_t)channels;
+    o[13] = 0; // sRGB with linear alpha
+    size_t n = HEADER_BYTES;
+
+    Px index[64] = {};
+    Px prev{0, 0, 0, 255};
+    int run = 0;
+    for (int y = 0; y < H; ++y)
+    {
+        const uint8_t *row = px + (size_t)y * stride;
+        for (int x = 0; x < W; ++x)
+        {
+            const uint8_t *s = row + (size_t)x * channels;
+            const Px cur{s[0], s[1], s[2], channels == 4 ? s[3] : (uint8_t)255};
+            if (same(cur, prev))
+            {
+                if (++run == 62)
+                {
+                    o[n++] = (uint8_t)(OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                o[n++] = (uint8_t)(OP_RUN | (run - 1));
+                run = 0;
+            }
+            const int h = hash(cur);
+            if (same(index[h], cur))
+                o[n++] = (uint8_t)(OP_INDEX | h);
+            else
+            {
+                index[h] = cur;
+                if (cur.a == prev.a)
+                {
+                    const int8_t vr = (int8_t)(cur.r - prev.r), vg = (int8_t)(cur.g - prev.g),
+                                 vb = (int8_t)(cur.b - prev.b);
+                    const int8_t vgr = (int8_t)(vr - vg), vgb = (int8_t)(vb - vg);
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                        o[n++] = (uint8_t)(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                    {
+                        o[n++] = (uint8_t)(OP_LUMA | (vg + 32));
+                        o[n++] = (uint8_t)((vgr + 8) << 4 | (vgb + 8));
+                    }
+                    else
+                    {
+                        o[n++] = OP_RGB;
+                        o[n++] = cur.r;
+                        o[n++] = cur.g;
+                        o[n++] = cur.b;
+                    }
+                }
+                else
+                {
+                    o[n++] = OP_RGBA;
+                    o[n++] = cur.r;
+                    o[n++] = cur.g;
+                    o[n++] = cur.b;
+                    o[n++] = cur.a;
+                }
+            }
+            prev = cur;
+        }
+    }
+    if (run > 0)
+        o[n++] = (uint8_t)(OP_RUN | (run - 1));
+    for (uint8_t b : kPadding)
+        o[n++] = b;
+    out.resize(n);
+    return true;
+}
+
+// Decodes to packed pixels of `channels` (3 or 4) bytes.
+inline bool qoiDecode(const uint8_t *data, size_t len, int &W, int &H, int channels, std::vector<uint8_t> &out)
+{
+    using namespace qoi_detail;
+    if (!data || len < HEADER_BYTES + sizeof(kPadding) || data[0] != 'q' || data[1] != 'o' ||
+        data[2] != 'i' || data[3] != 'f' || (channels != 3 && channels != 4))
+        return false;
+    const uint32_t w = getBE32(data + 4), h = getBE32(data + 8);
+    if (w == 0 || h == 0 || w > INT_MAX || h > INT_MAX || (uint64_t)w * h > MAX_PIXELS || data[12] < 3 ||
+        data[12] > 4)
+        return false;
+    // a header claiming more pixels than the stream could encode is rejected
+    // before anything is allocated for it
+    const uint64_t pixels = (uint64_t)w * h;
+    if (pixels > (uint64_t)(len - HEADER_BYTES - sizeof(kPadding)) * MAX_RUN)
+        return false;
+    W = (int)w;
+    H = (int)h;
+    out.resize((size_t)pixels * channels);
+
+    Px index[64] = {};
+    Px p{0, 0, 0, 255};
+    int run = 0;
+    size_t i = HEADER_BYTES;
+    const size_t end = len - sizeof(kPadding);
+    uint8_t *o = out.data();
+    for (size_t k = 0; k < pixels; ++k)
+    {
+        if (run > 0)
+            --run;
+        else if (i < end)
+        {
+            const uint8_t b1 = data[i++];
+            if (b1 == OP_RGB)
+            {
+                if (i + 3 > end)
+                    return false;
+                p.r = data[i++];
+                p.g = data[i++];
+                p.b = data[i++];
+            }
+            else if (b1 == OP_RGBA)
+            {
+                if (i + 4 > end)
+                    return false;
+                p.r = data[i++];
+                p.g = data[i++];
+                p.b = data[i++];
+                p.a = data[i++];
+            }
+            else if ((b1 & MASK_2) == OP_INDEX)
+                p = index[b1];
+            else if ((b1 & MASK_2) == OP_DIFF)
+            {
+                p.r += (uint8_t)(((b1 >> 4) & 3) - 2);
+                p.g += (uint8_t)(((b1 >> 2) & 3) - 2);
+                p.b += (uint8_t)((b1 & 3) - 2);
+            }
+            else if ((b1 & MASK_2) == OP_LUMA)
+            {
+                if (i >= end)
+                    return false;
+                const uint8_t b2 = data[i++];
+                const int vg = (b1 & 0x3f) - 32;
+                p.r += (uint8_t)(vg - 8 + ((b2 >> 4) & 0x0f));
+                p.g += (uint8_t)vg;
+                p.b += (uint8_t)(vg - 8 + (b2 & 0x0f));
+            }
+            else
+                run = b1 & 0x3f;
+            index[hash(p)] = p;
+        }
+        else
+            return false; // truncated
+        o[0] = p.r;
+        o[1] = p.g;
+        o[2] = p.b;
+        if (channels == 4)
+            o[3] = p.a;
+        o += channels;
+    }
+    return true;
+}
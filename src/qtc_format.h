@@ -0,0 +1,219 @@
+// qtc_format.h
+// Native quadtree file (.qtc): a small header followed by the tree in preorder.
+//
+//   "QTC1"  u32 W  u32 H  u32 rootW  u32 rootH        (little endian)
+//   node := 0x00 child*     internal node, children in NW, NE, SW, SE order
+//         | 0x01 r g b      leaf with its average color
+//
+// Geometry is implicit: children follow the split rule of childRects() from
+// the root rectangle, and children lying completely outside the W x H image
+// are not stored. Subtrees are self-contained byte ranges, so independently
+// serialized subtrees can be concatenated under a parent's 0x00 tag.
+#pragma once
+
+#include "quadtree.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+enum : uint8_t
+{
+    QTC_INTERNAL = 0,
+    QTC_LEAF = 1,
+};
+
+struct QtcHeader
+{
+    uint32_t W = 0, H = 0;
+    uint32_t rootW = 0, rootH = 0;
+};
+
+constexpr size_t QTC_HEADER_BYTES = 20;
+
+// Largest image a decoder expands into a full raster (qoiDecode's limit).
+// Trees themselves may be larger (tiled builds) but stay in int coordinates.
+constexpr uint64_t QT_MAX_RASTER_PIXELS = 400000000;
+
+// Header fields every reader relies on: a non-empty image inside a root whose
+// sides fit the int geometry of childRects().
+inline bool qtcHeaderValid(const QtcHeader &h)
+{
+    return h.W > 0 && h.H > 0 && h.rootW >= h.W && h.rootH >= h.H && h.rootW <= (uint32_t)INT_MAX &&
+           h.rootH <= (uint32_t)INT_MAX;
+}
+
+inline bool qtcRasterFits(const QtcHeader &h) { return (uint64_t)h.W * h.H <= QT_MAX_RASTER_PIXELS; }
+
+inline void putU32(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)(v >> 16));
+    out.push_back((uint8_t)(v >> 24));
+}
+
+inline uint32_t getU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void writeQtcHeader(std::vector<uint8_t> &out, const QtcHeader &h)
+{
+    out.insert(out.end(), {'Q', 'T', 'C', '1'});
+    putU32(out, h.W);
+    putU32(out, h.H);
+    putU32(out, h.rootW);
+    putU32(out, h.rootH);
+}
+
+inline bool readQtcHeader(const uint8_t *p, size_t len, QtcHeader &h)
+{
+    if (len < QTC_HEADER_BYTES || std::memcmp(p, "QTC1", 4) != 0)
+        return false;
+    h.W = getU32(p + 4);
+    h.H = getU32(p + 8);
+    h.rootW = getU32(p + 12);
+    h.rootH = getU32(p + 16);
+    return qtcHeaderValid(h);
+}
+
+// Exact encoded size of a tree with the given node/leaf counts.
+inline size_t qtcBytes(size_t nodes, size_t leaves)
+{
+    return QTC_HEADER_BYTES + nodes + 3 * leaves;
+}
+
+inline void serializeQT(const Node *n, std::vector<uint8_t> &out)
+{
+    if (!n)
+        return;
+    if (n->leaf)
+    {
+        out.push_back(QTC_LEAF);
+        out.push_back(n->avg.r);
+        out.push_back(n->avg.g);
+        out.push_back(n->avg.b);
+        return;
+    }
+    out.push_back(QTC_INTERNAL);
+    for (int i = 0; i < 4; ++i)
+        serializeQT(n->ch[i], out);
+}
+
+// Decodes one subtree rooted at (x, y, w, h); advances p. Returns nullptr on
+// truncated or malformed input.
+inline Node *deserializeQT(const uint8_t *&p, const uint8_t *end,
+                           int x, int y, int w, int h, int W, int H,
+                           BuildStats *stats = nullptr)
+{
+    if (p >= end)
+        return nullptr;
+    const uint8_t tag = *p++;
+    Node *n = new Node();
+    n->x = x;
+    n->y = y;
+    n->w = w;
+    n->h = h;
+    if (stats)
+        stats->nodes++;
+    if (tag == QTC_LEAF)
+    {
+        if (end - p < 3)
+        {
+            delete n;
+            return nullptr;
+        }
+        n->leaf = true;
+        n->avg = Color{p[0], p[1], p[2]};
+        p += 3;
+        if (stats)
+            stats->leaves++;
+        return n;
+    }
+    if (tag != QTC_INTERNAL)
+    {
+        delete n;
+        return nullptr;
+    }
+    int r[4][4];
+    childRects(x, y, w, h, r);
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            continue;
+        n->ch[i] = deserializeQT(p, end, r[i][0], r[i][1], r[i][2], r[i][3], W, H, stats);
+        if (!n->ch[i])
+        {
+            destroy(n);
+            return nullptr;
+        }
+    }
+    return n;
+}
+
+inline bool writeFileBytes(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+// 64-bit FILE positioning: fseek/ftell take a long, which is 32 bits on Windows.
+inline bool seekFile(FILE *f, uint64_t offset, int whence = SEEK_SET)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, whence) == 0;
+#else
+    return fseeko(f, (off_t)offset, whence) == 0;
+#endif
+}
+
+// Current position, or -1 on failure.
+inline int64_t tellFile(FILE *f)
+{
+#ifdef _WIN32
+    return (int64_t)_ftelli64(f);
+#else
+    return (int64_t)ftello(f);
+#endif
+}
+
+inline bool readFileBytes(const std::string &path, std::vector<uint8_t> &bytes)
+{
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    bytes.clear();
+    uint8_t tmp[1 << 16];
+    size_t got;
+    while ((got = std::fread(tmp, 1, sizeof(tmp), f)) > 0)
+        bytes.insert(bytes.end(), tmp, tmp + got);
+    std::fclose(f);
+    return true;
+}
+
+inline bool saveQtc(const std::string &path, const Node *root, int W, int H)
+{
+    if (!root)
+        return false;
+    std::vector<uint8_t> bytes;
+    writeQtcHeader(bytes, QtcHeader{(uint32_t)W, (uint32_t)H, (uint32_t)root->w, (uint32_t)root->h});
+    serializeQT(root, bytes);
+    return writeFileBytes(path, bytes);
+}
+
+inline Node *loadQtc(const std::string &path, QtcHeader &h, BuildStats *stats = nullptr)
+{
+    std::vector<uint8_t> bytes;
+    if (!readFileBytes(path, bytes) || !readQtcHeader(bytes.data(), bytes.size(), h))
+        return nullptr;
+    const uint8_t *p = bytes.data() + QTC_HEADER_BYTES;
+    Node *root = deserializeQT(p, bytes.data() + bytes.size(), 0, 0, (int)h.rootW, (int)h.rootH,
+                               (int)h.W, (int)h.H, stats);
+    fillInternalAverages(root, (int)h.W, (int)h.H); // the file only stores leaf colors
+    return root;
+}
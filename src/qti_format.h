@@ -0,0 +1,413 @@
+// qti_format.h
+// Indexed quadtree container (.qti): a .qtc body preceded by the byte offset
+// of every subtree down to an index depth, so a reader can seek straight to
+// the subtrees that intersect a viewport instead of decoding the whole file.
+//
+//   "QTI1"  u32 W  u32 H  u32 rootW  u32 rootH  u32 indexDepth  u64 count
+//   entry*  u64: bits 0-62 = offset of the subtree in the body
+//                bit 63    = internal node whose children are indexed too
+//   body    the .qtc node stream (qtc_format.h)
+//
+// Entries are in preorder, like the body, so the subtree of an entry without
+// bit 63 ends where the next entry starts. The index costs 8 bytes per node
+// above the index depth; by default the depth is the deepest one keeping it
+// under 1% of the body.
+#pragma once
+
+#include "spill.h"
+
+#include <cstdio>
+#include <mutex>
+
+constexpr size_t QTI_HEADER_BYTES = 32;
+constexpr int QTI_MAX_INDEX_DEPTH = 12;
+constexpr uint64_t QTI_EXPANDED = 1ull << 63;
+
+struct QtiEntry
+{
+    uint64_t offset = 0;
+    int depth = 0;
+    bool internal = false;
+};
+
+namespace qti_detail
+{
+    inline void putU64(std::vector<uint8_t> &out, uint64_t v)
+    {
+        putU32(out, (uint32_t)v);
+        putU32(out, (uint32_t)(v >> 32));
+    }
+
+    inline uint64_t getU64(const uint8_t *p)
+    {
+        return (uint64_t)getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+    }
+
+    // Walks one .qtc subtree, recording nodes up to maxDepth. Returns false on
+    // truncated or malformed input.
+    inline bool scan(const uint8_t *body, const uint8_t *&p, const uint8_t *end, int x, int y, int w, int h,
+                     int W, int H, int depth, int maxDepth, std::vector<QtiEntry> &entries)
+    {
+        if (p >= end)
+            return false;
+        const uint8_t tag = *p;
+        if (depth <= maxDepth)
+            entries.push_back({(uint64_t)(p - body), depth, tag == QTC_INTERNAL});
+        ++p;
+        if (tag == QTC_LEAF)
+        {
+            if (end - p < 3)
+                return false;
+            p += 3;
+            return true;
+        }
+        if (tag != QTC_INTERNAL)
+            return false;
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int i = 0; i < 4; ++i)
+            if (rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]) &&
+                !scan(body, p, end, r[i][0], r[i][1], r[i][2], r[i][3], W, H, depth + 1, maxDepth, entries))
+                return false;
+        return true;
+    }
+}
+
+// Index of a .qtc body. indexDepth < 0 picks the deepest level whose index
+// stays within maxOverhead of the body size.
+inline bool buildQtiIndex(const QtcHeader &h, const uint8_t *body, size_t len, int indexDepth,
+                          std::vector<QtiEntry> &entries, int &depthUsed, double maxOverhead = 0.01)
+{
+    entries.clear();
+    const int maxDepth = indexDepth < 0 ? QTI_MAX_INDEX_DEPTH : indexDepth;
+    const uint8_t *p = body;
+    if (!qti_detail::scan(body, p, body + len, 0, 0, (int)h.rootW, (int)h.rootH, (int)h.W, (int)h.H, 0,
+                          maxDepth, entries) ||
+        p != body + len)
+        return false;
+    depthUsed = maxDepth;
+    if (indexDepth < 0)
+    {
+        size_t perDepth[QTI_MAX_INDEX_DEPTH + 1] = {};
+        for (const QtiEntry &e : entries)
+            perDepth[e.depth]++;
+        size_t total = 0;
+        depthUsed = 0;
+        for (int d = 0; d <= maxDepth; ++d)
+        {
+            total += perDepth[d];
+            if (d > 0 && (double)total * 8 > maxOverhead * (double)len)
+                break;
+            depthUsed = d;
+        }
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const QtiEntry &e)
+                                     { return e.depth > depthUsed; }),
+                      entries.end());
+    }
+    return true;
+}
+
+inline void writeQtiHeader(std::vector<uint8_t> &out, const QtcHeader &h, int indexDepth,
+                           const std::vector<QtiEntry> &entries)
+{
+    out.insert(out.end(), {'Q', 'T', 'I', '1'});
+    putU32(out, h.W);
+    putU32(out, h.H);
+    putU32(out, h.rootW);
+    putU32(out, h.rootH);
+    putU32(out, (uint32_t)indexDepth);
+    qti_detail::putU64(out, entries.size());
+    for (const QtiEntry &e : entries)
+        qti_detail::putU64(out, e.offset | (e.internal && e.depth < indexDepth ? QTI_EXPANDED : 0));
+}
+
+// Writes header, index and body. Returns the index bytes through indexBytes.
+inline bool saveQtiBody(const std::string &path, const QtcHeader &h, const uint8_t *body, size_t len,
+                        int indexDepth = -1, size_t *indexBytes = nullptr)
+{
+    std::vector<QtiEntry> entries;
+    int depth = 0;
+    if (!buildQtiIndex(h, body, len, indexDepth, entries, depth))
+        return false;
+    std::vector<uint8_t> head;
+    writeQtiHeader(head, h, depth, entries);
+    if (indexBytes)
+        *indexBytes = head.size() - QTI_HEADER_BYTES;
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    const bool ok = std::fwrite(head.data(), 1, head.size(), f) == head.size() &&
+                    std::fwrite(body, 1, len, f) == len;
+    return std::fclose(f) == 0 && ok;
+}
+
+// Re-wraps a complete .qtc file (header included) as .qti.
+inline bool saveQtiFromQtc(const std::string &path, const std::vector<uint8_t> &qtc, int indexDepth = -1,
+                           size_t *indexBytes = nullptr)
+{
+    QtcHeader h;
+    return readQtcHeader(qtc.data(), qtc.size(), h) &&
+           saveQtiBody(path, h, qtc.data() + QTC_HEADER_BYTES, qtc.size() - QTC_HEADER_BYTES, indexDepth,
+                       indexBytes);
+}
+
+inline bool saveQti(const std::string &path, const Node *root, int W, int H, const SpillStore *store = nullptr,
+                    int indexDepth = -1, size_t *indexBytes = nullptr)
+{
+    if (!root)
+        return false;
+    std::vector<uint8_t> body;
+    return serializeQT(root, body, store) &&
+           saveQtiBody(path, QtcHeader{(uint32_t)W, (uint32_t)H, (uint32_t)root->w, (uint32_t)root->h},
+                       body.data(), body.size(), indexDepth, indexBytes);
+}
+
+struct QtiRegionStats
+{
+    size_t subtrees = 0; // indexed subtrees read
+    uint64_t bytesRead = 0;
+    size_t leaves = 0; // leaves painted
+};
+
+// Random-access reader: keeps the index (and the tree skeleton it describes)
+// in memory and reads body ranges on demand. decodeRegion() may be called from
+// several threads.
+struct QtiReader
+{
+    QtcHeader header;
+    int indexDepth = 0;
+    uint64_t bodyBytes = 0;
+
+    QtiReader() = default;
+    QtiReader(const QtiReader &) = delete;
+    QtiReader &operator=(const QtiReader &) = delete;
+    ~QtiReader() { close(); }
+
+    void close()
+    {
+        if (file)
+            std::fclose(file);
+        file = nullptr;
+        top.clear();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        uint8_t head[QTI_HEADER_BYTES];
+        if (std::fread(head, 1, sizeof(head), file) != sizeof(head) || std::memcmp(head, "QTI1", 4) != 0)
+            return fail();
+        std::memcpy(head, "QTC1", 4); // same geometry fields as .qtc
+        if (!readQtcHeader(head, sizeof(head), header))
+            return fail();
+        indexDepth = (int)getU32(head + 20);
+        const uint64_t count = qti_detail::getU64(head + 24);
+        const int64_t end = seekFile(file, 0, SEEK_END) ? tellFile(file) : -1;
+        if (end < 0)
+            return fail();
+        const uint64_t fileBytes = (uint64_t)end;
+        if (count == 0 || count > (fileBytes - QTI_HEADER_BYTES) / 8)
+            return fail();
+        bodyStart = QTI_HEADER_BYTES + count * 8;
+        bodyBytes = fileBytes - bodyStart;
+
+        std::vector<uint8_t> index((size_t)count * 8);
+        if (!seekFile(file, QTI_HEADER_BYTES) ||
+            std::fread(index.data(), 1, index.size(), file) != index.size())
+            return fail();
+        std::vector<uint64_t> raw((size_t)count);
+        for (size_t i = 0; i < raw.size(); ++i)
+            raw[i] = qti_detail::getU64(index.data() + i * 8);
+        size_t next = 0;
+        if (buildTop(raw, next, 0, 0, (int)header.rootW, (int)header.rootH) < 0 || next != raw.size())
+            return fail();
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+    size_t indexedNodes() const { return top.size(); }
+
+    // Box-filtered pixels of the rectangle (x, y, w, h), clipped to the image,
+    // downsampled by `scale` (1 = full resolution). Only the indexed subtrees
+    // overlapping the rectangle are read.
+    bool decodeRegion(int x, int y, int w, int h, int scale, std::vector<Color> &out, int &outW, int &outH,
+                      QtiRegionStats *stats = nullptr) const
+    {
+        const int W = (int)header.W, H = (int)header.H;
+        Region r;
+        r.x0 = std::max(0, x);
+        r.y0 = std::max(0, y);
+        r.x1 = std::min(W, x + w);
+        r.y1 = std::min(H, y + h);
+        r.scale = std::max(1, scale);
+        if (!file || r.x1 <= r.x0 || r.y1 <= r.y0)
+            return false;
+        r.outW = outW = (r.x1 - r.x0 + r.scale - 1) / r.scale;
+        r.outH = outH = (r.y1 - r.y0 + r.scale - 1) / r.scale;
+        if (r.scale > 1)
+            r.sums.assign((size_t)outW * outH * 3, 0);
+        out.assign((size_t)outW * outH, Color{0, 0, 0});
+
+        QtiRegionStats local;
+        std::vector<uint8_t> bytes;
+        std::vector<int> stack{0};
+        while (!stack.empty())
+        {
+            const TopNode &t = top[(size_t)stack.back()];
+            stack.pop_back();
+            if (t.x >= r.x1 || t.y >= r.y1 || t.x + t.w <= r.x0 || t.y + t.h <= r.y0)
+                continue;
+            if (t.expanded)
+            {
+                for (int i = 3; i >= 0; --i)
+                    if (t.child[i] >= 0)
+                        stack.push_back(t.child[i]);
+                continue;
+            }
+            if (!readBody(t.offset, t.end - t.offset, bytes))
+                return false;
+            local.subtrees++;
+            local.bytesRead += bytes.size();
+            const uint8_t *p = bytes.data();
+            if (!paint(p, bytes.data() + bytes.size(), t.x, t.y, t.w, t.h, r, out, local.leaves))
+                return false;
+        }
+        if (r.scale > 1)
+            for (int j = 0; j < outH; ++j)
+            {
+                const int bh = std::min(r.y1, r.y0 + (j + 1) * r.scale) - (r.y0 + j * r.scale);
+                for (int i = 0; i < outW; ++i)
+                {
+                    const int bw = std::min(r.x1, r.x0 + (i + 1) * r.scale) - (r.x0 + i * r.scale);
+                    const uint64_t area = (uint64_t)bw * bh, *s = &r.sums[((size_t)j * outW + i) * 3];
+                    out[(size_t)j * outW + i] = Color{(uint8_t)((s[0] + area / 2) / area),
+                                                      (uint8_t)((s[1] + area / 2) / area),
+                                                      (uint8_t)((s[2] + area / 2) / area)};
+                }
+            }
+        if (stats)
+            *stats = local;
+        return true;
+    }
+
+private:
+    struct TopNode
+    {
+        int x, y, w, h;
+        uint64_t offset, end; // body byte range (end only meaningful when !expanded)
+        bool expanded;
+        int child[4];
+    };
+    struct Region
+    {
+        int x0, y0, x1, y1, scale, outW, outH;
+        std::vector<uint64_t> sums; // per output pixel, scale > 1 only
+    };
+
+    FILE *file = nullptr;
+    uint64_t bodyStart = 0;
+    std::vector<TopNode> top; // preorder, top[0] = root
+    mutable std::mutex io;
+
+    bool fail()
+    {
+        close();
+        return false;
+    }
+
+    int buildTop(const std::vector<uint64_t> &raw, size_t &next, int x, int y, int w, int h)
+    {
+        if (next >= raw.size())
+            return -1;
+        const size_t i = next++;
+        const uint64_t off = raw[i] & ~QTI_EXPANDED;
+        const uint64_t end = next < raw.size() ? raw[next] & ~QTI_EXPANDED : bodyBytes;
+        if (off >= bodyBytes || end < off || (i > 0 && off <= (raw[i - 1] & ~QTI_EXPANDED)))
+            return -1;
+        const int id = (int)top.size();
+        top.push_back(TopNode{x, y, w, h, off, end, (raw[i] & QTI_EXPANDED) != 0, {-1, -1, -1, -1}});
+        if (!top[id].expanded)
+            return id;
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int c = 0; c < 4; ++c)
+        {
+            if (!rectInImage((int)header.W, (int)header.H, r[c][0], r[c][1], r[c][2], r[c][3]))
+                continue;
+            const int child = buildTop(raw, next, r[c][0], r[c][1], r[c][2], r[c][3]);
+            if (child < 0)
+                return -1;
+            top[id].child[c] = child;
+        }
+        return id;
+    }
+
+    bool readBody(uint64_t offset, uint64_t n, std::vector<uint8_t> &bytes) const
+    {
+        bytes.resize((size_t)n);
+        std::lock_guard<std::mutex> lk(io);
+        return seekFile(file, bodyStart + offset) &&
+               std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+    // Decodes one subtree, painting the leaves that overlap the region.
+    bool paint(const uint8_t *&p, const uint8_t *end, int x, int y, int w, int h, Region &r,
+               std::vector<Color> &out, size_t &leaves) const
+    {
+        if (p >= end)
+            return false;
+        const uint8_t tag = *p++;
+        if (tag == QTC_LEAF)
+        {
+            if (end - p < 3)
+                return false;
+            const Color c{p[0], p[1], p[2]};
+            p += 3;
+            const int x0 = std::max(r.x0, x), x1 = std::min(r.x1, x + w);
+            const int y0 = std::max(r.y0, y), y1 = std::min(r.y1, y + h);
+            if (x0 < x1 && y0 < y1)
+            {
+                leaves++;
+                accumulate(r, out, x0, y0, x1, y1, c);
+            }
+            return true;
+        }
+        if (tag != QTC_INTERNAL)
+            return false;
+        int rc[4][4];
+        childRects(x, y, w, h, rc);
+        for (int i = 0; i < 4; ++i)
+            if (rectInImage((int)header.W, (int)header.H, rc[i][0], rc[i][1], rc[i][2], rc[i][3]) &&
+                !paint(p, end, rc[i][0], rc[i][1], rc[i][2], rc[i][3], r, out, leaves))
+                return false;
+        return true;
+    }
+
+    static void accumulate(Region &r, std::vector<Color> &out, int x0, int y0, int x1, int y1, Color c)
+    {
+        if (r.scale == 1)
+        {
+            for (int j = y0; j < y1; ++j)
+                std::fill_n(out.begin() + ((size_t)(j - r.y0) * r.outW + (x0 - r.x0)), x1 - x0, c);
+            return;
+        }
+        // spread the leaf over the output pixels it covers, weighted by overlap
+        for (int oy = (y0 - r.y0) / r.scale; oy <= (y1 - 1 - r.y0) / r.scale; ++oy)
+        {
+            const int by0 = r.y0 + oy * r.scale;
+            const int dy = std::min(y1, by0 + r.scale) - std::max(y0, by0);
+            for (int ox = (x0 - r.x0) / r.scale; ox <= (x1 - 1 - r.x0) / r.scale; ++ox)
+            {
+                const int bx0 = r.x0 + ox * r.scale;
+                const uint64_t a = (uint64_t)(std::min(x1, bx0 + r.scale) - std::max(x0, bx0)) * dy;
+                uint64_t *s = &r.sums[((size_t)oy * r.outW + ox) * 3];
+                s[0] += a * c.r;
+                s[1] += a * c.g;
+                s[2] += a * c.b;
+            }
+        }
+    }
+};
@@ -0,0 +1,502 @@
+// quadtree.h
+// Core quadtree types shared by the viewer and the headless tools:
+// pixel views, block statistics, the recursive builder and rasterization.
+// Statistics and the builder are templates over the channel count and the
+// sample type; the viewer's RGB Node tree is their <3, uint8_t> case, and
+// typed_build.h instantiates them for the other formats.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// ---------------- Image buffer ----------------
+struct Color
+{
+    uint8_t r, g, b;
+};
+
+// Read-only view over packed RGB rows. The pixels may live in a heap buffer,
+// an stb decode or a memory-mapped file; the builder never copies them.
+struct ImageView
+{
+    const uint8_t *data = nullptr;
+    int W = 0, H = 0;
+    size_t stride = 0; // bytes per row
+
+    const Color *operator[](int j) const
+    {
+        return reinterpret_cast<const Color *>(data + (size_t)j * stride);
+    }
+};
+
+inline ImageView viewOf(const std::vector<Color> &px, int W, int H)
+{
+    ImageView v;
+    v.data = reinterpret_cast<const uint8_t *>(px.data());
+    v.W = W;
+    v.H = H;
+    v.stride = (size_t)W * sizeof(Color);
+    return v;
+}
+
+// ---------------- Quadtree ----------------
+// Node rectangles follow the split rule w2 = w / 2 from the root rectangle.
+// The root may be larger than the image (padded power-of-two trees built by
+// the tiled builder); statistics only cover the part inside the image and
+// children lying completely outside it are left as nullptr.
+struct Node
+{
+    int x, y, w, h;
+    bool leaf = false;
+    bool spilled = false; // children paged out to a SpillStore (avg = subtree mean)
+    Color avg{};
+    Node *ch[4]{nullptr, nullptr, nullptr, nullptr};
+};
+
+inline double clamp0(double v) { return v < 0 ? 0 : v; }
+
+template <class T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<uint8_t>
+{
+    using Acc = uint64_t;
+    static constexpr double peak = 255.0;
+    static constexpr double toUnit8 = 1.0;
+};
+
+template <>
+struct SampleTraits<uint16_t>
+{
+    using Acc = uint64_t; // squares < 2^32: 2^30 pixels per block before overflow
+    static constexpr double peak = 65535.0;
+    static constexpr double toUnit8 = 255.0 / 65535.0;
+};
+
+template <>
+struct SampleTraits<float>
+{
+    using Acc = double;
+    static constexpr double peak = 1.0; // HDR values above it count, they are just not clipped
+    static constexpr double toUnit8 = 255.0;
+};
+
+// Read-only view over packed rows of C interleaved samples of type T.
+template <int C, class T>
+struct PixelView
+{
+    static_assert(C == 1 || C == 3 || C == 4, "1, 3 or 4 channels");
+    const uint8_t *data = nullptr;
+    int W = 0, H = 0;
+    size_t stride = 0; // bytes per row
+
+    const T *operator[](int j) const { return reinterpret_cast<const T *>(data + (size_t)j * stride); }
+};
+
+inline PixelView<3, uint8_t> pixelsOf(const ImageView &v) { return {v.data, v.W, v.H, v.stride}; }
+
+// Per-channel sums over a block; enough to derive mean and variance and to
+// merge neighbouring blocks without touching their pixels again.
+template <int C, class T>
+struct TypedStats
+{
+    using Acc = typename SampleTraits<T>::Acc;
+    uint64_t n = 0;
+    Acc sum[C]{};
+    Acc sq[C]{};
+
+    void add(const TypedStats &o)
+    {
+        n += o.n;
+        for (int c = 0; c < C; ++c)
+        {
+            sum[c] += o.sum[c];
+            sq[c] += o.sq[c];
+        }
+    }
+
+    // Mean of the per-channel standard deviations (the split criterion), in
+    // 8-bit units whatever the samples are, so thresholds mean the same for
+    // every input.
+    double stdDev() const
+    {
+        if (n == 0)
+            return 0.0;
+        double sd = 0;
+        for (int c = 0; c < C; ++c)
+        {
+            const double m = (double)sum[c] / n;
+            sd += std::sqrt(clamp0((double)sq[c] / n - m * m));
+        }
+        return sd / C * SampleTraits<T>::toUnit8;
+    }
+
+    // Truncated for integer samples.
+    T mean(int c) const
+    {
+        if (n == 0)
+            return T(0);
+        if constexpr (std::is_floating_point_v<T>)
+            return (T)(sum[c] / (double)n);
+        else
+            return (T)(sum[c] / n);
+    }
+
+    // The viewer's leaf color (RGB 8-bit stats only).
+    Color mean() const
+    {
+        static_assert(C == 3 && std::is_same_v<T, uint8_t>, "Color is 8-bit RGB");
+        return Color{mean(0), mean(1), mean(2)};
+    }
+
+    // Squared error of channel c when the block is drawn as mean(c), in sample
+    // units: sum (x - m)^2 = sq - 2 m sum + n m^2, exact for the truncated mean.
+    double sse(int c) const
+    {
+        if (n == 0)
+            return 0.0;
+        const double m = (double)mean(c);
+        return (double)sq[c] - 2.0 * m * (double)sum[c] + (double)n * m * m;
+    }
+    double sse() const
+    {
+        double e = 0;
+        for (int c = 0; c < C; ++c)
+            e += sse(c);
+        return e;
+    }
+};
+
+using BlockStats = TypedStats<3, uint8_t>;
+
+// Clip a node rectangle to the image; returns false when nothing is left.
+inline bool clipToImage(const ImageView &px, int &x, int &y, int &w, int &h)
+{
+    const int x0 = std::max(0, x), y0 = std::max(0, y);
+    const int x1 = std::min(px.W, x + w), y1 = std::min(px.H, y + h);
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+    x = x0;
+    y = y0;
+    w = x1 - x0;
+    h = y1 - y0;
+    return true;
+}
+
+// Adds n pixels of one row to the per-channel sums. The channel loop is
+// expanded at compile time, so the sums stay in registers.
+template <int C, class T, class RowAcc, class Acc, int... c>
+inline void addBlockRow(const T *row, int n, RowAcc (&rs)[C], Acc (&sq)[C], std::integer_sequence<int, c...>)
+{
+    for (int i = 0; i < n; ++i, row += C)
+        ((rs[c] += (RowAcc)row[c], sq[c] += (RowAcc)row[c] * (RowAcc)row[c]), ...);
+}
+
+template <int C, class T>
+inline TypedStats<C, T> typedBlockStats(const PixelView<C, T> &px, int x, int y, int w, int h)
+{
+    using Acc = typename SampleTraits<T>::Acc;
+    TypedStats<C, T> s;
+    const int x0 = std::max(0, x), y0 = std::max(0, y);
+    const int x1 = std::min(px.W, x + w), y1 = std::min(px.H, y + h);
+    if (x1 <= x0 || y1 <= y0)
+        return s;
+    // per-row sums of 8-bit samples fit in 32 bits for rows up to 16M pixels
+    using RowAcc = std::conditional_t<std::is_same_v<T, uint8_t>, uint32_t, Acc>;
+    Acc sum[C]{}, sq[C]{}; // locals, not s: the return slot would be written back every row
+    for (int j = y0; j < y1; ++j)
+    {
+        RowAcc rs[C]{};
+        addBlockRow<C>(px[j] + (size_t)x0 * C, x1 - x0, rs, sq, std::make_integer_sequence<int, C>{});
+        for (int c = 0; c < C; ++c)
+            sum[c] += rs[c];
+    }
+    for (int c = 0; c < C; ++c)
+    {
+        s.sum[c] = sum[c];
+        s.sq[c] = sq[c];
+    }
+    s.n = (uint64_t)(x1 - x0) * (y1 - y0);
+    return s;
+}
+
+inline BlockStats blockStats(const ImageView &px, int x, int y, int w, int h)
+{
+    return typedBlockStats(pixelsOf(px), x, y, w, h);
+}
+
+inline double calcStdDevRGB(const ImageView &px, int x, int y, int w, int h)
+{
+    return blockStats(px, x, y, w, h).stdDev();
+}
+
+inline Color averageRGB(const ImageView &px, int x, int y, int w, int h)
+{
+    return blockStats(px, x, y, w, h).mean();
+}
+
+template <int C>
+struct TypedBuildStats
+{
+    size_t nodes = 0, leaves = 0;
+    double ms = 0;
+    double sse[C]{}; // squared error of the leaves per channel (sample units), added as each is decided
+
+    template <class Stats>
+    void addLeafError(const Stats &bs)
+    {
+        for (int c = 0; c < C; ++c)
+            sse[c] += bs.sse(c);
+    }
+    double totalSSE() const
+    {
+        double e = 0;
+        for (int c = 0; c < C; ++c)
+            e += sse[c];
+        return e;
+    }
+};
+
+using BuildStats = TypedBuildStats<3>;
+
+// Child rectangles in NW, NE, SW, SE order.
+inline void childRects(int x, int y, int w, int h, int out[4][4])
+{
+    const int w2 = w / 2, h2 = h / 2;
+    const int r[4][4] = {{x, y, w2, h2},
+                         {x + w2, y, w - w2, h2},
+                         {x, y + h2, w2, h - h2},
+                         {x + w2, y + h2, w - w2, h - h2}};
+    for (int i = 0; i < 4; ++i)
+        for (int k = 0; k < 4; ++k)
+            out[i][k] = r[i][k];
+}
+
+inline bool rectInImage(int W, int H, int x, int y, int w, int h)
+{
+    return w > 0 && h > 0 && x < W && y < H && x + w > 0 && y + h > 0;
+}
+
+inline void setAverage(Node *n, const BlockStats &bs) { n->avg = bs.mean(); }
+
+// Allocates the node for (x, y, w, h) and decides whether it stays a leaf.
+// NodeT has x, y, w, h, leaf and ch[4], and a setAverage(NodeT *, stats)
+// overload. blockOut, when given, receives the block statistics the decision
+// used.
+template <class NodeT, int C, class T>
+inline NodeT *makeNodeTyped(const PixelView<C, T> &px,
+                            int x, int y, int w, int h,
+                            int minLeaf, double sdThresh,
+                            TypedBuildStats<C> &stats, TypedStats<C, T> *blockOut = nullptr)
+{
+    NodeT *n = new NodeT();
+    n->x = x;
+    n->y = y;
+    n->w = w;
+    n->h = h;
+    stats.nodes++;
+
+    const TypedStats<C, T> bs = typedBlockStats(px, x, y, w, h);
+    setAverage(n, bs); // internal nodes keep theirs too (progressive previews)
+    if (blockOut)
+        *blockOut = bs;
+    if (w <= minLeaf || h <= minLeaf || bs.stdDev() <= sdThresh || w / 2 == 0 || h / 2 == 0)
+    {
+        n->leaf = true;
+        stats.leaves++;
+        stats.addLeafError(bs);
+    }
+    return n;
+}
+
+template <class NodeT, int C, class T>
+inline NodeT *buildTypedQT(const PixelView<C, T> &px,
+                           int x, int y, int w, int h,
+                           int minLeaf, double sdThresh,
+                           TypedBuildStats<C> &stats)
+{
+    NodeT *n = makeNodeTyped<NodeT>(px, x, y, w, h, minLeaf, sdThresh, stats);
+    if (n->leaf)
+        return n;
+
+    int r[4][4];
+    childRects(x, y, w, h, r);
+    for (int i = 0; i < 4; ++i) // NW, NE, SW, SE
+        if (rectInImage(px.W, px.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            n->ch[i] = buildTypedQT<NodeT>(px, r[i][0], r[i][1], r[i][2], r[i][3], minLeaf, sdThresh, stats);
+    return n;
+}
+
+inline Node *makeNodeQT(const ImageView &px,
+                        int x, int y, int w, int h,
+                        int minLeaf, double sdThresh,
+                        BuildStats &stats, BlockStats *blockOut = nullptr)
+{
+    return makeNodeTyped<Node>(pixelsOf(px), x, y, w, h, minLeaf, sdThresh, stats, blockOut);
+}
+
+inline Node *buildQT(const ImageView &px,
+                     int x, int y, int w, int h,
+                     int minLeaf, double sdThresh,
+                     BuildStats &stats)
+{
+    return buildTypedQT<Node>(pixelsOf(px), x, y, w, h, minLeaf, sdThresh, stats);
+}
+
+// Sets the avg of every internal node to the area-weighted mean of its
+// leaves (clipped to W x H), for trees that only carry leaf colors such as
+// those read back from .qtc. Returns the subtree's clipped area.
+inline double fillInternalAverages(Node *n, int W, int H, double acc[3] = nullptr)
+{
+    if (!n)
+        return 0;
+    const double area = (double)std::max(0, std::min(W, n->x + n->w) - std::max(0, n->x)) *
+                        std::max(0, std::min(H, n->y + n->h) - std::max(0, n->y));
+    if (n->leaf || n->spilled)
+    {
+        if (acc)
+        {
+            acc[0] += area * n->avg.r;
+            acc[1] += area * n->avg.g;
+            acc[2] += area * n->avg.b;
+        }
+        return area;
+    }
+    double sum[3] = {0, 0, 0}, covered = 0;
+    for (int i = 0; i < 4; ++i)
+        covered += fillInternalAverages(n->ch[i], W, H, sum);
+    if (covered > 0)
+        n->avg = Color{(uint8_t)(sum[0] / covered), (uint8_t)(sum[1] / covered), (uint8_t)(sum[2] / covered)};
+    if (acc)
+        for (int c = 0; c < 3; ++c)
+            acc[c] += sum[c];
+    return covered;
+}
+
+inline void destroy(Node *n)
+{
+    if (!n)
+        return;
+    if (!n->leaf)
+        for (int i = 0; i < 4; ++i)
+            destroy(n->ch[i]);
+    delete n;
+}
+
+// -------- Rasterize quadtree to buffer --------
+// Fills n pixels with c. The 3-byte period repeats every 48 bytes, so the
+// row is written as whole 48-byte blocks (three 16-byte stores) plus a tail
+// instead of one 3-byte store per pixel.
+inline void fillSpanRGB(Color *dst, size_t n, Color c)
+{
+    if (n < 16)
+    {
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = c;
+        return;
+    }
+    alignas(16) Color pat[16];
+    for (int i = 0; i < 16; ++i)
+        pat[i] = c;
+    uint8_t *d = reinterpret_cast<uint8_t *>(dst);
+    const size_t blocks = n / 16;
+    for (size_t b = 0; b < blocks; ++b, d += sizeof(pat))
+        std::memcpy(d, pat, sizeof(pat));
+    std::memcpy(d, pat, (n % 16) * sizeof(Color));
+}
+
+// Rectangles at least this large are replicated with streaming stores:
+// they would evict the whole cache anyway, and skipping the read-for-ownership
+// makes the fill memory-bandwidth bound.
+constexpr size_t QT_STREAM_FILL_BYTES = 256u << 10;
+
+inline void copyRowStream(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    const size_t head = std::min(bytes, (size_t)((16 - ((uintptr_t)dst & 15)) & 15));
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    bytes -= head;
+    for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+        const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), e);
+    }
+#endif
+    std::memcpy(dst, src, bytes);
+}
+
+// Fills the part of (x, y, w, h) that lies inside columns [0, W) and rows [yLo, yHi).
+// Only the first row is filled pixel-wise; the others are copies of it. buf
+// holds rows from bufY0 on (0 for a full raster, yLo for a strip buffer).
+// streamLarge = false keeps large rectangles in the cache too, for buffers
+// that are read back right away (strips handed to an encoder).
+inline void blitRectBand(Color *buf, int W, int yLo, int yHi, int x, int y, int w, int h, Color c, int bufY0 = 0,
+                         bool streamLarge = true)
+{
+    int x0 = std::max(0, x), y0 = std::max(yLo, y);
+    int x1 = std::min(W, x + w), y1 = std::min(yHi, y + h);
+    if (x1 <= x0 || y1 <= y0)
+        return;
+    const size_t span = (size_t)(x1 - x0);
+    const Color *first = &buf[(size_t)(y0 - bufY0) * W + x0];
+    fillSpanRGB(&buf[(size_t)(y0 - bufY0) * W + x0], span, c);
+
+    const size_t rowBytes = span * sizeof(Color);
+    const bool stream = streamLarge && rowBytes * (size_t)(y1 - y0) >= QT_STREAM_FILL_BYTES;
+    for (int j = y0 + 1; j < y1; ++j)
+    {
+        uint8_t *row = reinterpret_cast<uint8_t *>(&buf[(size_t)(j - bufY0) * W + x0]);
+        if (stream)
+            copyRowStream(row, reinterpret_cast<const uint8_t *>(first), rowBytes);
+        else
+            std::memcpy(row, first, rowBytes);
+    }
+#if defined(__SSE2__) || defined(_M_X64)
+    if (stream)
+        _mm_sfence(); // make the streamed rows visible before the raster is handed on
+#endif
+}
+
+inline void blitRect(std::vector<Color> &buf, int W, int H, int x, int y, int w, int h, Color c)
+{
+    blitRectBand(buf.data(), W, 0, H, x, y, w, h, c);
+}
+
+// Calls paint(leaf) for every leaf under n, for trees of any node type.
+template <class NodeT, class Paint>
+inline void forEachLeaf(const NodeT *n, Paint &&paint)
+{
+    if (!n)
+        return;
+    if (n->leaf)
+    {
+        paint(n);
+        return;
+    }
+    for (int i = 0; i < 4; ++i)
+        forEachLeaf(n->ch[i], paint);
+}
+
+inline void rasterizeQT(const Node *n, int W, int H, std::vector<Color> &out)
+{
+    forEachLeaf(n, [&](const Node *l) { blitRect(out, W, H, l->x, l->y, l->w, l->h, l->avg); });
+}
@@ -0,0 +1,43 @@
+// raster.h
+// Parallel rasterization. The output is cut into horizontal bands; each
+// worker walks only the subtrees that intersect its band and clips leaves to
+// it. Leaves are disjoint and bands never overlap, so no locking is needed.
+#pragma once
+
+#include "parallel.h"
+#include "spill.h"
+
+// Rows [y0, y1) of the raster. Spilled subtrees come from `pager`. `out`
+// holds rows from outY0 on, so a strip buffer of y1 - y0 rows can be filled
+// with outY0 = y0. `tops`, when given, is cleared at every row of the band
+// where a leaf starts: the other rows repeat the row above. Streaming stores
+// are only used when asked for (a full raster that is not read back at once).
+inline void rasterizeQTBand(const Node *root, int W, int y0, int y1, Color *out, SpillPager *pager,
+                            int outY0 = 0, uint8_t *tops = nullptr, bool streamLarge = false)
+{
+    forEachLeafInBand(root, y0, y1, pager, [&](const Node *n)
+                      {
+        blitRectBand(out, W, y0, y1, n->x, n->y, n->w, n->h, n->avg, outY0, streamLarge);
+        if (tops && n->y >= y0)
+            tops[n->y] = 0; });
+}
+
+// Rasterizes into a W*H buffer using `threads` workers (0 = all cores).
+// `tops` (H flags, set to 1) is cleared on rows where a leaf starts.
+inline void rasterizeQTParallel(const Node *root, int W, int H, Color *out,
+                                const SpillStore *store = nullptr, int threads = 0, uint8_t *tops = nullptr)
+{
+    if (!root || W <= 0 || H <= 0)
+        return;
+    const unsigned nt = workerCount(threads);
+    // a few bands per worker keeps them busy when subtrees are uneven
+    const int bands = (int)std::min<size_t>((size_t)H, (size_t)nt * 4);
+    const int bandH = (H + bands - 1) / bands;
+    SpillPager pager(store, H);
+    parallelFor((size_t)bands, (int)nt, [&](size_t b)
+                {
+        const int y0 = (int)b * bandH;
+        const int y1 = std::min(H, y0 + bandH);
+        if (y0 < y1)
+            rasterizeQTBand(root, W, y0, y1, out, store ? &pager : nullptr, 0, tops, true); });
+}
@@ -0,0 +1,136 @@
+// raster_cache.h
+// One rasterization of the current tree, shared by PNG save, size
+// measurement, texture upload and quality metrics. The raster is produced on
+// first use after a rebuild and dropped by invalidate(); the W*H buffers go
+// back to a small pool instead of being freed, and are never zero-filled
+// (the leaves of a tree cover every pixel of the image).
+#pragma once
+
+#include "raster.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+struct RasterBuffer
+{
+    std::unique_ptr<Color[]> px;
+    size_t capacity = 0; // in pixels
+};
+
+struct RasterPool
+{
+    size_t maxPooled = 2;
+    std::vector<RasterBuffer> pooled;
+    std::mutex m;
+    size_t allocations = 0; // fresh allocations (for the stats panel)
+
+    RasterBuffer acquire(size_t pixels)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            for (size_t i = 0; i < pooled.size(); ++i)
+                if (pooled[i].capacity >= pixels)
+                {
+                    RasterBuffer b = std::move(pooled[i]);
+                    pooled.erase(pooled.begin() + (std::ptrdiff_t)i);
+                    return b;
+                }
+            allocations++;
+        }
+        RasterBuffer b;
+        b.px.reset(new Color[pixels]); // default-init: no zeroing pass
+        b.capacity = pixels;
+        return b;
+    }
+
+    void release(RasterBuffer &&b)
+    {
+        if (!b.px)
+            return;
+        std::lock_guard<std::mutex> lk(m);
+        if (pooled.size() >= maxPooled)
+        {
+            // keep the largest buffers; they are the expensive ones to refault
+            auto smallest = std::min_element(pooled.begin(), pooled.end(),
+                                             [](const RasterBuffer &a, const RasterBuffer &c)
+                                             { return a.capacity < c.capacity; });
+            if (smallest->capacity >= b.capacity)
+                return;
+            *smallest = std::move(b);
+            return;
+        }
+        pooled.push_back(std::move(b));
+    }
+};
+
+struct RasterCache
+{
+    RasterPool *pool = nullptr;
+    RasterBuffer buf;
+    const Node *root = nullptr; // tree the pixels belong to
+    int W = 0, H = 0;
+    bool valid = false;
+    // per row: 1 if it repeats the row above by the leaf layout (the PNG
+    // encoder's repeatRows); empty once repaint() has made it stale
+    std::vector<uint8_t> repeat;
+    uint64_t generation = 0; // bumped on every invalidate (texture uploads key on it)
+    double lastMs = 0;       // time of the last rasterization
+
+    explicit RasterCache(RasterPool *p) : pool(p) {}
+    RasterCache(const RasterCache &) = delete;
+    RasterCache &operator=(const RasterCache &) = delete;
+    ~RasterCache() { invalidate(); }
+
+    void invalidate()
+    {
+        if (buf.px)
+            pool->release(std::move(buf));
+        buf = RasterBuffer{};
+        root = nullptr;
+        valid = false;
+        repeat.clear();
+        generation++;
+    }
+
+    // Rasterizes on first use; later calls for the same tree and size return
+    // the same pixels until invalidate(). A tree edited in place keeps its
+    // root, so it still needs invalidate() (or repaint()).
+    const Color *get(const Node *tree, int w, int h, const SpillStore *store = nullptr, int threads = 0)
+    {
+        if (valid && tree == root && w == W && h == H)
+            return buf.px.get();
+        if (!tree || w <= 0 || h <= 0)
+            return nullptr;
+        const size_t n = (size_t)w * h;
+        if (!buf.px || buf.capacity < n)
+        {
+            pool->release(std::move(buf));
+            buf = pool->acquire(n);
+        }
+        root = tree;
+        W = w;
+        H = h;
+        repeat.assign((size_t)H, 1);
+        repeat[0] = 0;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        rasterizeQTParallel(root, W, H, buf.px.get(), store, threads, repeat.data());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        lastMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        valid = true;
+        return buf.px.get();
+    }
+
+    // Paints the given leaves over the cached raster, for trees updated in
+    // place (IncrementalTree's TreeDelta::added), instead of dropping it.
+    void repaint(const std::vector<const Node *> &leaves)
+    {
+        if (!valid)
+            return;
+        for (const Node *n : leaves)
+            blitRectBand(buf.px.get(), W, 0, H, n->x, n->y, n->w, n->h, n->avg);
+        repeat.clear(); // leaves that went away may have started rows
+        generation++;
+    }
+};
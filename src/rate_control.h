@@ -0,0 +1,306 @@
+// rate_control.h
+// Picks the StdDev threshold (and optionally the leaf size) that meets a byte
+// budget or a PSNR floor. The image is analysed once into the finest tree
+// (leaf 1, threshold 0) stored flat with each node's StdDev and the squared
+// error it would have as a leaf; every tree buildQT can produce is a cut of
+// it. A probe walks one cut and sums its node/leaf counts and error, so the
+// search costs a few tree walks instead of a build and an encode per step.
+//
+// Byte budgets are in native tree bytes (qtcBytes: the .qtc file), which the
+// counts give exactly. Other outputs (PNG, QOI, .qti, .qtp) are not a
+// function of the counts: fitEncoded() starts from the threshold the model
+// picked and encodes a few real candidates until the file fits. PSNR is over
+// the RGB samples of the rendered tree against the source.
+#pragma once
+
+#include "metrics.h"
+#include "qtc_format.h"
+
+#include <chrono>
+
+enum RateTargetKind
+{
+    RATE_OFF,
+    RATE_BYTES, // at most value bytes
+    RATE_PSNR,  // at least value dB
+};
+
+struct RateTarget
+{
+    int kind = RATE_OFF;
+    double value = 0;
+    bool searchLeaf = false; // also try leaf sizes 2^0..2^8 (else keep minLeaf)
+    int minLeaf = 1;
+};
+
+struct RateResult
+{
+    bool met = false;
+    double sdThresh = 0;
+    int minLeaf = 1;
+    size_t nodes = 0, leaves = 0, bytes = 0;
+    double psnr = 0;
+    int probes = 0;
+    size_t fileBytes = 0; // encoded output size, when fitEncoded checked it
+    int encodes = 0;
+    double analyseMs = 0, searchMs = 0;
+};
+
+struct RateModel
+{
+    struct Entry
+    {
+        double sd;       // StdDev the builder compares with the threshold
+        double sse;      // error of the block as one leaf
+        uint32_t first;  // first child entry (children are contiguous)
+        uint8_t count;   // children; 0 = leaf of the finest tree
+        int minSide;     // min(w, h), for the leaf size test
+    };
+
+    int W = 0, H = 0;
+    std::vector<Entry> entries; // preorder-ish: root first, each node's children together
+    std::vector<double> cuts;   // distinct thresholds at which the tree changes (ascending)
+    double ms = 0;
+
+    bool empty() const { return entries.empty(); }
+    void clear()
+    {
+        entries.clear();
+        cuts.clear();
+        W = H = 0;
+    }
+
+    void analyse(const ImageView &px)
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        clear();
+        W = px.W;
+        H = px.H;
+        if (W <= 0 || H <= 0)
+            return;
+        entries.push_back(Entry{});
+        add(px, 0, 0, 0, W, H);
+        for (const Entry &e : entries)
+            if (e.count)
+                cuts.push_back(e.sd);
+        cuts.push_back(0.0);
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    }
+
+    // The tree buildQT(px, minLeaf, sdThresh) would give, summarized.
+    void probe(double sdThresh, int minLeaf, size_t &nodes, size_t &leaves, double &sse) const
+    {
+        nodes = leaves = 0;
+        sse = 0;
+        if (!entries.empty())
+            walk(0, sdThresh, minLeaf, nodes, leaves, sse);
+    }
+
+    RateResult search(const RateTarget &t) const
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        RateResult best;
+        best.analyseMs = ms;
+        if (entries.empty() || t.kind == RATE_OFF)
+            return best;
+        int probes = 0;
+        bool have = false;
+        for (int k = 0; k <= 8; ++k)
+        {
+            const int leaf = t.searchLeaf ? 1 << k : std::max(1, t.minLeaf);
+            RateResult r = searchThreshold(t, leaf, probes);
+            // among the settings that meet the target: best PSNR under a budget,
+            // fewest bytes above a PSNR floor
+            const bool better = !have || (r.met && !best.met) ||
+                                (r.met == best.met &&
+                                 (t.kind == RATE_BYTES ? (r.met ? r.psnr > best.psnr : r.bytes < best.bytes)
+                                                       : (r.met ? r.bytes < best.bytes : r.psnr > best.psnr)));
+            if (better)
+                best = r;
+            have = true;
+            if (!t.searchLeaf)
+                break;
+        }
+        best.probes = probes;
+        best.analyseMs = ms;
+        best.searchMs =
+            std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        return best;
+    }
+
+    // For a byte budget on an encoded output: encodedBytes(sdThresh, minLeaf)
+    // builds the tree and returns its file size. Starting at the cut of
+    // `start`, each step scales the tree-byte target by the last file/tree
+    // ratio and asks the model for the next cut, kept inside the bracket of
+    // cuts known to fit and not to fit so the bracket shrinks by a quarter at
+    // least. Stops on a fitting file within 1% of the budget, on a bracket of
+    // neighbouring cuts, or after maxEncodes. Only a file seen to fit is met.
+    template <class Encode>
+    RateResult fitEncoded(const RateTarget &t, const RateResult &start, Encode &&encodedBytes,
+                          int maxEncodes = 12) const
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        if (entries.empty() || t.kind != RATE_BYTES)
+            return start;
+        const int leaf = start.minLeaf;
+        int probes = start.probes, encodes = 0;
+        const long last = (long)cuts.size() - 1;
+        auto indexOf = [&](double sd)
+        { return std::min(last, (long)(std::lower_bound(cuts.begin(), cuts.end(), sd) - cuts.begin())); };
+        // a higher index is a coarser tree: good fits, bad does not
+        long good = -1, bad = -1, cur = indexOf(start.sdThresh);
+        size_t goodBytes = 0, badBytes = 0;
+        while (encodes < maxEncodes)
+        {
+            const size_t bytes = encodedBytes(cuts[cur], leaf);
+            encodes++;
+            const bool fits = bytes && (double)bytes <= t.value;
+            if (fits && (good < 0 || cur < good))
+            {
+                good = cur;
+                goodBytes = bytes;
+            }
+            else if (!fits && cur > bad)
+            {
+                bad = cur;
+                badBytes = bytes;
+            }
+            if ((fits && (double)bytes >= 0.99 * t.value) || (fits && cur == 0) || (!fits && cur == last) ||
+                (good >= 0 && good - bad <= 1))
+                break;
+            // the cut the model picks for the budget scaled by this file's ratio
+            RateTarget scaled = t;
+            if (bytes)
+                scaled.value = t.value * (double)evaluate(cuts[cur], leaf, probes).bytes / (double)bytes;
+            long next = indexOf(searchThreshold(scaled, leaf, probes).sdThresh);
+            const long lo = bad + 1, hi = good < 0 ? last : good - 1;
+            const long margin = good >= 0 && bad >= 0 ? (good - bad) / 4 : 0;
+            next = std::clamp(next, lo + margin, hi - margin);
+            if (next == cur) // the model repeats itself: step past it
+                next = fits ? std::max(lo, cur - 1) : std::min(hi, cur + 1);
+            cur = next;
+        }
+        RateResult r = evaluate(cuts[good >= 0 ? good : bad], leaf, probes);
+        r.met = good >= 0;
+        r.fileBytes = good >= 0 ? goodBytes : badBytes;
+        r.probes = probes;
+        r.encodes = encodes;
+        r.analyseMs = ms;
+        r.searchMs = start.searchMs + std::chrono::duration<double, std::milli>(
+                                          std::chrono::high_resolution_clock::now() - t0)
+                                          .count();
+        return r;
+    }
+
+private:
+    // Stats of (x, y, w, h) from its children, mirroring buildQT at leaf 1 and
+    // threshold 0; the entry at index i is filled in.
+    BlockStats add(const ImageView &px, size_t i, int x, int y, int w, int h)
+    {
+        BlockStats st;
+        Entry e{};
+        e.minSide = std::min(w, h);
+        if (w <= 1 || h <= 1)
+            st = blockStats(px, x, y, w, h);
+        else
+        {
+            int r[4][4];
+            childRects(x, y, w, h, r);
+            const size_t first = entries.size();
+            uint8_t count = 0;
+            for (int c = 0; c < 4; ++c)
+                if (rectInImage(W, H, r[c][0], r[c][1], r[c][2], r[c][3]))
+                    count++;
+            entries.resize(first + count);
+            size_t slot = first;
+            for (int c = 0; c < 4; ++c)
+                if (rectInImage(W, H, r[c][0], r[c][1], r[c][2], r[c][3]))
+                    st.add(add(px, slot++, r[c][0], r[c][1], r[c][2], r[c][3]));
+            if (st.stdDev() > 0)
+            {
+                e.first = (uint32_t)first;
+                e.count = count;
+            }
+            else
+                entries.resize(first); // flat: a leaf at every threshold
+        }
+        e.sd = st.stdDev();
+        e.sse = st.sse();
+        entries[i] = e;
+        return st;
+    }
+
+    void walk(size_t i, double sdThresh, int minLeaf, size_t &nodes, size_t &leaves, double &sse) const
+    {
+        const Entry &e = entries[i];
+        nodes++;
+        if (e.count == 0 || e.minSide <= minLeaf || e.sd <= sdThresh)
+        {
+            leaves++;
+            sse += e.sse;
+            return;
+        }
+        for (uint32_t c = 0; c < e.count; ++c)
+            walk(e.first + c, sdThresh, minLeaf, nodes, leaves, sse);
+    }
+
+    RateResult evaluate(double sdThresh, int minLeaf, int &probes) const
+    {
+        RateResult r;
+        r.sdThresh = sdThresh;
+        r.minLeaf = minLeaf;
+        double sse = 0;
+        probe(sdThresh, minLeaf, r.nodes, r.leaves, sse);
+        r.bytes = qtcBytes(r.nodes, r.leaves);
+        r.psnr = psnrFromSSE(sse, 3.0 * W * H);
+        probes++;
+        return r;
+    }
+
+    bool meets(const RateTarget &t, const RateResult &r) const
+    {
+        return t.kind == RATE_BYTES ? (double)r.bytes <= t.value : r.psnr >= t.value;
+    }
+
+    // Bytes and quality both fall as the threshold rises, so a binary search
+    // over the thresholds where the cut changes finds the finest tree within a
+    // byte budget, or the coarsest one above a PSNR floor.
+    RateResult searchThreshold(const RateTarget &t, int minLeaf, int &probes) const
+    {
+        size_t lo = 0, hi = cuts.size() - 1;
+        if (t.kind == RATE_BYTES)
+        {
+            RateResult r = evaluate(cuts[hi], minLeaf, probes);
+            if (!meets(t, r))
+                return r; // even the coarsest cut is over budget
+            while (lo < hi)
+            {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (meets(t, evaluate(cuts[mid], minLeaf, probes)))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+        }
+        else
+        {
+            RateResult r = evaluate(cuts[lo], minLeaf, probes);
+            if (!meets(t, r))
+                return r; // even the finest cut misses the floor
+            while (lo < hi)
+            {
+                const size_t mid = hi - (hi - lo) / 2;
+                if (meets(t, evaluate(cuts[mid], minLeaf, probes)))
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+        }
+        RateResult r = evaluate(cuts[lo], minLeaf, probes);
+        r.met = meets(t, r);
+        return r;
+    }
+};
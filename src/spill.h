@@ -0,0 +1,363 @@
+// spill.h
+// Out-of-core quadtrees. While building, completed subtrees rooted at
+// `spillDepth` are serialized (.qtc preorder, see qtc_format.h) to a scratch
+// file whenever the next subtree could push the resident nodes past the memory
+// ceiling. The subtree root stays in memory as a lightweight handle
+// (Node::spilled, no children, avg = subtree mean) and is paged back in on
+// demand by rasterization and export.
+#pragma once
+
+#include "qtc_format.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct SpillParams
+{
+    size_t memLimitBytes = 256u << 20; // resident Node budget
+    int spillDepth = 4;                // depth of the subtrees that get spilled
+};
+
+struct SpillStore
+{
+    struct Ref
+    {
+        uint64_t offset = 0;
+        size_t bytes = 0;
+        size_t nodes = 0, leaves = 0;
+    };
+
+    SpillParams params;
+    int W = 0, H = 0; // image bounds, needed to decode subtree geometry
+    FILE *file = nullptr;
+    uint64_t fileEnd = 0;
+    std::unordered_map<const Node *, Ref> refs;
+    size_t bytesSpilled = 0;
+    size_t nodesSpilled = 0; // nodes living only in the scratch file
+    std::vector<Node *> completed; // subtrees of the current build not spilled yet, oldest first
+    size_t nextToSpill = 0;
+    mutable std::mutex io;
+
+    SpillStore() = default;
+    SpillStore(const SpillStore &) = delete;
+    SpillStore &operator=(const SpillStore &) = delete;
+    ~SpillStore() { reset(); }
+
+    // Drops every handle and truncates the scratch file (tmpfile, removed on close).
+    void reset()
+    {
+        if (file)
+            std::fclose(file);
+        file = nullptr;
+        fileEnd = 0;
+        refs.clear();
+        bytesSpilled = 0;
+        nodesSpilled = 0;
+        completed.clear();
+        nextToSpill = 0;
+    }
+
+    bool active() const { return !refs.empty(); }
+
+    size_t residentBytes(const BuildStats &stats) const
+    {
+        return (stats.nodes - nodesSpilled) * sizeof(Node);
+    }
+
+    // Most nodes a build over a w x h block can allocate: every block splits
+    // down to minLeaf. Blocks of one level differ by at most a pixel per side,
+    // so each level has at most four distinct sizes.
+    static uint64_t worstCaseNodes(int w, int h, int minLeaf)
+    {
+        struct Blocks
+        {
+            int w, h;
+            uint64_t count;
+        };
+        std::vector<Blocks> level{{w, h, 1}}, next;
+        auto add = [&](int bw, int bh, uint64_t count)
+        {
+            for (Blocks &b : next)
+                if (b.w == bw && b.h == bh)
+                {
+                    b.count += count;
+                    return;
+                }
+            next.push_back(Blocks{bw, bh, count});
+        };
+        uint64_t nodes = 0;
+        while (!level.empty())
+        {
+            next.clear();
+            for (const Blocks &b : level)
+            {
+                nodes += b.count;
+                if (b.w <= minLeaf || b.h <= minLeaf || b.w / 2 == 0 || b.h / 2 == 0)
+                    continue;
+                add(b.w / 2, b.h / 2, b.count);
+                add(b.w - b.w / 2, b.h / 2, b.count);
+                add(b.w / 2, b.h - b.h / 2, b.count);
+                add(b.w - b.w / 2, b.h - b.h / 2, b.count);
+            }
+            level.swap(next);
+        }
+        return nodes;
+    }
+
+    // Spills completed subtrees until `incoming` more bytes fit under the ceiling.
+    void makeRoom(size_t incoming, const BuildStats &stats)
+    {
+        while (residentBytes(stats) + incoming > params.memLimitBytes && nextToSpill < completed.size())
+            spill(completed[nextToSpill++]);
+    }
+
+    // Serializes n's subtree to the scratch file and frees its children.
+    bool spill(Node *n)
+    {
+        if (!n || n->leaf || n->spilled)
+            return false;
+        if (!file && !(file = std::tmpfile()))
+            return false;
+        std::vector<uint8_t> bytes;
+        serializeQT(n, bytes);
+
+        Ref ref;
+        ref.offset = fileEnd;
+        ref.bytes = bytes.size();
+        countSubtree(n, ref.nodes, ref.leaves);
+        {
+            std::lock_guard<std::mutex> lk(io);
+            if (!seekFile(file, fileEnd) ||
+                std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size())
+                return false;
+        }
+        fileEnd += bytes.size();
+        bytesSpilled += bytes.size();
+        nodesSpilled += ref.nodes - 1; // the handle itself stays resident
+
+        // n->avg already is the subtree's block mean (makeNodeQT / fillInternalAverages)
+        for (int i = 0; i < 4; ++i)
+        {
+            destroy(n->ch[i]);
+            n->ch[i] = nullptr;
+        }
+        n->spilled = true;
+        refs[n] = ref;
+        return true;
+    }
+
+    // Pages a spilled subtree back in; the caller owns (and destroys) the copy.
+    Node *load(const Node *n) const
+    {
+        auto it = refs.find(n);
+        if (it == refs.end())
+            return nullptr;
+        std::vector<uint8_t> bytes;
+        if (!readBytes(it->second, bytes))
+            return nullptr;
+        const uint8_t *p = bytes.data();
+        return deserializeQT(p, p + bytes.size(), n->x, n->y, n->w, n->h, W, H);
+    }
+
+    // Raw preorder bytes of a spilled subtree (already in .qtc encoding).
+    bool readBytes(const Ref &ref, std::vector<uint8_t> &bytes) const
+    {
+        bytes.resize(ref.bytes);
+        std::lock_guard<std::mutex> lk(io);
+        return seekFile(file, ref.offset) &&
+               std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+    static void countSubtree(const Node *n, size_t &nodes, size_t &leaves)
+    {
+        if (!n)
+            return;
+        nodes++;
+        if (n->leaf)
+        {
+            leaves++;
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            countSubtree(n->ch[i], nodes, leaves);
+    }
+};
+
+// Same tree as buildQT. Subtrees are built whole from params.spillDepth down,
+// or deeper while a subtree's worst case exceeds a quarter of the ceiling.
+// Before each one is built, completed subtrees are spilled until its worst
+// case fits, so the resident nodes stay under params.memLimitBytes (save for
+// the levels above the spilled subtrees, which must stay resident).
+inline Node *buildQTOutOfCore(const ImageView &px,
+                              int x, int y, int w, int h,
+                              int minLeaf, double sdThresh,
+                              BuildStats &stats, SpillStore &store, int depth = 0)
+{
+    if (depth == 0)
+    {
+        store.W = px.W;
+        store.H = px.H;
+        store.completed.clear();
+        store.nextToSpill = 0;
+    }
+    if (depth >= store.params.spillDepth)
+    {
+        const uint64_t worst = SpillStore::worstCaseNodes(w, h, minLeaf) * sizeof(Node);
+        if (worst <= store.params.memLimitBytes / 4)
+        {
+            store.makeRoom((size_t)worst, stats);
+            Node *n = buildQT(px, x, y, w, h, minLeaf, sdThresh, stats);
+            store.completed.push_back(n);
+            return n;
+        }
+    }
+    Node *n = makeNodeQT(px, x, y, w, h, minLeaf, sdThresh, stats);
+    if (n->leaf)
+        return n;
+    int r[4][4];
+    childRects(x, y, w, h, r);
+    for (int i = 0; i < 4; ++i)
+        if (rectInImage(px.W, px.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            n->ch[i] = buildQTOutOfCore(px, r[i][0], r[i][1], r[i][2], r[i][3],
+                                        minLeaf, sdThresh, stats, store, depth + 1);
+    return n;
+}
+
+// Shares paged-in subtrees between the bands of one pass over the raster. A
+// subtree is loaded by the first band that reaches it, used by every band it
+// crosses, and freed once bands have covered all of its rows, so each one is
+// read and decoded once however the bands are cut or scheduled. Bands must
+// not overlap; a subtree needed again after it was freed is just reloaded.
+class SpillPager
+{
+public:
+    SpillPager(const SpillStore *store, int H) : store(store), H(H) {}
+
+    // The paged-in subtree behind a spilled handle (null if unreadable).
+    std::shared_ptr<const Node> acquire(const Node *handle)
+    {
+        std::shared_ptr<Entry> e;
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            auto &slot = entries[handle];
+            if (!slot)
+            {
+                slot = std::make_shared<Entry>();
+                slot->rowsLeft = std::min(H, handle->y + handle->h) - std::max(0, handle->y);
+            }
+            e = slot;
+        }
+        std::lock_guard<std::mutex> lk(e->load);
+        if (!e->loaded)
+        {
+            e->tree = std::shared_ptr<const Node>(store->load(handle), [](const Node *n)
+                                                  { destroy(const_cast<Node *>(n)); });
+            e->loaded = true;
+        }
+        return e->tree;
+    }
+
+    // Rows [y0, y1) of the handle are done; the subtree goes after its last row.
+    void release(const Node *handle, int y0, int y1)
+    {
+        const int rows = std::min(y1, handle->y + handle->h) - std::max(y0, handle->y);
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = entries.find(handle);
+        if (it != entries.end() && (it->second->rowsLeft -= rows) <= 0)
+            entries.erase(it); // bands still drawing it hold their own reference
+    }
+
+private:
+    struct Entry
+    {
+        std::mutex load;
+        bool loaded = false;
+        std::shared_ptr<const Node> tree;
+        int rowsLeft = 0;
+    };
+    const SpillStore *store;
+    int H;
+    std::mutex lock;
+    std::unordered_map<const Node *, std::shared_ptr<Entry>> entries;
+};
+
+// Calls fn(n) for every leaf crossing rows [y0, y1), paging spilled subtrees
+// in through `pager`. Without one, spilled handles count as leaves (their mean).
+template <class Fn>
+inline void forEachLeafInBand(const Node *n, int y0, int y1, SpillPager *pager, Fn &&fn)
+{
+    if (!n || n->y >= y1 || n->y + n->h <= y0)
+        return;
+    if (n->spilled && pager)
+    {
+        const std::shared_ptr<const Node> sub = pager->acquire(n);
+        forEachLeafInBand(sub.get(), y0, y1, nullptr, fn);
+        pager->release(n, y0, y1);
+        return;
+    }
+    if (n->leaf || n->spilled)
+    {
+        fn(n);
+        return;
+    }
+    for (int i = 0; i < 4; ++i)
+        forEachLeafInBand(n->ch[i], y0, y1, pager, fn);
+}
+
+// rasterizeQT that pages spilled subtrees in one at a time.
+inline void rasterizeQT(const Node *n, int W, int H, std::vector<Color> &out, const SpillStore *store)
+{
+    if (!n)
+        return;
+    if (n->spilled && store)
+    {
+        Node *sub = store->load(n);
+        rasterizeQT(sub, W, H, out);
+        destroy(sub);
+        return;
+    }
+    if (n->leaf || n->spilled)
+    {
+        blitRect(out, W, H, n->x, n->y, n->w, n->h, n->avg);
+        return;
+    }
+    for (int i = 0; i < 4; ++i)
+        rasterizeQT(n->ch[i], W, H, out, store);
+}
+
+// serializeQT that splices spilled subtrees straight from the scratch file.
+inline bool serializeQT(const Node *n, std::vector<uint8_t> &out, const SpillStore *store)
+{
+    if (!n)
+        return true;
+    if (n->spilled && store)
+    {
+        auto it = store->refs.find(n);
+        std::vector<uint8_t> bytes;
+        if (it == store->refs.end() || !store->readBytes(it->second, bytes))
+            return false;
+        out.insert(out.end(), bytes.begin(), bytes.end());
+        return true;
+    }
+    if (n->leaf)
+    {
+        serializeQT(n, out);
+        return true;
+    }
+    out.push_back(QTC_INTERNAL);
+    for (int i = 0; i < 4; ++i)
+        if (!serializeQT(n->ch[i], out, store))
+            return false;
+    return true;
+}
+
+inline bool saveQtc(const std::string &path, const Node *root, int W, int H, const SpillStore *store)
+{
+    if (!root)
+        return false;
+    std::vector<uint8_t> bytes;
+    writeQtcHeader(bytes, QtcHeader{(uint32_t)W, (uint32_t)H, (uint32_t)root->w, (uint32_t)root->h});
+    return serializeQT(root, bytes, store) && writeFileBytes(path, bytes);
+}
@@ -0,0 +1,292 @@
+// split_criteria.h
+// Alternative split tests for the threshold builder. Summed-area tables of
+// the quantities a criterion needs are computed once per image, so every
+// node's statistics, and with them its split test, cost O(1) instead of a
+// pass over its pixels. The criterion is a template parameter of the
+// builder: the recursion is compiled once per criterion, with no indirect
+// call per node.
+//
+// Every criterion returns a value in 8-bit levels that is compared with the
+// same StdDev threshold:
+//   mean   mean of the R, G, B standard deviations (the buildQT rule)
+//   luma   standard deviation of luma
+//   max    largest of the R, G, B standard deviations
+//   ycbcr  sqrt(0.6 var Y + 0.2 var Cb + 0.2 var Cr): chroma counts less,
+//          as the eye resolves it more coarsely
+//   edge   the block's luma steps between neighbouring pixels, summed and
+//          divided by half its perimeter: the height of one edge crossing
+//          the block, so an edge or texture of any size splits while flat
+//          blocks stay whole
+#pragma once
+
+#include "parallel.h"
+#include "quadtree.h"
+
+#include <cstring>
+
+enum SplitCriterionKind
+{
+    SPLIT_MEAN,
+    SPLIT_LUMA,
+    SPLIT_MAX,
+    SPLIT_YCBCR,
+    SPLIT_EDGE,
+};
+
+inline const char *splitCriterionName(int k)
+{
+    static const char *names[] = {"mean", "luma", "max", "ycbcr", "edge"};
+    return k >= 0 && k <= SPLIT_EDGE ? names[k] : "?";
+}
+
+inline bool parseSplitCriterion(const char *s, int &out)
+{
+    for (int k = SPLIT_MEAN; k <= SPLIT_EDGE; ++k)
+        if (std::strcmp(s, splitCriterionName(k)) == 0)
+        {
+            out = k;
+            return true;
+        }
+    return false;
+}
+
+// Planes a criterion can ask for, beyond the R, G, B sums and squares that
+// every build uses for leaf colors and error.
+enum SplitPlanes : unsigned
+{
+    PLANES_LUMA = 1u << 0,   // Y, Y^2
+    PLANES_CHROMA = 1u << 1, // Cb, Cb^2, Cr, Cr^2
+    PLANES_EDGE = 1u << 2,   // |dY| across x, |dY| across y
+};
+
+struct SplitSums
+{
+    enum Plane
+    {
+        SUM_R, SUM_G, SUM_B, SQ_R, SQ_G, SQ_B,
+        Y, Y2, CB, CB2, CR, CR2,
+        GX, GY,
+        PLANE_COUNT
+    };
+
+    int W = 0, H = 0;
+    unsigned planes = 0; // SplitPlanes held
+    std::vector<uint64_t> sat[PLANE_COUNT]; // (W + 1) x (H + 1), empty when not needed
+
+    static int luma(const Color &c) { return (77 * c.r + 150 * c.g + 29 * c.b + 128) >> 8; }
+    static int cb(const Color &c) { return ((-43 * c.r - 85 * c.g + 128 * c.b + 128) >> 8) + 128; }
+    static int cr(const Color &c) { return ((128 * c.r - 107 * c.g - 21 * c.b + 128) >> 8) + 128; }
+
+    void build(const ImageView &px, unsigned planes, int threads = 0)
+    {
+        W = px.W;
+        H = px.H;
+        this->planes = planes;
+        std::vector<int> want{SUM_R, SUM_G, SUM_B, SQ_R, SQ_G, SQ_B};
+        if (planes & PLANES_LUMA)
+            want.insert(want.end(), {Y, Y2});
+        if (planes & PLANES_CHROMA)
+            want.insert(want.end(), {CB, CB2, CR, CR2});
+        if (planes & PLANES_EDGE)
+            want.insert(want.end(), {GX, GY});
+        for (auto &s : sat)
+            s.clear();
+        parallelFor(want.size(), threads, [&](size_t i) { fill(px, want[i]); });
+    }
+
+    bool holds(const ImageView &px, unsigned need) const
+    {
+        return W == px.W && H == px.H && !sat[SUM_R].empty() && (planes & need) == need;
+    }
+
+    // Sum of a plane over the rectangle (clipped to the image).
+    uint64_t rect(int p, int x0, int y0, int x1, int y1) const
+    {
+        const uint64_t *s = sat[p].data();
+        const size_t st = (size_t)W + 1;
+        return s[(size_t)y1 * st + x1] - s[(size_t)y0 * st + x1] - s[(size_t)y1 * st + x0] + s[(size_t)y0 * st + x0];
+    }
+
+    // The same BlockStats as blockStats(px, x, y, w, h), in O(1).
+    BlockStats block(int x0, int y0, int x1, int y1) const
+    {
+        BlockStats s;
+        s.n = (uint64_t)(x1 - x0) * (y1 - y0);
+        for (int c = 0; c < 3; ++c)
+        {
+            s.sum[c] = rect(SUM_R + c, x0, y0, x1, y1);
+            s.sq[c] = rect(SQ_R + c, x0, y0, x1, y1);
+        }
+        return s;
+    }
+
+    // Variance of a plane whose squares are in the next plane.
+    double variance(int p, int x0, int y0, int x1, int y1, double n) const
+    {
+        const double m = (double)rect(p, x0, y0, x1, y1) / n;
+        return clamp0((double)rect(p + 1, x0, y0, x1, y1) / n - m * m);
+    }
+
+private:
+    void fill(const ImageView &px, int p)
+    {
+        // a step belongs to the pixel on its left / top, so a block's own
+        // steps are those of all but its last column / row
+        switch (p)
+        {
+        case SUM_R: return fillWith(px, p, [](const Color *r, int i) { return r[i].r; });
+        case SUM_G: return fillWith(px, p, [](const Color *r, int i) { return r[i].g; });
+        case SUM_B: return fillWith(px, p, [](const Color *r, int i) { return r[i].b; });
+        case SQ_R: return fillWith(px, p, [](const Color *r, int i) { return r[i].r * r[i].r; });
+        case SQ_G: return fillWith(px, p, [](const Color *r, int i) { return r[i].g * r[i].g; });
+        case SQ_B: return fillWith(px, p, [](const Color *r, int i) { return r[i].b * r[i].b; });
+        case Y: return fillWith(px, p, [](const Color *r, int i) { return luma(r[i]); });
+        case Y2: return fillWith(px, p, [](const Color *r, int i) { return luma(r[i]) * luma(r[i]); });
+        case CB: return fillWith(px, p, [](const Color *r, int i) { return cb(r[i]); });
+        case CB2: return fillWith(px, p, [](const Color *r, int i) { return cb(r[i]) * cb(r[i]); });
+        case CR: return fillWith(px, p, [](const Color *r, int i) { return cr(r[i]); });
+        case CR2: return fillWith(px, p, [](const Color *r, int i) { return cr(r[i]) * cr(r[i]); });
+        case GX:
+            return fillWith(px, p, [&](const Color *r, int i)
+                            { return i + 1 < W ? std::abs(luma(r[i + 1]) - luma(r[i])) : 0; });
+        case GY:
+            return fillWith(px, p, [&](const Color *r, int i)
+                            {
+                const Color *below = r + px.stride / sizeof(Color);
+                return r != px[H - 1] ? std::abs(luma(below[i]) - luma(r[i])) : 0; });
+        }
+    }
+
+    template <class Sample>
+    void fillWith(const ImageView &px, int p, Sample &&sample)
+    {
+        const size_t st = (size_t)W + 1;
+        std::vector<uint64_t> &s = sat[p];
+        s.assign(st * (H + 1), 0);
+        for (int j = 0; j < H; ++j)
+        {
+            const Color *row = px[j];
+            const uint64_t *above = &s[(size_t)j * st];
+            uint64_t *cur = &s[(size_t)(j + 1) * st];
+            uint64_t run = 0;
+            for (int i = 0; i < W; ++i)
+            {
+                run += (uint64_t)sample(row, i);
+                cur[i + 1] = above[i + 1] + run;
+            }
+        }
+    }
+};
+
+// ---------------- Criteria ----------------
+// Each has `planes` (what SplitSums must hold) and eval(), O(1) per node.
+struct SplitMean
+{
+    static constexpr unsigned planes = 0;
+    static double eval(const SplitSums &, const BlockStats &bs, int, int, int, int) { return bs.stdDev(); }
+};
+
+struct SplitLuma
+{
+    static constexpr unsigned planes = PLANES_LUMA;
+    static double eval(const SplitSums &s, const BlockStats &bs, int x0, int y0, int x1, int y1)
+    {
+        return std::sqrt(s.variance(SplitSums::Y, x0, y0, x1, y1, (double)bs.n));
+    }
+};
+
+struct SplitMax
+{
+    static constexpr unsigned planes = 0;
+    static double eval(const SplitSums &, const BlockStats &bs, int, int, int, int)
+    {
+        double v = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            const double m = (double)bs.sum[c] / bs.n;
+            v = std::max(v, (double)bs.sq[c] / bs.n - m * m);
+        }
+        return std::sqrt(clamp0(v));
+    }
+};
+
+struct SplitYCbCr
+{
+    static constexpr unsigned planes = PLANES_LUMA | PLANES_CHROMA;
+    static double eval(const SplitSums &s, const BlockStats &bs, int x0, int y0, int x1, int y1)
+    {
+        const double n = (double)bs.n;
+        return std::sqrt(0.6 * s.variance(SplitSums::Y, x0, y0, x1, y1, n) +
+                         0.2 * s.variance(SplitSums::CB, x0, y0, x1, y1, n) +
+                         0.2 * s.variance(SplitSums::CR, x0, y0, x1, y1, n));
+    }
+};
+
+struct SplitEdge
+{
+    static constexpr unsigned planes = PLANES_EDGE;
+    static double eval(const SplitSums &s, const BlockStats &, int x0, int y0, int x1, int y1)
+    {
+        const double steps = (double)(s.rect(SplitSums::GX, x0, y0, x1 - 1, y1) +
+                                      s.rect(SplitSums::GY, x0, y0, x1, y1 - 1));
+        return 2.0 * steps / ((x1 - x0) + (y1 - y0));
+    }
+};
+
+// buildQT with the split test of Criterion; sums must hold Criterion::planes.
+template <class Criterion>
+inline Node *buildQTCriterion(const SplitSums &sums, int x, int y, int w, int h, int minLeaf, double sdThresh,
+                              BuildStats &stats)
+{
+    Node *n = new Node();
+    n->x = x;
+    n->y = y;
+    n->w = w;
+    n->h = h;
+    stats.nodes++;
+    const int x0 = std::max(0, x), y0 = std::max(0, y);
+    const int x1 = std::min(sums.W, x + w), y1 = std::min(sums.H, y + h);
+    const BlockStats bs = sums.block(x0, y0, x1, y1);
+    n->avg = bs.mean();
+    if (w <= minLeaf || h <= minLeaf || w / 2 == 0 || h / 2 == 0 ||
+        Criterion::eval(sums, bs, x0, y0, x1, y1) <= sdThresh)
+    {
+        n->leaf = true;
+        stats.leaves++;
+        stats.addLeafError(bs);
+        return n;
+    }
+    int r[4][4];
+    childRects(x, y, w, h, r);
+    for (int i = 0; i < 4; ++i)
+        if (rectInImage(sums.W, sums.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+            n->ch[i] = buildQTCriterion<Criterion>(sums, r[i][0], r[i][1], r[i][2], r[i][3], minLeaf, sdThresh,
+                                                   stats);
+    return n;
+}
+
+inline unsigned splitPlanes(int criterion)
+{
+    switch (criterion)
+    {
+    case SPLIT_LUMA: return SplitLuma::planes;
+    case SPLIT_MAX: return SplitMax::planes;
+    case SPLIT_YCBCR: return SplitYCbCr::planes;
+    case SPLIT_EDGE: return SplitEdge::planes;
+    default: return SplitMean::planes;
+    }
+}
+
+// The one runtime switch: picks the builder instantiation for a criterion.
+inline Node *buildQTSplit(int criterion, const SplitSums &sums, int minLeaf, double sdThresh, BuildStats &stats)
+{
+    const int W = sums.W, H = sums.H;
+    switch (criterion)
+    {
+    case SPLIT_LUMA: return buildQTCriterion<SplitLuma>(sums, 0, 0, W, H, minLeaf, sdThresh, stats);
+    case SPLIT_MAX: return buildQTCriterion<SplitMax>(sums, 0, 0, W, H, minLeaf, sdThresh, stats);
+    case SPLIT_YCBCR: return buildQTCriterion<SplitYCbCr>(sums, 0, 0, W, H, minLeaf, sdThresh, stats);
+    case SPLIT_EDGE: return buildQTCriterion<SplitEdge>(sums, 0, 0, W, H, minLeaf, sdThresh, stats);
+    default: return buildQTCriterion<SplitMean>(sums, 0, 0, W, H, minLeaf, sdThresh, stats);
+    }
+}
@@ -0,0 +1,184 @@
+// sweep.h
+// Size and quality of the tree over a grid of leaf sizes and StdDev
+// thresholds, in one run. The image is analysed once into a RateModel, and
+// for each leaf size its entries become step functions of the threshold
+// (ThresholdCurve): a node is in the tree below the smallest StdDev of its
+// ancestors, and a leaf from its own StdDev up. Every point then reads the
+// node and leaf counts and the squared error buildQT would give, exactly, in
+// O(log n), so even every distinct threshold costs little more than one pass.
+// Points can also be built for real, to time the build and to size the
+// rendering as PNG.
+//
+// The Pareto frontier marks the points that no other point beats on both
+// size (PNG bytes when measured, else native bytes) and PSNR.
+#pragma once
+
+#include "parallel.h"
+#include "rate_control.h"
+
+#include <functional>
+#include <limits>
+#include <numeric>
+
+struct SweepPoint
+{
+    int minLeaf = 1;
+    double sdThresh = 0;
+    size_t nodes = 0, leaves = 0;
+    size_t bytes = 0;    // native tree bytes (qtcBytes)
+    size_t pngBytes = 0; // 0 when not measured
+    double psnr = 0;
+    double buildMs = 0; // 0 when not built
+    bool pareto = false;
+
+    size_t size() const { return pngBytes ? pngBytes : bytes; }
+};
+
+struct SweepOptions
+{
+    bool build = true; // build each point to time it
+    int threads = 0;   // points probed (and built) at once
+    // Sizes a built tree as PNG. Called from the workers, on the tree each
+    // point was built into, so it must be safe to call concurrently.
+    std::function<size_t(const Node *)> pngSize;
+};
+
+// Counts and error of the tree at one leaf size, for any threshold.
+struct ThresholdCurve
+{
+    void build(const RateModel &model, int minLeaf)
+    {
+        events.clear();
+        if (!model.empty())
+            add(model, 0, minLeaf, std::numeric_limits<double>::infinity());
+        std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) { return a.at < b.at; });
+        at.clear();
+        sums.clear();
+        Sums run;
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            run.nodes += events[i].nodes;
+            run.leaves += events[i].leaves;
+            run.sse += events[i].sse;
+            if (i + 1 == events.size() || events[i + 1].at != events[i].at)
+            {
+                at.push_back(events[i].at);
+                sums.push_back(run);
+            }
+        }
+        events.clear();
+        events.shrink_to_fit();
+    }
+
+    // Same as RateModel::probe(sdThresh, minLeaf, ...).
+    void eval(double sdThresh, size_t &nodes, size_t &leaves, double &sse) const
+    {
+        const size_t k = (size_t)(std::upper_bound(at.begin(), at.end(), sdThresh) - at.begin());
+        const Sums s = k ? sums[k - 1] : Sums{};
+        nodes = (size_t)s.nodes;
+        leaves = (size_t)s.leaves;
+        sse = s.sse;
+    }
+
+private:
+    struct Event
+    {
+        double at;
+        int64_t nodes, leaves;
+        double sse; // integral values, so sums in any order are exact
+    };
+    struct Sums
+    {
+        int64_t nodes = 0, leaves = 0;
+        double sse = 0;
+    };
+    std::vector<Event> events;
+    std::vector<double> at; // thresholds where the counts step (ascending)
+    std::vector<Sums> sums; // counts for thresholds in [at[i], at[i + 1])
+
+    // Entry i is in the tree for thresholds below `until` (its ancestors'
+    // smallest StdDev); it is a leaf there once the threshold reaches its own.
+    void add(const RateModel &model, size_t i, int minLeaf, double until)
+    {
+        const RateModel::Entry &e = model.entries[i];
+        const bool splits = e.count != 0 && e.minSide > minLeaf;
+        const double leafFrom = splits ? e.sd : 0.0;
+        span(0.0, until, 1, 0, 0);
+        if (leafFrom < until)
+            span(leafFrom, until, 0, 1, e.sse);
+        if (splits)
+            for (uint32_t c = 0; c < e.count; ++c)
+                add(model, e.first + c, minLeaf, std::min(until, e.sd));
+    }
+
+    void span(double from, double until, int64_t nodes, int64_t leaves, double sse)
+    {
+        events.push_back(Event{from, nodes, leaves, sse});
+        if (until != std::numeric_limits<double>::infinity())
+            events.push_back(Event{until, -nodes, -leaves, -sse});
+    }
+};
+
+// All thresholds at which the tree changes, within [lo, hi]: the densest
+// useful threshold range, as every value in between repeats a tree.
+inline std::vector<double> sweepCuts(const RateModel &model, double lo, double hi)
+{
+    std::vector<double> out;
+    for (double c : model.cuts)
+        if (c >= lo && c <= hi)
+            out.push_back(c);
+    return out;
+}
+
+// Marks the points on the size/PSNR frontier.
+inline void markPareto(std::vector<SweepPoint> &points)
+{
+    std::vector<size_t> order(points.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return points[a].size() != points[b].size() ? points[a].size() < points[b].size()
+                                                            : points[a].psnr > points[b].psnr; });
+    double best = -1;
+    for (size_t i : order)
+    {
+        points[i].pareto = points[i].psnr > best;
+        best = std::max(best, points[i].psnr);
+    }
+}
+
+// Every (leaf, threshold) pair, leaf-major. model must be analysed from px.
+inline std::vector<SweepPoint> runSweep(const RateModel &model, const ImageView &px, const std::vector<int> &leaves,
+                                        const std::vector<double> &thresholds, const SweepOptions &opt)
+{
+    std::vector<SweepPoint> points;
+    for (int leaf : leaves)
+        for (double sd : thresholds)
+        {
+            SweepPoint p;
+            p.minLeaf = std::max(1, leaf);
+            p.sdThresh = sd;
+            points.push_back(p);
+        }
+    std::vector<ThresholdCurve> curves(leaves.size());
+    parallelFor(leaves.size(), opt.threads, [&](size_t i) { curves[i].build(model, std::max(1, leaves[i])); });
+    const double samples = 3.0 * px.W * px.H;
+    parallelFor(points.size(), opt.threads, [&](size_t i)
+                {
+        SweepPoint &p = points[i];
+        double sse = 0;
+        curves[i / thresholds.size()].eval(p.sdThresh, p.nodes, p.leaves, sse);
+        p.bytes = qtcBytes(p.nodes, p.leaves);
+        p.psnr = psnrFromSSE(sse, samples);
+        if (!opt.build && !opt.pngSize)
+            return;
+        BuildStats stats{};
+        auto t0 = std::chrono::high_resolution_clock::now();
+        Node *root = buildQT(px, 0, 0, px.W, px.H, p.minLeaf, p.sdThresh, stats);
+        if (opt.build)
+            p.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        if (opt.pngSize)
+            p.pngBytes = opt.pngSize(root);
+        destroy(root); });
+    markPareto(points);
+    return points;
+}
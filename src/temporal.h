@@ -0,0 +1,356 @@
+// temporal.h
+// Frame-sequence mode (.qtv) for screen recordings and camera feeds. Each
+// frame's tree is the previous frame's tree with only the changed subtrees
+// rebuilt (an IncrementalTree update): pixels are compared against the
+// previous frame in small blocks and subtrees over unchanged blocks are
+// reused as they are, so the result is exactly the tree a full build of the
+// frame would give.
+//
+//   "QTV1"  u32 W  u32 H  u32 rootW  u32 rootH        (little endian)
+//   frame := u32 bytes  u16 delayMs  u8 flags (bit 0 = keyframe)  payload
+//
+// The payload is a preorder bitstream (MSB first). Wherever the previous
+// tree has a node at the same position, one bit says whether the subtree
+// changed; an unchanged subtree costs just that bit. A changed or new node is
+// a leaf bit followed by 24 bits of color (leaf) or by its children.
+#pragma once
+
+#include "incremental.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <unordered_set>
+
+constexpr size_t QTV_HEADER_BYTES = 20;
+constexpr size_t QTV_FRAME_HEADER_BYTES = 7;
+
+struct TemporalParams
+{
+    int minLeaf = 1;
+    double sdThresh = 16.0;
+    int block = 16; // change detection granularity in pixels
+};
+
+struct TemporalFrameStats
+{
+    bool keyframe = false;
+    size_t changedBlocks = 0, blocks = 0;
+    size_t reused = 0;  // subtrees carried over from the previous frame
+    size_t rebuilt = 0; // nodes built or re-decided this frame
+    size_t nodes = 0, leaves = 0;
+    size_t bytes = 0; // payload
+    double detectMs = 0, updateMs = 0, encodeMs = 0;
+};
+
+namespace temporal_detail
+{
+    struct BitWriter
+    {
+        std::vector<uint8_t> &out;
+        uint32_t acc = 0;
+        int n = 0;
+
+        void put(uint32_t v, int bits)
+        {
+            for (int b = bits - 1; b >= 0; --b)
+            {
+                acc = (acc << 1) | ((v >> b) & 1u);
+                if (++n == 8)
+                {
+                    out.push_back((uint8_t)acc);
+                    acc = 0;
+                    n = 0;
+                }
+            }
+        }
+        void flush()
+        {
+            if (n > 0)
+                out.push_back((uint8_t)(acc << (8 - n)));
+            acc = 0;
+            n = 0;
+        }
+    };
+
+    struct BitReader
+    {
+        const uint8_t *p, *end;
+        int bit = 0;
+        bool overrun = false;
+
+        uint32_t get(int bits)
+        {
+            uint32_t v = 0;
+            for (int b = 0; b < bits; ++b)
+            {
+                if (p >= end)
+                {
+                    overrun = true;
+                    return 0;
+                }
+                v = (v << 1) | ((*p >> (7 - bit)) & 1u);
+                if (++bit == 8)
+                {
+                    bit = 0;
+                    ++p;
+                }
+            }
+            return v;
+        }
+    };
+
+    // Frees the nodes of `prev` that the decoded tree did not take over.
+    inline void releaseUnkept(Node *prev, const std::unordered_set<const Node *> &kept)
+    {
+        if (!prev || kept.count(prev))
+            return;
+        if (!prev->leaf)
+            for (int i = 0; i < 4; ++i)
+                releaseUnkept(prev->ch[i], kept);
+        delete prev;
+    }
+
+    // Drops a partly decoded tree; reused nodes inside it stay with the
+    // previous tree.
+    inline void discardNew(Node *n, std::unordered_set<const Node *> &kept)
+    {
+        if (!n || kept.erase(n))
+            return;
+        if (!n->leaf)
+            for (int i = 0; i < 4; ++i)
+                discardNew(n->ch[i], kept);
+        delete n;
+    }
+}
+
+inline void writeQtvHeader(std::vector<uint8_t> &out, const QtcHeader &h)
+{
+    out.insert(out.end(), {'Q', 'T', 'V', '1'});
+    putU32(out, h.W);
+    putU32(out, h.H);
+    putU32(out, h.rootW);
+    putU32(out, h.rootH);
+}
+
+inline bool readQtvHeader(const uint8_t *p, size_t len, QtcHeader &h)
+{
+    if (len < QTV_HEADER_BYTES || std::memcmp(p, "QTV1", 4) != 0)
+        return false;
+    h.W = getU32(p + 4);
+    h.H = getU32(p + 8);
+    h.rootW = getU32(p + 12);
+    h.rootH = getU32(p + 16);
+    return qtcHeaderValid(h);
+}
+
+inline void appendQtvFrame(std::vector<uint8_t> &out, const std::vector<uint8_t> &payload, int delayMs, bool keyframe)
+{
+    putU32(out, (uint32_t)payload.size());
+    const uint16_t d = (uint16_t)std::clamp(delayMs, 0, 65535);
+    out.push_back((uint8_t)d);
+    out.push_back((uint8_t)(d >> 8));
+    out.push_back(keyframe ? 1 : 0);
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+struct TemporalEncoder
+{
+    TemporalParams params;
+    IncrementalTree tree;
+
+    explicit TemporalEncoder(const TemporalParams &p = TemporalParams{}) : params(p) {}
+
+    // Updates the tree to `cur` and writes the frame's payload. A frame of a
+    // different size (or the first one) is a keyframe.
+    void encodeFrame(const ImageView &cur, std::vector<uint8_t> &payload, TemporalFrameStats &fs)
+    {
+        using clock = std::chrono::high_resolution_clock;
+        fs = TemporalFrameStats{};
+        payload.clear();
+        auto t0 = clock::now();
+        tree.minLeaf = params.minLeaf;
+        tree.sdThresh = params.sdThresh;
+        fs.keyframe = !tree.root || cur.W != tree.W || cur.H != tree.H;
+        if (!fs.keyframe)
+            detectChanges(cur, fs);
+        auto t1 = clock::now();
+
+        TreeDelta delta;
+        if (fs.keyframe)
+            tree.build(cur, &delta);
+        else
+            tree.update(cur, [this](int x, int y, int w, int h)
+                        { return changedIn(x, y, w, h); }, &delta);
+        auto t2 = clock::now();
+
+        temporal_detail::BitWriter bw{payload};
+        encode(tree.root, tree.previous, bw);
+        bw.flush();
+        fs.reused = tree.reusedCount();
+        tree.releasePrevious();
+        saveFrame(cur);
+        auto t3 = clock::now();
+
+        SpillStore::countSubtree(tree.root, fs.nodes, fs.leaves);
+        fs.rebuilt = delta.visited;
+        fs.bytes = payload.size();
+        fs.detectMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        fs.updateMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        fs.encodeMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+    }
+
+private:
+    std::vector<uint8_t> prevFrame;   // packed RGB of the last frame
+    std::vector<uint32_t> changedSum; // 2D prefix sums of changed blocks
+    int gridW = 0, gridH = 0;
+
+    // Marks the blocks whose pixels differ from the previous frame.
+    void detectChanges(const ImageView &cur, TemporalFrameStats &fs)
+    {
+        const int W = tree.W, H = tree.H, B = std::max(1, params.block);
+        gridW = (W + B - 1) / B;
+        gridH = (H + B - 1) / B;
+        std::vector<uint8_t> changed((size_t)gridW * gridH, 0);
+        const size_t rowBytes = (size_t)W * sizeof(Color);
+        parallelFor((size_t)gridH, 0, [&](size_t gy)
+                    {
+            uint8_t *flags = changed.data() + gy * gridW;
+            const int y1 = std::min(H, (int)(gy + 1) * B);
+            for (int y = (int)gy * B; y < y1; ++y)
+            {
+                const uint8_t *a = cur.data + (size_t)y * cur.stride;
+                const uint8_t *b = prevFrame.data() + (size_t)y * rowBytes;
+                if (std::memcmp(a, b, rowBytes) == 0)
+                    continue;
+                for (int gx = 0; gx < gridW; ++gx)
+                {
+                    if (flags[gx])
+                        continue;
+                    const size_t off = (size_t)gx * B * sizeof(Color);
+                    const size_t len = std::min(rowBytes - off, (size_t)B * sizeof(Color));
+                    flags[gx] = std::memcmp(a + off, b + off, len) != 0;
+                }
+            } });
+        changedSum.assign((size_t)(gridW + 1) * (gridH + 1), 0);
+        for (int gy = 0; gy < gridH; ++gy)
+            for (int gx = 0; gx < gridW; ++gx)
+            {
+                const size_t i = (size_t)(gy + 1) * (gridW + 1) + gx + 1;
+                changedSum[i] = changed[(size_t)gy * gridW + gx] + changedSum[i - 1] + changedSum[i - gridW - 1] -
+                                changedSum[i - gridW - 2];
+            }
+        fs.blocks = changed.size();
+        fs.changedBlocks = changedSum.back();
+    }
+
+    // True when a block overlapping the rectangle changed (conservative).
+    bool changedIn(int x, int y, int w, int h) const
+    {
+        const int B = std::max(1, params.block);
+        const int x0 = std::max(0, x) / B, y0 = std::max(0, y) / B;
+        const int x1 = (std::min(tree.W, x + w) - 1) / B + 1, y1 = (std::min(tree.H, y + h) - 1) / B + 1;
+        const size_t s = (size_t)gridW + 1;
+        return changedSum[(size_t)y1 * s + x1] - changedSum[(size_t)y0 * s + x1] - changedSum[(size_t)y1 * s + x0] +
+                   changedSum[(size_t)y0 * s + x0] !=
+               0;
+    }
+
+    void encode(const Node *n, const Node *prev, temporal_detail::BitWriter &bw) const
+    {
+        if (prev)
+        {
+            bw.put(n != prev, 1);
+            if (n == prev)
+                return;
+        }
+        bw.put(n->leaf, 1);
+        if (n->leaf)
+        {
+            bw.put((uint32_t)n->avg.r << 16 | (uint32_t)n->avg.g << 8 | n->avg.b, 24);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            if (n->ch[i])
+                encode(n->ch[i], prev && !prev->leaf ? prev->ch[i] : nullptr, bw);
+    }
+
+    void saveFrame(const ImageView &cur)
+    {
+        const size_t rowBytes = (size_t)tree.W * sizeof(Color);
+        prevFrame.resize(rowBytes * tree.H);
+        for (int y = 0; y < tree.H; ++y)
+            std::memcpy(prevFrame.data() + (size_t)y * rowBytes, cur.data + (size_t)y * cur.stride, rowBytes);
+    }
+};
+
+// Rebuilds each frame's tree from the previous one and the payload.
+struct TemporalDecoder
+{
+    QtcHeader header;
+    Node *tree = nullptr;
+
+    TemporalDecoder() = default;
+    TemporalDecoder(const TemporalDecoder &) = delete;
+    TemporalDecoder &operator=(const TemporalDecoder &) = delete;
+    ~TemporalDecoder() { destroy(tree); }
+
+    bool decodeFrame(const uint8_t *payload, size_t len, bool keyframe)
+    {
+        using namespace temporal_detail;
+        if (!keyframe && !tree)
+            return false;
+        Node *prev = keyframe ? nullptr : tree;
+        kept.clear();
+        BitReader br{payload, payload + len};
+        bool ok = true;
+        Node *next = decode(prev, 0, 0, (int)header.rootW, (int)header.rootH, br, ok);
+        if (!ok || br.overrun)
+        {
+            discardNew(next, kept);
+            return false;
+        }
+        if (keyframe)
+            destroy(tree);
+        else
+            releaseUnkept(prev, kept);
+        tree = next;
+        return true;
+    }
+
+private:
+    std::unordered_set<const Node *> kept;
+
+    Node *decode(Node *prev, int x, int y, int w, int h, temporal_detail::BitReader &br, bool &ok)
+    {
+        if (prev && br.get(1) == 0)
+        {
+            kept.insert(prev);
+            return prev;
+        }
+        Node *n = new Node();
+        n->x = x;
+        n->y = y;
+        n->w = w;
+        n->h = h;
+        n->leaf = br.get(1) != 0;
+        if (n->leaf)
+        {
+            const uint32_t c = br.get(24);
+            n->avg = Color{(uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c};
+            return n;
+        }
+        if (w / 2 == 0 || h / 2 == 0 || br.overrun)
+        {
+            ok = false; // cannot split further
+            n->leaf = true;
+            return n;
+        }
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int i = 0; i < 4 && ok && !br.overrun; ++i)
+            if (rectInImage((int)header.W, (int)header.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                n->ch[i] = decode(prev && !prev->leaf ? prev->ch[i] : nullptr, r[i][0], r[i][1], r[i][2], r[i][3],
+                                  br, ok);
+        return n;
+    }
+};
@@ -0,0 +1,255 @@
+// tile_render.h
+// Web-map style tiles (XYZ: zoom z, column x, row y, 256 px squares) of a
+// quadtree. The deepest zoom is 1:1 with the image and every level up halves
+// the resolution. A tile only walks the subtree under its footprint and stops
+// at nodes no larger than one output pixel, whose average color stands in for
+// everything below them, so rendering costs O(tile pixels) at any zoom.
+#pragma once
+
+#include "spill.h"
+
+#include <cmath>
+
+struct TileGrid
+{
+    int W = 0, H = 0;   // image size
+    int tileSize = 256; // output pixels per tile side
+    int maxZoom = 0;    // zoom at which one tile pixel is one image pixel
+
+    TileGrid() = default;
+    TileGrid(int w, int h, int tile = 256) : W(w), H(h), tileSize(tile)
+    {
+        maxZoom = 0;
+        while (((int64_t)tileSize << maxZoom) < std::max(W, H))
+            maxZoom++;
+    }
+
+    // Image pixels per tile pixel at zoom z.
+    int64_t scale(int z) const { return (int64_t)1 << (maxZoom - z); }
+    int64_t span(int z) const { return (int64_t)tileSize * scale(z); }
+    int columns(int z) const { return (int)((W + span(z) - 1) / span(z)); }
+    int rows(int z) const { return (int)((H + span(z) - 1) / span(z)); }
+
+    bool valid(int z, int x, int y) const
+    {
+        return z >= 0 && z <= maxZoom && x >= 0 && y >= 0 && x < columns(z) && y < rows(z);
+    }
+};
+
+namespace tile_detail
+{
+    struct Target
+    {
+        int64_t ox, oy, s; // output origin in image pixels, image pixels per output pixel
+        int outW, outH, W, H;
+        Color *out;
+        const SpillStore *store;
+    };
+
+    // Output pixels along one axis whose centers fall in [a, b). A node ending
+    // at the image edge also takes the pixels that straddle the edge (their
+    // centers may lie just outside it), so coarse levels have no dark border.
+    inline void coveredRange(int64_t a, int64_t b, bool edge, int64_t o, int64_t s, int n, int &i0, int &i1)
+    {
+        // center of pixel i is o + (i + 0.5) s, so a <= center  <=>  i >= (2(a - o) - s) / 2s
+        auto first = [&](int64_t twice)
+        {
+            const int64_t num = twice - 2 * o - s, den = 2 * s;
+            const int64_t q = num >= 0 ? (num + den - 1) / den : -((-num) / den);
+            return (int)std::clamp<int64_t>(q, 0, n);
+        };
+        i0 = first(2 * a);
+        i1 = first(2 * b + (edge ? s : 0));
+    }
+
+    // Output pixels covered by the block (x, y, w, h) clipped to the image;
+    // false when there are none.
+    inline bool footprint(const Target &t, int x, int y, int w, int h, int &i0, int &i1, int &j0, int &j1)
+    {
+        const int64_t x1 = std::min<int64_t>(t.W, (int64_t)x + w);
+        const int64_t y1 = std::min<int64_t>(t.H, (int64_t)y + h);
+        coveredRange(std::max(0, x), x1, x1 == t.W, t.ox, t.s, t.outW, i0, i1);
+        coveredRange(std::max(0, y), y1, y1 == t.H, t.oy, t.s, t.outH, j0, j1);
+        return i0 < i1 && j0 < j1;
+    }
+
+    inline void fill(const Target &t, int i0, int i1, int j0, int j1, Color c)
+    {
+        for (int j = j0; j < j1; ++j)
+            fillSpanRGB(t.out + (size_t)j * t.outW + i0, (size_t)(i1 - i0), c);
+    }
+
+    inline void render(const Node *n, const Target &t)
+    {
+        int i0, i1, j0, j1;
+        if (!n || !footprint(t, n->x, n->y, n->w, n->h, i0, i1, j0, j1))
+            return;
+        if (n->leaf || (n->w <= t.s && n->h <= t.s) || (n->spilled && !t.store))
+        {
+            fill(t, i0, i1, j0, j1, n->avg);
+            return;
+        }
+        if (n->spilled)
+        {
+            Node *sub = t.store->load(n);
+            if (sub)
+                fillInternalAverages(sub, t.W, t.H);
+            Target paged = t;
+            paged.store = nullptr;
+            render(sub ? sub : n, paged);
+            destroy(sub);
+            return;
+        }
+        for (int i = 0; i < 4; ++i)
+            render(n->ch[i], t);
+    }
+}
+
+// Renders the outW x outH pixels starting at image point (ox, oy), each
+// covering scale x scale image pixels, into out (row-major). Pixels entirely
+// beyond the image edge get `background`. Internal nodes must carry their
+// averages (makeNodeQT, or fillInternalAverages after loading a .qtc).
+inline void renderScaled(const Node *root, int W, int H, int64_t ox, int64_t oy, int64_t scale, int outW, int outH,
+                         std::vector<Color> &out, const SpillStore *store = nullptr,
+                         Color background = Color{0, 0, 0})
+{
+    out.assign((size_t)outW * outH, background);
+    const tile_detail::Target t{ox, oy, std::max<int64_t>(1, scale), outW, outH, W, H, out.data(), store};
+    tile_detail::render(root, t);
+}
+
+// Tile (z, x, y) of the grid as tileSize^2 pixels.
+inline bool renderTile(const Node *root, const TileGrid &g, int z, int x, int y, std::vector<Color> &out,
+                       const SpillStore *store = nullptr, Color background = Color{0, 0, 0})
+{
+    if (!root || !g.valid(z, x, y))
+        return false;
+    renderScaled(root, g.W, g.H, x * g.span(z), y * g.span(z), g.scale(z), g.tileSize, g.tileSize, out, store,
+                 background);
+    return true;
+}
+
+// ---------------- Compact trees ----------------
+// Read-only tree for serving tiles, 8 bytes a node instead of sizeof(Node).
+// The children of a node that lie inside the image are stored next to each
+// other, so a cell only keeps its color (the area-weighted mean for internal
+// nodes, as fillInternalAverages) and the index of its first child; the
+// geometry is recomputed with childRects() on the way down.
+struct CompactTree
+{
+    struct Cell
+    {
+        uint32_t first = 0; // 0: leaf (cell 0 is the root, never a child)
+        Color avg{0, 0, 0};
+    };
+    int W = 0, H = 0, rootW = 0, rootH = 0;
+    std::vector<Cell> cells;
+    size_t leaves = 0;
+
+    size_t bytes() const { return cells.capacity() * sizeof(Cell); }
+};
+
+namespace tile_detail
+{
+    // Decodes the .qtc subtree at p into cell idx, returning its clipped area
+    // and adding its area-weighted color sums to acc (same arithmetic as
+    // fillInternalAverages, so colors match a loadQtc tree).
+    inline double decodeCompact(const uint8_t *&p, const uint8_t *end, size_t idx, int x, int y, int w, int h,
+                                CompactTree &t, double acc[3], bool &ok)
+    {
+        if (p >= end)
+            return ok = false;
+        const uint8_t tag = *p++;
+        const double area = (double)std::max(0, std::min(t.W, x + w) - std::max(0, x)) *
+                            std::max(0, std::min(t.H, y + h) - std::max(0, y));
+        if (tag == QTC_LEAF)
+        {
+            if (end - p < 3)
+                return ok = false;
+            const Color c{p[0], p[1], p[2]};
+            p += 3;
+            t.cells[idx].avg = c;
+            t.leaves++;
+            acc[0] += area * c.r;
+            acc[1] += area * c.g;
+            acc[2] += area * c.b;
+            return area;
+        }
+        if (tag != QTC_INTERNAL)
+            return ok = false;
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        size_t k = 0;
+        for (int i = 0; i < 4; ++i)
+            k += rectInImage(t.W, t.H, r[i][0], r[i][1], r[i][2], r[i][3]);
+        const size_t first = t.cells.size();
+        if (k == 0 || first + k > UINT32_MAX)
+            return ok = false;
+        t.cells.resize(first + k);
+        t.cells[idx].first = (uint32_t)first;
+        double sum[3] = {0, 0, 0}, covered = 0;
+        for (int i = 0, c = 0; i < 4 && ok; ++i)
+            if (rectInImage(t.W, t.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                covered += decodeCompact(p, end, first + c++, r[i][0], r[i][1], r[i][2], r[i][3], t, sum, ok);
+        if (covered > 0)
+            t.cells[idx].avg =
+                Color{(uint8_t)(sum[0] / covered), (uint8_t)(sum[1] / covered), (uint8_t)(sum[2] / covered)};
+        for (int c = 0; c < 3; ++c)
+            acc[c] += sum[c];
+        return covered;
+    }
+
+    inline void renderCompact(const CompactTree &tree, size_t idx, int x, int y, int w, int h, const Target &t)
+    {
+        int i0, i1, j0, j1;
+        if (!footprint(t, x, y, w, h, i0, i1, j0, j1))
+            return;
+        const CompactTree::Cell &c = tree.cells[idx];
+        if (!c.first || (w <= t.s && h <= t.s))
+        {
+            fill(t, i0, i1, j0, j1, c.avg);
+            return;
+        }
+        int r[4][4];
+        childRects(x, y, w, h, r);
+        for (int i = 0, k = 0; i < 4; ++i)
+            if (rectInImage(t.W, t.H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                renderCompact(tree, c.first + k++, r[i][0], r[i][1], r[i][2], r[i][3], t);
+    }
+}
+
+// Reads a .qtc straight into a CompactTree (no Node tree in between).
+inline bool loadCompactQtc(const std::string &path, QtcHeader &h, CompactTree &t)
+{
+    std::vector<uint8_t> bytes;
+    if (!readFileBytes(path, bytes) || !readQtcHeader(bytes.data(), bytes.size(), h))
+        return false;
+    t = CompactTree{};
+    t.W = (int)h.W;
+    t.H = (int)h.H;
+    t.rootW = (int)h.rootW;
+    t.rootH = (int)h.rootH;
+    // one pass over the tags sizes the cells exactly
+    size_t nodes = 0;
+    for (const uint8_t *q = bytes.data() + QTC_HEADER_BYTES; q < bytes.data() + bytes.size(); ++nodes)
+        q += *q == QTC_LEAF ? 4 : 1;
+    t.cells.reserve(nodes);
+    t.cells.resize(1);
+    const uint8_t *p = bytes.data() + QTC_HEADER_BYTES;
+    double acc[3] = {0, 0, 0};
+    bool ok = true;
+    tile_detail::decodeCompact(p, bytes.data() + bytes.size(), 0, 0, 0, t.rootW, t.rootH, t, acc, ok);
+    return ok;
+}
+
+inline bool renderTile(const CompactTree &tree, const TileGrid &g, int z, int x, int y, std::vector<Color> &out,
+                       Color background = Color{0, 0, 0})
+{
+    if (tree.cells.empty() || !g.valid(z, x, y))
+        return false;
+    out.assign((size_t)g.tileSize * g.tileSize, background);
+    const tile_detail::Target t{x * g.span(z), y * g.span(z), g.scale(z), g.tileSize, g.tileSize,
+                                tree.W, tree.H, out.data(), nullptr};
+    tile_detail::renderCompact(tree, 0, 0, 0, tree.rootW, tree.rootH, t);
+    return true;
+}
@@ -0,0 +1,461 @@
+// tile_server.cpp
+// quadtree_tiled: serves XYZ tiles of quadtree-compressed images over HTTP on
+// localhost. Each .qtc is read into a CompactTree at startup (8 bytes per
+// node, about 2.5x the file); each request renders only the subtree under the
+// tile at the tile's resolution (tile_render.h) and encodes it on a worker
+// pool, with recently rendered tiles kept in an LRU cache. Concurrent misses
+// on one tile wait for a single render.
+//
+//   quadtree_tiled [--host 127.0.0.1] [--port 8080] [--threads 0] [--cache-mb 256]
+//                  [--tile 256] [--png-preset fast] [--level 0-12] <tree.qtc | name=tree.qtc>...
+//
+//   GET /                         image list
+//   GET /{image}.json             size, tile size and zoom range
+//   GET /{image}/{z}/{x}/{y}.png  one tile
+//   GET /stats                    request, cache and render counters
+#include "cli_args.h"
+#include "http.h"
+#include "lru_cache.h"
+#include "parallel.h"
+#include "png_writer.h"
+#include "qtc_format.h"
+#include "tile_render.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+
+// ---------------- Images ----------------
+struct TiledImage
+{
+    CompactTree tree;
+    TileGrid grid;
+};
+
+// ---------------- Server ----------------
+struct Connection
+{
+    int fd = -1;
+    std::string buf; // received bytes not consumed yet
+};
+
+struct TileServer
+{
+    std::map<std::string, TiledImage> images;
+    PngParams png;
+    LruCache cache;
+    int workers = 1;
+    // tiles being rendered, so other requests for them wait instead of
+    // rendering them again
+    std::mutex inflightLock;
+    std::unordered_map<std::string, std::shared_future<Blob>> inflight;
+
+    std::atomic<uint64_t> requests{0}, errors{0}, rendered{0}, joined{0};
+    std::atomic<uint64_t> renderNs{0}, encodeNs{0};
+
+    explicit TileServer(size_t cacheBytes) : cache(cacheBytes) {}
+
+    // Returns the status; fills body and content type.
+    int handle(const std::string &method, std::string path, Blob &body, std::string &type, bool &cached)
+    {
+        requests++;
+        cached = false;
+        if (method != "GET")
+            return 405;
+        path = path.substr(0, path.find('?'));
+        if (path == "/")
+            return text(listing(), "text/plain", body, type);
+        if (path == "/stats")
+            return text(statsJson(), "application/json", body, type);
+        const size_t dot = path.rfind('.');
+        if (path.size() < 2 || dot == std::string::npos)
+            return 404;
+        const std::string ext = path.substr(dot);
+        const std::string rest = path.substr(1, dot - 1);
+        if (ext == ".json")
+        {
+            auto it = images.find(rest);
+            return it == images.end() ? 404 : text(infoJson(rest, it->second), "application/json", body, type);
+        }
+        if (ext != ".png")
+            return 404;
+
+        // {image}/{z}/{x}/{y}
+        const size_t s3 = rest.rfind('/');
+        const size_t s2 = s3 == std::string::npos || s3 == 0 ? std::string::npos : rest.rfind('/', s3 - 1);
+        const size_t s1 = s2 == std::string::npos || s2 == 0 ? std::string::npos : rest.rfind('/', s2 - 1);
+        if (s1 == std::string::npos)
+            return 404;
+        auto it = images.find(rest.substr(0, s1));
+        int z, x, y;
+        char tail;
+        if (it == images.end() ||
+            std::sscanf(rest.c_str() + s1, "/%d/%d/%d%c", &z, &x, &y, &tail) != 3 ||
+            !it->second.grid.valid(z, x, y))
+            return 404;
+        type = "image/png";
+        std::promise<Blob> mine;
+        std::shared_future<Blob> other;
+        {
+            // under the lock: a render finishing in between has put its tile
+            // in the cache before leaving inflight
+            std::lock_guard<std::mutex> g(inflightLock);
+            if ((body = cache.get(path)))
+            {
+                cached = true;
+                return 200;
+            }
+            auto f = inflight.find(path);
+            if (f != inflight.end())
+                other = f->second;
+            else
+                inflight.emplace(path, mine.get_future().share());
+        }
+        if (other.valid())
+        {
+            joined++;
+            cached = true; // not rendered for this request
+            return (body = other.get()) ? 200 : 500;
+        }
+        // the waiters are released on every path: a render that throws (out of
+        // memory) fails this request and theirs instead of breaking the promise
+        try
+        {
+            body = renderPng(it->second, z, x, y);
+            if (body)
+            {
+                std::lock_guard<std::mutex> g(inflightLock);
+                cache.put(path, body);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Tile " << path << " failed: " << e.what() << "\n";
+            body = nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> g(inflightLock);
+            inflight.erase(path);
+        }
+        mine.set_value(body);
+        return body ? 200 : 500;
+    }
+
+    Blob renderPng(const TiledImage &img, int z, int x, int y)
+    {
+        thread_local std::vector<Color> px;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!renderTile(img.tree, img.grid, z, x, y, px))
+            return nullptr;
+        auto t1 = std::chrono::steady_clock::now();
+        auto out = std::make_shared<std::vector<uint8_t>>();
+        const int T = img.grid.tileSize;
+        if (!encodePNG(pngImageRGB(reinterpret_cast<const uint8_t *>(px.data()), T, T), png, *out))
+            return nullptr;
+        auto t2 = std::chrono::steady_clock::now();
+        rendered++;
+        renderNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        encodeNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+        return out;
+    }
+
+    static int text(const std::string &s, const char *contentType, Blob &body, std::string &type)
+    {
+        body = std::make_shared<std::vector<uint8_t>>(s.begin(), s.end());
+        type = contentType;
+        return 200;
+    }
+
+    std::string listing() const
+    {
+        std::string s;
+        for (const auto &kv : images)
+        {
+            char line[256];
+            std::snprintf(line, sizeof(line), "%s %dx%d zoom 0-%d\n", kv.first.c_str(), kv.second.grid.W,
+                          kv.second.grid.H, kv.second.grid.maxZoom);
+            s += line;
+        }
+        return s;
+    }
+
+    static std::string infoJson(const std::string &name, const TiledImage &img)
+    {
+        char s[512];
+        std::snprintf(s, sizeof(s),
+                      "{\"name\":\"%s\",\"width\":%d,\"height\":%d,\"tileSize\":%d,\"minZoom\":0,\"maxZoom\":%d,"
+                      "\"nodes\":%zu,\"leaves\":%zu}\n",
+                      name.c_str(), img.grid.W, img.grid.H, img.grid.tileSize, img.grid.maxZoom, img.tree.cells.size(),
+                      img.tree.leaves);
+        return s;
+    }
+
+    std::string statsJson() const
+    {
+        const LruCache::Stats c = cache.snapshot();
+        const uint64_t n = std::max<uint64_t>(1, rendered.load());
+        char s[512];
+        std::snprintf(s, sizeof(s),
+                      "{\"requests\":%llu,\"errors\":%llu,\"workers\":%d,\"cacheHits\":%llu,\"cacheMisses\":%llu,"
+                      "\"cacheEvictions\":%llu,\"cacheEntries\":%zu,\"cacheBytes\":%zu,\"rendered\":%llu,"
+                      "\"joined\":%llu,\"avgRenderMs\":%.3f,\"avgEncodeMs\":%.3f}\n",
+                      (unsigned long long)requests.load(), (unsigned long long)errors.load(), workers,
+                      (unsigned long long)c.hits, (unsigned long long)c.misses, (unsigned long long)c.evictions,
+                      c.entries, c.bytes, (unsigned long long)rendered.load(), (unsigned long long)joined.load(),
+                      renderNs.load() / 1e6 / n,
+                      encodeNs.load() / 1e6 / n);
+        return s;
+    }
+};
+
+// ---------------- Connection handling ----------------
+// One poll() thread watches the listening socket and idle keep-alive
+// connections; a connection with pending bytes is handed to a worker, which
+// answers every complete request in its buffer and then gives it back.
+static int gWakePipe[2] = {-1, -1};
+static std::atomic<bool> gStop{false};
+
+static void onSignal(int)
+{
+    gStop = true;
+    const char b = 1;
+    (void)!::write(gWakePipe[1], &b, 1);
+}
+
+struct ConnectionQueue
+{
+    std::deque<Connection *> ready; // readable, waiting for a worker
+    std::vector<Connection *> back; // served, to be watched again
+    std::mutex m;
+    std::condition_variable cv;
+
+    void push(Connection *c)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            ready.push_back(c);
+        }
+        cv.notify_one();
+    }
+
+    Connection *pop()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&]
+                { return !ready.empty() || gStop; });
+        if (ready.empty())
+            return nullptr;
+        Connection *c = ready.front();
+        ready.pop_front();
+        return c;
+    }
+
+    void giveBack(Connection *c)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            back.push_back(c);
+        }
+        const char b = 0;
+        (void)!::write(gWakePipe[1], &b, 1);
+    }
+};
+
+static void closeConnection(Connection *c)
+{
+    ::close(c->fd);
+    delete c;
+}
+
+// Serves the requests buffered on c. Returns false once it should be closed.
+static bool serve(TileServer &srv, Connection *c)
+{
+    do
+    {
+        size_t headLen = 0, total = 0;
+        if (!httpReadMessage(c->fd, c->buf, headLen, total))
+            return false;
+        const std::string head = c->buf.substr(0, headLen);
+        c->buf.erase(0, total);
+
+        const size_t sp1 = head.find(' '), sp2 = head.find(' ', sp1 + 1);
+        if (sp1 == std::string::npos || sp2 == std::string::npos)
+            return false;
+        const std::string conn = httpHeader(head, "Connection");
+        const bool keepAlive = head.compare(sp2 + 1, 8, "HTTP/1.0") == 0 ? strcasecmp(conn.c_str(), "keep-alive") == 0
+                                                                          : strcasecmp(conn.c_str(), "close") != 0;
+        Blob body;
+        std::string type = "text/plain";
+        bool cached = false;
+        const int status = srv.handle(head.substr(0, sp1), head.substr(sp1 + 1, sp2 - sp1 - 1), body, type, cached);
+        if (status != 200)
+        {
+            srv.errors++;
+            const std::string msg = std::string(httpReason(status)) + "\n";
+            body = std::make_shared<std::vector<uint8_t>>(msg.begin(), msg.end());
+            type = "text/plain";
+        }
+        const std::string out = httpResponseHead(status, type.c_str(), body->size(), keepAlive,
+                                                 status != 200 ? ""
+                                                 : cached      ? "X-Cache: hit\r\n"
+                                                               : "X-Cache: miss\r\n");
+        if (!sendAll(c->fd, out.data(), out.size()) || !sendAll(c->fd, body->data(), body->size()) || !keepAlive)
+            return false;
+    } while (!c->buf.empty());
+    return true;
+}
+
+static void workerLoop(TileServer &srv, ConnectionQueue &q)
+{
+    while (Connection *c = q.pop())
+    {
+        if (serve(srv, c))
+            q.giveBack(c);
+        else
+            closeConnection(c);
+    }
+}
+
+static void pollLoop(int listenFd, ConnectionQueue &q)
+{
+    std::vector<Connection *> idle;
+    std::vector<pollfd> fds;
+    while (!gStop)
+    {
+        fds.assign({{listenFd, POLLIN, 0}, {gWakePipe[0], POLLIN, 0}});
+        for (Connection *c : idle)
+            fds.push_back({c->fd, POLLIN, 0});
+        if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[256];
+            while (::read(gWakePipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            std::lock_guard<std::mutex> lk(q.m);
+            idle.insert(idle.end(), q.back.begin(), q.back.end());
+            q.back.clear();
+        }
+        // readable (or hung up) idle connections go to the workers
+        std::vector<Connection *> still;
+        for (size_t i = 2; i < fds.size(); ++i)
+        {
+            Connection *c = idle[i - 2];
+            if (fds[i].revents)
+                q.push(c);
+            else
+                still.push_back(c);
+        }
+        // connections given back during this round were not polled yet
+        still.insert(still.end(), idle.begin() + (std::ptrdiff_t)(fds.size() - 2), idle.end());
+        idle.swap(still);
+        if (fds[0].revents & POLLIN)
+            for (int fd; (fd = ::accept(listenFd, nullptr, nullptr)) >= 0;)
+            {
+                const int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                // a worker never waits long on a client that stalls mid-request
+                timeval tv{10, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                idle.push_back(new Connection{fd, {}});
+            }
+    }
+    for (Connection *c : idle)
+        closeConnection(c);
+    {
+        std::lock_guard<std::mutex> lk(q.m); // workers waiting in pop() see gStop
+    }
+    q.cv.notify_all();
+}
+
+// ---------------- Main ----------------
+int main(int argc, char **argv)
+{
+    const HeadlessArgs a = parseArgs(argc, argv, 1);
+    if (a.pos.empty())
+    {
+        std::cerr << "usage: quadtree_tiled [--host 127.0.0.1] [--port 8080] [--threads N] [--cache-mb MB]"
+                     " [--tile 256] [--png-preset fast|default|max] [--level 0-12] <tree.qtc | name=tree.qtc>...\n";
+        return 2;
+    }
+    int preset = PNG_PRESET_FAST;
+    if (const char *p = a.get("png-preset"))
+        if (!parsePngPreset(p, preset))
+        {
+            std::cerr << "Unknown PNG preset: " << p << " (fast, default, max)\n";
+            return 2;
+        }
+    TileServer srv((size_t)std::max(1, a.getInt("cache-mb", 256)) << 20);
+    srv.png = pngPresetParams(preset);
+    srv.png.threads = 1; // parallelism comes from serving tiles concurrently
+    srv.png.level = std::min(a.getInt("level", srv.png.level), 12);
+    srv.workers = (int)workerCount(a.getInt("threads", 0));
+    const int tileSize = std::clamp(a.getInt("tile", 256), 16, 4096);
+
+    for (const std::string &arg : a.pos)
+    {
+        const size_t eq = arg.find('=');
+        const std::string path = eq == std::string::npos ? arg : arg.substr(eq + 1);
+        const std::string name = eq == std::string::npos ? std::filesystem::path(arg).stem().string() : arg.substr(0, eq);
+        TiledImage img;
+        QtcHeader h;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!loadCompactQtc(path, h, img.tree))
+        {
+            std::cerr << "Failed to load .qtc: " << path << "\n";
+            return 1;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        img.grid = TileGrid((int)h.W, (int)h.H, tileSize);
+        std::printf("%s: %ux%u zoom 0-%d nodes=%zu leaves=%zu tree=%.1f MB load=%.1f ms\n", name.c_str(), h.W,
+                    h.H, img.grid.maxZoom, img.tree.cells.size(), img.tree.leaves, img.tree.bytes() / (1024.0 * 1024.0),
+                    std::chrono::duration<double, std::milli>(t1 - t0).count());
+        srv.images[name] = std::move(img);
+    }
+
+    const std::string host = a.get("host") ? a.get("host") : "127.0.0.1";
+    const int port = a.getInt("port", 8080);
+    const int listenFd = httpListen(host, port);
+    if (listenFd < 0 || ::pipe(gWakePipe) != 0)
+    {
+        std::cerr << "Cannot listen on " << host << ":" << port << "\n";
+        return 1;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    fcntl(gWakePipe[0], F_SETFL, fcntl(gWakePipe[0], F_GETFL) | O_NONBLOCK);
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::printf("serving %zu image(s) on http://%s:%d/ workers=%d cache=%d MB png=%s level %d\n",
+                srv.images.size(), host.c_str(), port, srv.workers, std::max(1, a.getInt("cache-mb", 256)),
+                pngPresetName(preset), srv.png.level);
+    std::fflush(stdout);
+
+    ConnectionQueue q;
+    std::vector<std::thread> pool;
+    for (int i = 0; i < srv.workers; ++i)
+        pool.emplace_back(workerLoop, std::ref(srv), std::ref(q));
+    pollLoop(listenFd, q);
+    for (auto &t : pool)
+        t.join();
+    for (Connection *c : q.ready)
+        closeConnection(c);
+    for (Connection *c : q.back)
+        closeConnection(c);
+    ::close(listenFd);
+    std::printf("%s", srv.statsJson().c_str());
+    return 0;
+}
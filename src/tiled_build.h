@@ -0,0 +1,279 @@
+// tiled_build.h
+// Memory-bounded quadtree construction for images too large to hold in RAM.
+//
+// The image is covered by a padded power-of-two root (rootSize = tile * 2^k)
+// and cut into aligned tile x tile squares. Each tile's subtree is built and
+// serialized on its own, so a worker only ever holds one tile of pixels and
+// one tile subtree. The levels above the tiles are then decided from the
+// per-tile BlockStats alone and the tile streams are spliced underneath,
+// which yields exactly the tree a top-down build of the padded root would.
+#pragma once
+
+#include "mapped_image.h"
+#include "parallel.h"
+#include "qtc_format.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// ---------------- Tile sources ----------------
+struct TileSource
+{
+    virtual ~TileSource() = default;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    // View of the rectangle (already clipped to the image) with (0,0) at (x,y).
+    // May point into `scratch` or directly into the source pixels.
+    virtual bool tile(int x, int y, int w, int h, std::vector<Color> &scratch, ImageView &out) = 0;
+    // Called once the tile's subtree has been serialized.
+    virtual void release(int /*x*/, int /*y*/, int /*w*/, int /*h*/) {}
+    // Whether tile() may be called from several workers at once.
+    virtual bool concurrent() const { return true; }
+};
+
+// Whole image already in memory (any format stb can decode).
+struct MemoryTileSource : TileSource
+{
+    ImageView img;
+    explicit MemoryTileSource(const ImageView &v) : img(v) {}
+    int width() const override { return img.W; }
+    int height() const override { return img.H; }
+    bool tile(int x, int y, int w, int h, std::vector<Color> &, ImageView &out) override
+    {
+        out.data = img.data + (size_t)y * img.stride + (size_t)x * sizeof(Color);
+        out.W = w;
+        out.H = h;
+        out.stride = img.stride;
+        return true;
+    }
+};
+
+#ifndef _WIN32
+// Tiles straight out of an mmap'ed PPM/PAM/raw file. Tiles of one row band
+// share its pages (a tile row is narrower than a page), so the band is
+// prefetched when its first tile is asked for and dropped from this mapping
+// once its last tile is released; resident memory tracks the bands in flight
+// rather than the whole file.
+struct MappedTileSource : MemoryTileSource
+{
+    const MappedImage &map;
+    std::mutex lock;
+    std::unordered_map<int, long long> bandLeft; // band y -> pixel columns not yet released
+    explicit MappedTileSource(const MappedImage &m) : MemoryTileSource(m.img), map(m) {}
+    bool tile(int x, int y, int w, int h, std::vector<Color> &scratch, ImageView &out) override
+    {
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> g(lock);
+            first = bandLeft.emplace(y, (long long)img.W).second;
+        }
+        if (first)
+            map.adviseRows(y, y + h, MADV_WILLNEED);
+        return MemoryTileSource::tile(x, y, w, h, scratch, out);
+    }
+    void release(int, int y, int w, int h) override
+    {
+        {
+            std::lock_guard<std::mutex> g(lock);
+            auto it = bandLeft.find(y);
+            if (it == bandLeft.end() || (it->second -= w) > 0)
+                return;
+            bandLeft.erase(it);
+        }
+        // clean, file-backed pages: dropping them only costs a refault later.
+        // Inward, so the pages shared with the bands above and below stay.
+        map.adviseRows(y, y + h, MADV_DONTNEED, true);
+    }
+};
+#endif
+
+// Streams tiles from a binary PPM on disk with one fseek/fread per tile row,
+// so only the tile being built is ever resident.
+struct PpmTileSource : TileSource
+{
+    FILE *f = nullptr;
+    PnmInfo info;
+
+    bool open(const std::string &path)
+    {
+        f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        uint8_t head[4096];
+        const size_t got = std::fread(head, 1, sizeof(head), f);
+        if (!parsePnmHeader(head, got, info))
+        {
+            std::fclose(f);
+            f = nullptr;
+            return false;
+        }
+        return true;
+    }
+    ~PpmTileSource() override
+    {
+        if (f)
+            std::fclose(f);
+    }
+    int width() const override { return info.W; }
+    int height() const override { return info.H; }
+    // fseek/fread share one FILE position
+    bool concurrent() const override { return false; }
+    bool tile(int x, int y, int w, int h, std::vector<Color> &scratch, ImageView &out) override
+    {
+        scratch.resize((size_t)w * h);
+        for (int j = 0; j < h; ++j)
+        {
+            const long long off = (long long)info.dataOffset +
+                                  ((long long)(y + j) * info.W + x) * (long long)sizeof(Color);
+            if (!seekFile(f, (uint64_t)off) ||
+                std::fread(&scratch[(size_t)j * w], sizeof(Color), (size_t)w, f) != (size_t)w)
+                return false;
+        }
+        out = viewOf(scratch, w, h);
+        return true;
+    }
+};
+
+// ---------------- Tiled builder ----------------
+struct TiledBuildParams
+{
+    int tileSize = 1024; // rounded up to a power of two
+    int minLeaf = 1;
+    double sdThresh = 16.0;
+    int threads = 0; // 0 = hardware concurrency
+};
+
+struct TiledBuildResult
+{
+    std::vector<uint8_t> bytes; // complete .qtc file
+    BuildStats stats;
+    int rootSize = 0;
+    size_t tiles = 0;
+    size_t peakTileBytes = 0; // pixels + nodes of the largest tile subtree
+};
+
+namespace tiled_detail
+{
+    struct TileOut
+    {
+        std::vector<uint8_t> bytes;
+        BlockStats bs;
+        size_t nodes = 0, leaves = 0;
+        double sse[3] = {0, 0, 0};
+    };
+
+    struct Stitcher
+    {
+        const std::vector<TileOut> &tiles;
+        int W, H, tile, nx, minLeaf;
+        double sdThresh;
+        std::vector<uint8_t> &out;
+        BuildStats &stats;
+
+        BlockStats regionStats(int x, int y, int size) const
+        {
+            BlockStats s;
+            if (size == tile)
+                return tiles[(size_t)(y / tile) * nx + x / tile].bs;
+            int r[4][4];
+            childRects(x, y, size, size, r);
+            for (int i = 0; i < 4; ++i)
+                if (rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                    s.add(regionStats(r[i][0], r[i][1], r[i][2]));
+            return s;
+        }
+
+        void emit(int x, int y, int size)
+        {
+            if (size == tile)
+            {
+                const TileOut &t = tiles[(size_t)(y / tile) * nx + x / tile];
+                out.insert(out.end(), t.bytes.begin(), t.bytes.end());
+                stats.nodes += t.nodes;
+                stats.leaves += t.leaves;
+                for (int c = 0; c < 3; ++c)
+                    stats.sse[c] += t.sse[c];
+                return;
+            }
+            const BlockStats bs = regionStats(x, y, size);
+            stats.nodes++;
+            if (size <= minLeaf || bs.stdDev() <= sdThresh)
+            {
+                const Color c = bs.mean();
+                out.insert(out.end(), {QTC_LEAF, c.r, c.g, c.b});
+                stats.leaves++;
+                stats.addLeafError(bs);
+                return;
+            }
+            out.push_back(QTC_INTERNAL);
+            int r[4][4];
+            childRects(x, y, size, size, r);
+            for (int i = 0; i < 4; ++i)
+                if (rectInImage(W, H, r[i][0], r[i][1], r[i][2], r[i][3]))
+                    emit(r[i][0], r[i][1], r[i][2]);
+        }
+    };
+}
+
+inline bool buildTiled(TileSource &src, const TiledBuildParams &p, TiledBuildResult &res)
+{
+    const int W = src.width(), H = src.height();
+    if (W <= 0 || H <= 0)
+        return false;
+
+    int tile = 1;
+    while (tile < std::max(p.tileSize, 2))
+        tile <<= 1;
+    int rootSize = tile;
+    while (rootSize < W || rootSize < H)
+        rootSize <<= 1;
+    const int nx = (W + tile - 1) / tile, ny = (H + tile - 1) / tile;
+
+    std::vector<tiled_detail::TileOut> tiles((size_t)nx * ny);
+    std::vector<size_t> peak(tiles.size(), 0);
+    std::atomic<bool> readOk{true};
+    std::mutex ioLock;
+
+    parallelFor(tiles.size(), p.threads, [&](size_t idx)
+                {
+        const int tx = (int)(idx % nx) * tile, ty = (int)(idx / nx) * tile;
+        const int tw = std::min(tile, W - tx), th = std::min(tile, H - ty);
+        std::vector<Color> scratch;
+        ImageView view;
+        {
+            std::unique_lock<std::mutex> lk(ioLock, std::defer_lock);
+            if (!src.concurrent())
+                lk.lock();
+            if (!src.tile(tx, ty, tw, th, scratch, view))
+            {
+                readOk = false;
+                return;
+            }
+        }
+        tiled_detail::TileOut &t = tiles[idx];
+        t.bs = blockStats(view, 0, 0, tw, th);
+        BuildStats bs{};
+        // Tile-local coordinates: the padded tile square clipped by the view.
+        Node *sub = buildQT(view, 0, 0, tile, tile, p.minLeaf, p.sdThresh, bs);
+        serializeQT(sub, t.bytes);
+        destroy(sub);
+        src.release(tx, ty, tw, th);
+        t.nodes = bs.nodes;
+        t.leaves = bs.leaves;
+        std::copy(bs.sse, bs.sse + 3, t.sse);
+        peak[idx] = scratch.size() * sizeof(Color) + bs.nodes * sizeof(Node); });
+    if (!readOk)
+        return false;
+
+    res = TiledBuildResult{};
+    res.rootSize = rootSize;
+    res.tiles = tiles.size();
+    res.peakTileBytes = *std::max_element(peak.begin(), peak.end());
+    writeQtcHeader(res.bytes, QtcHeader{(uint32_t)W, (uint32_t)H, (uint32_t)rootSize, (uint32_t)rootSize});
+    tiled_detail::Stitcher st{tiles, W, H, tile, nx, p.minLeaf, p.sdThresh, res.bytes, res.stats};
+    st.emit(0, 0, rootSize);
+    return true;
+}
@@ -0,0 +1,119 @@
+// typed_build.h
+// The builder at an image's own channel count (1, 3 or 4) and sample type
+// (uint8, uint16 or float), fixed at compile time. Grayscale blocks sum one
+// channel instead of three, and 16-bit or HDR sources keep their precision
+// through the statistics, the leaf colors and the export, instead of being
+// cut to the 8-bit RGB Color the viewer works in.
+//
+// The statistics and the builder are quadtree.h's templates; this adds the
+// node type that keeps samples at full precision, its rasterization and the
+// export.
+#pragma once
+
+#include "quadtree.h"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+template <int C, class T>
+struct TypedNode
+{
+    int x, y, w, h;
+    bool leaf = false;
+    T avg[C]{};
+    TypedNode *ch[4]{nullptr, nullptr, nullptr, nullptr};
+};
+
+template <int C, class T>
+inline void setAverage(TypedNode<C, T> *n, const TypedStats<C, T> &bs)
+{
+    for (int c = 0; c < C; ++c)
+        n->avg[c] = bs.mean(c);
+}
+
+template <int C, class T>
+inline void destroy(TypedNode<C, T> *n)
+{
+    if (!n)
+        return;
+    for (auto *c : n->ch)
+        destroy(c);
+    delete n;
+}
+
+// buildQT's builder (quadtree.h) over TypedNodes.
+template <int C, class T>
+inline TypedNode<C, T> *buildTyped(const PixelView<C, T> &px, int x, int y, int w, int h, int minLeaf,
+                                   double sdThresh, TypedBuildStats<C> &stats)
+{
+    return buildTypedQT<TypedNode<C, T>>(px, x, y, w, h, minLeaf, sdThresh, stats);
+}
+
+// Fills out (W*H*C samples) with the leaves' colors; 8-bit RGB goes through
+// the viewer's blitRectBand.
+template <int C, class T>
+inline void rasterizeTyped(const TypedNode<C, T> *root, int W, int H, T *out)
+{
+    forEachLeaf(root, [&](const TypedNode<C, T> *n)
+                {
+        if constexpr (C == 3 && std::is_same_v<T, uint8_t>)
+            blitRectBand(reinterpret_cast<Color *>(out), W, 0, H, n->x, n->y, n->w, n->h,
+                         Color{n->avg[0], n->avg[1], n->avg[2]});
+        else
+        {
+            const int x0 = std::max(0, n->x), y0 = std::max(0, n->y);
+            const int x1 = std::min(W, n->x + n->w), y1 = std::min(H, n->y + n->h);
+            for (int j = y0; j < y1; ++j)
+            {
+                T *row = out + ((size_t)j * W + x0) * C;
+                if constexpr (C == 1 && sizeof(T) == 1)
+                    std::memset(row, n->avg[0], (size_t)(x1 - x0));
+                else
+                    for (int i = x0; i < x1; ++i, row += C)
+                        std::copy(n->avg, n->avg + C, row);
+            }
+        } });
+}
+
+// PNG samples of a typed raster: 8-bit as is, 16-bit big-endian, float
+// clipped to [0, 1] and written as 16-bit.
+template <class T>
+inline void pngSamplesOf(const std::vector<T> &raster, std::vector<uint8_t> &out, int &bitDepth)
+{
+    if constexpr (std::is_same_v<T, uint8_t>)
+    {
+        bitDepth = 8;
+        out.assign(raster.begin(), raster.end());
+    }
+    else
+    {
+        bitDepth = 16;
+        out.resize(raster.size() * 2);
+        for (size_t i = 0; i < raster.size(); ++i)
+        {
+            uint16_t v;
+            if constexpr (std::is_floating_point_v<T>)
+                v = (uint16_t)std::lround(std::clamp((double)raster[i], 0.0, 1.0) * 65535.0);
+            else
+                v = raster[i];
+            out[2 * i] = (uint8_t)(v >> 8);
+            out[2 * i + 1] = (uint8_t)v;
+        }
+    }
+}
+
+// Float rasters at full precision: PFM (1 or 3 channels), rows bottom-up.
+template <int C>
+inline bool writePFM(const std::string &path, const std::vector<float> &raster, int W, int H)
+{
+    static_assert(C == 1 || C == 3, "PFM holds 1 or 3 channels");
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    std::fprintf(f, "%s\n%d %d\n-1.0\n", C == 1 ? "Pf" : "PF", W, H); // negative scale: little-endian
+    bool ok = true;
+    for (int j = H - 1; j >= 0 && ok; --j)
+        ok = std::fwrite(raster.data() + (size_t)j * W * C, sizeof(float), (size_t)W * C, f) == (size_t)W * C;
+    return std::fclose(f) == 0 && ok;
+}